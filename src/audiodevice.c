@@ -0,0 +1,90 @@
+/* audiodevice: opens the audio device through wInitAudio, keeps some
+ * voices playing on it for a while, and prints what the callback saw.
+ * usage:
+ * audiodevice [seconds] [buffer frames]
+ *
+ * SDL_AUDIODRIVER defaults to dummy here, so it runs without a sound
+ * card; set it to use a real device instead. Every second it prints the
+ * callback count, underruns, and the last and worst callback times
+ * (wAudioState's counters). The dummy driver's timing makes the lateness
+ * half of the underrun count noisy (see wAudioState), so underruns are
+ * reported, not failed on. Exits 0 if the callback ran, 1 if it never
+ * did, 2 if the device wouldn't open.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SDL_MAIN_HANDLED
+#include <SDL2/SDL.h>
+
+#include "wpl/wpl.h"
+
+#define Device_Frequency (48000)
+#define Device_BufferFrames (512)
+#define Device_Seconds (5)
+#define Device_Voices (256)
+// A game's worth of sound, not the whole pool
+#define Device_Playing (64)
+
+int main(int argc, char** argv)
+{
+	i32 seconds = argc > 1 ? atoi(argv[1]) : Device_Seconds;
+	i32 bufferFrames = argc > 2 ? atoi(argv[2]) : Device_BufferFrames;
+	if(seconds <= 0 || bufferFrames <= 0) {
+		printf("usage: audiodevice [seconds] [buffer frames]\n");
+		return 2;
+	}
+
+	// Don't override a driver picked on the command line
+	SDL_setenv("SDL_AUDIODRIVER", "dummy", 0);
+	SDL_SetMainReady();
+	wMemoryArena* arena = wArenaBootstrap(wGetMemoryInfo(), 0);
+	wAudioState* audio = wArenaPush(arena, sizeof(wAudioState));
+	if(!wInitAudio(audio, Device_Frequency, bufferFrames, Device_Voices, arena)) {
+		return 2;
+	}
+	printf("%d Hz, %d frame buffer (%.2fms)\n",
+			audio->frequency, audio->bufferFrames,
+			audio->bufferFrames * 1000.0 / audio->frequency);
+
+	// Long enough to outlast the run, pitched so they interpolate
+	wMixerSample tone;
+	memset(&tone, 0, sizeof(wMixerSample));
+	tone.frequency = audio->frequency;
+	tone.length = (u32)(seconds + 1) * audio->frequency;
+	f32* data = wArenaPush(arena, sizeof(f32) * tone.length);
+	for(u32 i = 0; i < tone.length; ++i) {
+		data[i] = 0.5f * sinf(Math_Tau * 440.0f * i / audio->frequency);
+	}
+	tone.data = data;
+	for(i32 i = 0; i < Device_Playing; ++i) {
+		wMixerPlaySample(&audio->mixer, &tone, 0.01f,
+				1.0f + (i % 8) * 0.07f, (i % 5) * 0.5f - 1.0f);
+	}
+
+	for(i32 s = 1; s <= seconds; ++s) {
+		SDL_Delay(1000);
+		printf("%2ds: %6d callbacks, %4d underruns, last %5dus, worst %5dus\n",
+				s, wAtomicLoad(&audio->callbacks),
+				wAtomicLoad(&audio->underruns),
+				wAtomicLoad(&audio->lastCallbackMicros),
+				wAtomicLoad(&audio->worstCallbackMicros));
+	}
+	wQuitAudio(audio);
+
+	i32 callbacks = wAtomicLoad(&audio->callbacks);
+	f64 period = audio->bufferFrames * 1e6 / audio->frequency;
+	printf("underruns %d of %d callbacks, worstCallbackMicros %d "
+			"(%.1f%% of the %.0fus period)\n",
+			wAtomicLoad(&audio->underruns), callbacks,
+			wAtomicLoad(&audio->worstCallbackMicros),
+			wAtomicLoad(&audio->worstCallbackMicros) * 100.0 / period, period);
+	if(callbacks == 0) {
+		printf("FAILED: the device never called back\n");
+		return 1;
+	}
+	return 0;
+}
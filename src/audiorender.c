@@ -0,0 +1,313 @@
+/* audiorender: renders a fixed timeline through the mixer with no audio
+ * device, for timing mixer changes and checking they don't change the
+ * output.
+ * usage:
+ * audiorender [<out.wav | -> [<golden checksum> | <golden.wav>]]
+ *
+ * Everything it plays is generated here, so it needs no assets. With a
+ * golden checksum (hex, as printed), a different checksum fails. With a
+ * golden WAV, anything more than a 16-bit step away from it fails. With
+ * neither, it checks against Render_Golden, so a plain run catches drift.
+ * Exits 0 on a pass, 1 on a mismatch, 2 if it couldn't run.
+ *
+ * Goldens only hold for the build they came from: the compiler's float
+ * settings and the CRT's sinf are both in the output. Render_Golden is
+ * from a 64-bit SSE2 build with gcc -O2 and glibc; a build that rounds
+ * differently needs its own, passed in or put here.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "wpl/wpl.h"
+
+#define Render_Frequency (44100)
+#define Render_Seconds (20)
+#define Render_BlockFrames (512)
+#define Render_Tolerance (1.0f / 32768.0f)
+#define Render_Golden (0x60b5190b3e132fb0ull)
+
+typedef struct
+{
+	wMixerSample kick, blip, noise, pad;
+} RenderSounds;
+
+// Same numbers on every platform, unlike rand()
+static
+u32 renderRandom(u32* state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+static
+f32* pushSound(wMemoryArena* arena, wMixerSample* sample, f32 seconds)
+{
+	memset(sample, 0, sizeof(wMixerSample));
+	sample->frequency = Render_Frequency;
+	sample->length = (u32)(seconds * Render_Frequency);
+	sample->data = wArenaPush(arena, sizeof(f32) * sample->length);
+	return sample->data;
+}
+
+static
+void makeSounds(RenderSounds* sounds, wMemoryArena* arena)
+{
+	f32 rate = (f32)Render_Frequency;
+	f32* kick = pushSound(arena, &sounds->kick, 0.3f);
+	f32 phase = 0.0f;
+	for(u32 i = 0; i < sounds->kick.length; ++i) {
+		f32 t = i / rate;
+		phase += Math_Tau * (50.0f + 120.0f * expf(-t * 30.0f)) / rate;
+		kick[i] = 0.9f * sinf(phase) * expf(-t * 9.0f);
+	}
+
+	f32* blip = pushSound(arena, &sounds->blip, 0.15f);
+	for(u32 i = 0; i < sounds->blip.length; ++i) {
+		f32 t = i / rate;
+		blip[i] = 0.4f * sinf(Math_Tau * 880.0f * t) * expf(-t * 25.0f);
+	}
+
+	u32 seed = 1;
+	f32* noise = pushSound(arena, &sounds->noise, 0.4f);
+	for(u32 i = 0; i < sounds->noise.length; ++i) {
+		f32 t = i / rate;
+		f32 n = (f32)(renderRandom(&seed) & 0xFFFF) / 32768.0f - 1.0f;
+		noise[i] = 0.3f * n * expf(-t * 6.0f);
+	}
+
+	// int16, so the conversion path gets rendered too
+	wMixerSample* pad = &sounds->pad;
+	memset(pad, 0, sizeof(wMixerSample));
+	pad->frequency = Render_Frequency;
+	pad->length = 3 * Render_Frequency;
+	pad->format = wMixer_FormatS16;
+	i16* padData = wArenaPush(arena, sizeof(i16) * pad->length);
+	pad->data = padData;
+	f32 chord[] = {220.0f, 277.18f, 329.63f};
+	for(u32 i = 0; i < pad->length; ++i) {
+		f32 t = i / rate;
+		f32 x = 0.0f;
+		for(i32 k = 0; k < 3; ++k) {
+			x += sinf(Math_Tau * chord[k] * t);
+		}
+		f32 fade = t < 0.5f ? t * 2.0f : (t > 2.5f ? (3.0f - t) * 2.0f : 1.0f);
+		padData[i] = (i16)(x * 0.2f * fade * 32767.0f);
+	}
+}
+
+/* Four beats a second: a kick on every beat, blips wandering across the
+ * stereo field, noise bursts sometimes, and a pad every two seconds that
+ * gets faded and moved between buses. Sixteen voices, so there's
+ * stealing too.
+ */
+static
+isize makeTimeline(wRenderEvent* events, isize capacity,
+		RenderSounds* sounds, i32 sfx, i32 music, i32 ui)
+{
+	isize count = 0;
+	u32 seed = 7;
+	i64 beat = Render_Frequency / 4;
+	for(i64 frame = 0; frame < Render_Seconds * Render_Frequency; frame += beat) {
+		if(count + 8 > capacity) break;
+		i64 n = frame / beat;
+		wRenderEvent* e = events + count++;
+		memset(e, 0, sizeof(wRenderEvent));
+		e->frame = frame;
+		e->type = wRender_Play;
+		e->voice = -1;
+		e->sample = &sounds->kick;
+		e->gain = 1.0f;
+		e->pitch = 1.0f;
+		e->priority = 2;
+
+		e = events + count++;
+		memset(e, 0, sizeof(wRenderEvent));
+		e->frame = frame + (renderRandom(&seed) % 4000);
+		e->type = wRender_Play;
+		e->voice = (i32)(n % 8);
+		e->sample = &sounds->blip;
+		e->gain = 0.5f;
+		e->pitch = 0.5f + (renderRandom(&seed) % 1000) / 500.0f;
+		e->pan = (renderRandom(&seed) % 2001) / 1000.0f - 1.0f;
+
+		if(renderRandom(&seed) % 3 == 0) {
+			e = events + count++;
+			memset(e, 0, sizeof(wRenderEvent));
+			e->frame = frame + beat / 2;
+			e->type = wRender_Play;
+			e->voice = 8 + (i32)(n % 8);
+			e->sample = &sounds->noise;
+			e->gain = 0.4f;
+			e->pitch = 0.8f + (renderRandom(&seed) % 400) / 1000.0f;
+		}
+
+		if(n % 8 == 0) {
+			e = events + count++;
+			memset(e, 0, sizeof(wRenderEvent));
+			e->frame = frame;
+			e->type = wRender_Play;
+			e->voice = 16;
+			e->sample = &sounds->pad;
+			e->gain = 0.8f;
+			e->pitch = n % 16 ? 1.0f : 0.75f;
+			e->priority = 1;
+		} else if(n % 8 == 4) {
+			e = events + count++;
+			memset(e, 0, sizeof(wRenderEvent));
+			e->frame = frame + 100;
+			e->type = wRender_SetGain;
+			e->voice = 16;
+			e->gain = 0.3f;
+
+			e = events + count++;
+			memset(e, 0, sizeof(wRenderEvent));
+			e->frame = frame + 200;
+			e->type = wRender_SetBus;
+			e->voice = 16;
+			e->bus = n % 16 == 4 ? sfx : music;
+		}
+
+		if(n % 16 == 15) {
+			e = events + count++;
+			memset(e, 0, sizeof(wRenderEvent));
+			e->frame = frame + 1000;
+			e->type = wRender_SetBusGain;
+			e->bus = ui;
+			e->gain = (n / 16) % 2 ? 1.0f : 0.5f;
+
+			e = events + count++;
+			memset(e, 0, sizeof(wRenderEvent));
+			e->frame = frame + 3000;
+			e->type = wRender_Stop;
+			e->voice = 16;
+		}
+	}
+
+	// The blips and bursts start a little after their beat; keep it sorted
+	for(isize i = 1; i < count; ++i) {
+		wRenderEvent e = events[i];
+		isize j = i;
+		while(j > 0 && events[j - 1].frame > e.frame) {
+			events[j] = events[j - 1];
+			j--;
+		}
+		events[j] = e;
+	}
+	return count;
+}
+
+static
+u64 parseChecksum(string s, i32* ok)
+{
+	u64 x = 0;
+	*ok = 0;
+	if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) s += 2;
+	for(; *s; ++s) {
+		i32 d = -1;
+		if(*s >= '0' && *s <= '9') d = *s - '0';
+		else if(*s >= 'a' && *s <= 'f') d = *s - 'a' + 10;
+		else if(*s >= 'A' && *s <= 'F') d = *s - 'A' + 10;
+		if(d < 0) return 0;
+		x = (x << 4) | (u64)d;
+		*ok = 1;
+	}
+	return x;
+}
+
+static
+i32 endsWith(string s, string end)
+{
+	isize n = strlen(s), m = strlen(end);
+	return n >= m && strcmp(s + n - m, end) == 0;
+}
+
+int main(int argc, char** argv)
+{
+	wMemoryArena* arena = wArenaBootstrap(wGetMemoryInfo(), 0);
+	wMixer* mixer = wArenaPush(arena, sizeof(wMixer));
+	wMixerInit(mixer, 16, arena);
+	mixer->frequency = Render_Frequency;
+	mixer->interpolation = wMixer_InterpCubic;
+
+	i32 music = wMixerAddBus(mixer, "music", 0);
+	i32 sfx = wMixerAddBus(mixer, "sfx", 0);
+	i32 ui = wMixerAddBus(mixer, "ui", 0);
+	wMixerAddEffect(mixer, music, wMixer_EffectLowPass, 3000.0f, 0.0f, 0.0f, arena);
+	wMixerAddEffect(mixer, music, wMixer_EffectReverb, 0.7f, 0.5f, 0.3f, arena);
+	wMixerAddEffect(mixer, music, wMixer_EffectLimiter, 0.7f, 0.2f, 0.0f, arena);
+	wMixerAddEffect(mixer, sfx, wMixer_EffectHighPass, 80.0f, 0.0f, 0.0f, arena);
+	wMixerAddEffect(mixer, sfx, wMixer_EffectLimiter, 0.8f, 0.05f, 0.0f, arena);
+	wMixerAddEffect(mixer, ui, wMixer_EffectReverb, 0.3f, 0.2f, 0.2f, arena);
+
+	RenderSounds sounds;
+	makeSounds(&sounds, arena);
+	sounds.kick.bus = sfx;
+	sounds.noise.bus = sfx;
+	sounds.blip.bus = ui;
+	sounds.pad.bus = music;
+
+	isize capacity = Render_Seconds * 4 * 8;
+	wRenderEvent* events = wArenaPush(arena, sizeof(wRenderEvent) * capacity);
+	isize eventCount = makeTimeline(events, capacity, &sounds, sfx, music, ui);
+
+	wAudioRender render;
+	wInitAudioRender(&render, mixer, events, eventCount,
+			Render_Seconds * Render_Frequency, Render_BlockFrames, arena);
+	wRunAudioRender(&render);
+
+	f64 blockLength = (f64)Render_BlockFrames / Render_Frequency;
+	printf("%d events, %d blocks of %d frames in %.1fms (%.0fx realtime)\n",
+			(i32)eventCount, (i32)render.blockCount, Render_BlockFrames,
+			render.totalTime * 1000.0,
+			Render_Seconds / (render.totalTime > 0 ? render.totalTime : 1));
+	printf("block time: median %.1fus, p90 %.1fus, p99 %.1fus, worst %.1fus "
+			"(of %.0fus)\n",
+			render.median * 1e6, render.p90 * 1e6, render.p99 * 1e6,
+			render.worst * 1e6, blockLength * 1e6);
+	printf("checksum %016llx\n", (unsigned long long)render.checksum);
+
+	if(argc > 1 && strcmp(argv[1], "-") != 0) {
+		isize size = Wav_HeaderSize + render.frames * 2 * sizeof(f32);
+		void* wav = wArenaPush(arena, size);
+		wEncodeWav(wav, render.output, render.frames, 2, Render_Frequency);
+		if(!wWriteFile(argv[1], wav, size)) {
+			return 2;
+		}
+	}
+
+	if(argc > 2 && endsWith(argv[2], ".wav")) {
+		isize size = 0;
+		u8* golden = wLoadFile(argv[2], &size, arena);
+		if(!golden) {
+			return 2;
+		}
+		f32 diff = wCompareAudioRender(&render, golden, size);
+		if(diff < 0.0f) {
+			return 2;
+		}
+		printf("largest difference from %s: %g\n", argv[2], diff);
+		if(diff > Render_Tolerance) {
+			printf("FAILED: more than %g\n", Render_Tolerance);
+			return 1;
+		}
+	} else {
+		i32 ok = 1;
+		u64 golden = Render_Golden;
+		if(argc > 2) {
+			golden = parseChecksum(argv[2], &ok);
+		}
+		if(!ok) {
+			printf("%s isn't a checksum or a .wav\n", argv[2]);
+			return 2;
+		}
+		if(golden != render.checksum) {
+			printf("FAILED: expected checksum %016llx\n",
+					(unsigned long long)golden);
+			return 1;
+		}
+	}
+	printf("matches\n");
+	return 0;
+}
@@ -0,0 +1,991 @@
+/* bench: times the sprite and mixer paths, so the figures in their
+ * commits can be reproduced.
+ * usage:
+ * bench [sprites | mixer | upload | queue |
+ *        textures [image.png] [count] | vorbis <music.ogg>]
+ *
+ * With no arguments it runs the sprite and mixer sections, which make up
+ * everything they use; upload, queue and textures need a GL context, and
+ * vorbis a track to play.
+ *   sprites: CPU expansion per kernel, packed vs full instance bytes,
+ *            and grid culling against brute force on 1M sprites
+ *   mixer:   256 voices checked against the old per-sample loop, a 256
+ *            voice block at 48kHz, interpolation quality and cost,
+ *            play/stop round trips on a 4096 voice pool, int16 vs float
+ *            samples, and buses with effects
+ *   upload:  streams 10k and 100k instances a frame through a batch on
+ *            glBufferData orphaning and on the wEnableBatchStreaming ring.
+ *            It opens a hidden window; LIBGL_ALWAYS_SOFTWARE=1 (and
+ *            SDL_VIDEODRIVER=offscreen without a display) puts it on
+ *            llvmpipe
+ *   queue:   the test apps' sprite batches drawn straight through and
+ *            through their render queue, with the state changes and
+ *            draws each one cost
+ *   textures: loads count (200) copies of image.png (texture.png)
+ *            synchronously and then through wTextureLoader, for total
+ *            startup time and the worst frame's stall
+ *   vorbis:  decodes the track through the mixer and prints the stream's
+ *            stats
+ *
+ * Times are best of Bench_Runs, and only mean anything with wpl built
+ * optimized (the figures in the commits are gcc -O2 -msse3; the libsdl
+ * target builds without /O2). Besides the timings, the expansion
+ * kernels have to agree with the scalar one, the grid can't miss a
+ * visible sprite, and the block mixer has to stay within a 16-bit step
+ * of the old loop. Exits 0 if they do, 1 if not, 2 if it couldn't run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "wpl/wpl.h"
+#include "shaders.h"
+#include "spritebatch.c"
+
+// The upload section calls glFinish, so it needs the loader's procs
+#define WB_GL_USE_LEGACY
+#define WB_GL_USE_COMPAT
+#define WB_GL_USE_CORE
+#include "wpl/thirdparty/wb_gl_loader.h"
+// For stbi_image_free on the synchronous path
+#include "wpl/thirdparty/stb_image.h"
+
+#define Bench_Runs (5)
+#define Bench_ExpandSprites (65536)
+#define Bench_Sprites (1000000)
+#define Bench_World (20000.0f)
+#define Bench_ViewW (1280.0f)
+#define Bench_ViewH (720.0f)
+#define Bench_CellSize (128.0f)
+#define Bench_Frequency (48000)
+#define Bench_BlockVoices (256)
+#define Bench_PoolVoices (4096)
+#define Bench_ConvertVoices (64)
+#define Bench_Buses (8)
+#define Bench_EffectFrames (512)
+// Vorbis gets mixed this many times faster than it would play
+#define Bench_VorbisSpeed (16.0)
+#define Bench_UploadFrames (120)
+#define Bench_QueueBatches (3)
+#define Bench_QueueRanges (16)
+#define Bench_QueueRange (256)
+#define Bench_Textures (200)
+// Upload budget a frame, as in wplTextureLoader.c's example
+#define Bench_TextureBudget (0.002)
+#define Bench_RefSeconds (2)
+// A 16-bit step, like audiorender's golden WAV check
+#define Bench_RefTolerance (1.0f / 32768.0f)
+
+// Same numbers on every platform, unlike rand()
+static
+u32 benchRandom(u32* state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+static
+f32 benchRange(u32* state, f32 min, f32 max)
+{
+	return min + (max - min) * (f32)(benchRandom(state) & 0xFFFF) / 65536.0f;
+}
+
+static
+void makeSprites(wSprite* sprites, isize count, f32 world, u32 seed)
+{
+	for(isize i = 0; i < count; ++i) {
+		wSprite* s = sprites + i;
+		memset(s, 0, sizeof(wSprite));
+		s->flags = (f32)(benchRandom(&seed) % 9);
+		s->color = benchRandom(&seed) | 0xFF;
+		s->x = benchRange(&seed, -1000.0f, world);
+		s->y = benchRange(&seed, -1000.0f, world);
+		s->z = (f32)(benchRandom(&seed) % 5);
+		s->angle = benchRange(&seed, 0.0f, Math_Tau);
+		s->w = benchRange(&seed, 1.0f, 64.0f);
+		s->h = benchRange(&seed, 1.0f, 64.0f);
+		s->cx = benchRange(&seed, -5.0f, 5.0f);
+		s->cy = benchRange(&seed, -5.0f, 5.0f);
+		s->tx = (i16)(benchRandom(&seed) % 512);
+		s->ty = (i16)(benchRandom(&seed) % 512);
+		s->tw = s->th = 32;
+		// Some too big for their neighbouring cells, for the overflow list
+		if(i % 1000 == 0) {
+			s->w = 900.0f;
+		}
+	}
+}
+
+static
+i32 benchSprites(wMemoryArena* arena)
+{
+	i32 failed = 0;
+	isize count = Bench_ExpandSprites;
+	wSprite* sprites = wArenaPush(arena, sizeof(wSprite) * Bench_Sprites);
+	wVertex* reference = wArenaPush(arena, sizeof(wVertex) * 6 * count);
+	wVertex* verts = wArenaPush(arena, sizeof(wVertex) * 6 * count);
+	makeSprites(sprites, count, Bench_ViewW, 1);
+
+	printf("sprites: expanding %d sprites\n", (i32)count);
+	const char* names[] = {"", "scalar", "SSE", "AVX2"};
+	f64 scalarTime = 0.0;
+	wExpandSpritesScalar(reference, sprites, count, 13.0f, 7.0f, 2.0f,
+			Bench_ViewW, Bench_ViewH);
+	for(i32 mode = wSpriteExpand_Scalar; mode <= wSpriteExpand_AVX2; ++mode) {
+		if(wSetSpriteExpandMode(mode) != mode) {
+			printf("  %-6s not supported here\n", names[mode]);
+			continue;
+		}
+		f64 best = 1e9;
+		for(i32 run = 0; run < Bench_Runs; ++run) {
+			f64 start = wGetTime();
+			wExpandSprites(verts, sprites, count, 13.0f, 7.0f, 2.0f,
+					Bench_ViewW, Bench_ViewH);
+			f64 t = wGetTime() - start;
+			if(t < best) best = t;
+		}
+		if(mode == wSpriteExpand_Scalar) {
+			scalarTime = best;
+		}
+
+		f32 maxDiff = 0.0f;
+		isize colors = 0;
+		for(isize i = 0; i < 6 * count; ++i) {
+			f32* a = (f32*)(reference + i);
+			f32* b = (f32*)(verts + i);
+			for(i32 k = 0; k < 10; ++k) {
+				if(k == 8) continue;
+				f32 d = fabsf(a[k] - b[k]);
+				if(d > maxDiff) maxDiff = d;
+			}
+			if(reference[i].color != verts[i].color) {
+				colors++;
+			}
+		}
+		printf("  %-6s %7.2fms, %5.1fns a sprite, %.1fx scalar, "
+				"max diff %g, %d colors wrong\n",
+				names[mode], best * 1000.0, best * 1e9 / count,
+				scalarTime / best, maxDiff, (i32)colors);
+		if(maxDiff > 1e-3f || colors) {
+			printf("FAILED: %s doesn't match the scalar kernel\n", names[mode]);
+			failed = 1;
+		}
+	}
+	wSetSpriteExpandMode(wSpriteExpand_Auto);
+
+	// Packed positions stop at +-8191px, so these stay inside that and
+	// the grid gets the whole world below
+	count = Bench_Sprites;
+	makeSprites(sprites, count, 8000.0f, 2);
+	wPackedSprite* packed = wArenaPush(arena, sizeof(wPackedSprite) * count);
+	f64 best = 1e9;
+	for(i32 run = 0; run < Bench_Runs; ++run) {
+		f64 start = wGetTime();
+		wPackSprites(packed, sprites, count);
+		f64 t = wGetTime() - start;
+		if(t < best) best = t;
+	}
+	printf("sprites: %d instances are %.1fMB full, %.1fMB packed; "
+			"packing takes %.2fms\n",
+			(i32)count, sizeof(wSprite) * count / 1048576.0,
+			sizeof(wPackedSprite) * count / 1048576.0, best * 1000.0);
+
+	makeSprites(sprites, count, Bench_World, 2);
+	wSpriteGrid grid;
+	i32 cells = (i32)ceilf((Bench_World + 1000.0f) / Bench_CellSize);
+	wInitSpriteGrid(&grid, -1000.0f, -1000.0f, cells, cells, Bench_CellSize,
+			count, arena);
+	wSprite* visible = wArenaPush(arena, sizeof(wSprite) * count);
+	f32 minX = 5000.0f, minY = 5000.0f;
+	f32 maxX = minX + Bench_ViewW, maxY = minY + Bench_ViewH;
+	f64 build = 1e9, cull = 1e9;
+	isize found = 0;
+	for(i32 run = 0; run < Bench_Runs; ++run) {
+		f64 start = wGetTime();
+		wBuildSpriteGrid(&grid, sprites, count);
+		f64 built = wGetTime();
+		found = wCullSprites(&grid, sprites, minX, minY, maxX, maxY, visible);
+		f64 culled = wGetTime();
+		if(built - start < build) build = built - start;
+		if(culled - built < cull) cull = culled - built;
+	}
+
+	// Brute force: expand every sprite and keep the ones with a corner's
+	// bounds on screen. Culling keeps index order, so one pass over what
+	// it found says if anything's missing.
+	wVertex corners[6 * 256];
+	isize truth = 0, missing = 0, at = 0;
+	f64 start = wGetTime();
+	for(isize i = 0; i < count; i += 256) {
+		isize n = count - i < 256 ? count - i : 256;
+		wExpandSprites(corners, sprites + i, n, minX, minY, 1.0f,
+				maxX - minX, maxY - minY);
+		for(isize j = 0; j < n; ++j) {
+			wVertex* v = corners + j * 6;
+			f32 x0 = v->x, x1 = v->x, y0 = v->y, y1 = v->y;
+			for(i32 k = 1; k < 6; ++k) {
+				if(v[k].x < x0) x0 = v[k].x;
+				if(v[k].x > x1) x1 = v[k].x;
+				if(v[k].y < y0) y0 = v[k].y;
+				if(v[k].y > y1) y1 = v[k].y;
+			}
+			if(x1 < -1.0f || x0 > 1.0f || y1 < -1.0f || y0 > 1.0f) continue;
+			truth++;
+			while(at < found &&
+					memcmp(visible + at, sprites + i + j, sizeof(wSprite)) != 0) {
+				at++;
+			}
+			if(at == found) {
+				missing++;
+				at = 0;
+			}
+		}
+	}
+	f64 brute = wGetTime() - start;
+	printf("sprites: culling %d sprites to a %dx%d view: build %.2fms, "
+			"cull %.3fms, brute force %.2fms; %d found, %d on screen, "
+			"%d missing\n",
+			(i32)count, (i32)Bench_ViewW, (i32)Bench_ViewH,
+			build * 1000.0, cull * 1000.0, brute * 1000.0,
+			(i32)found, (i32)truth, (i32)missing);
+	if(missing) {
+		printf("FAILED: the grid missed visible sprites\n");
+		failed = 1;
+	}
+	return failed;
+}
+
+static
+void makeSine(wMixerSample* sample, f32 freq, u32 rate, f32 seconds,
+		wMemoryArena* arena)
+{
+	memset(sample, 0, sizeof(wMixerSample));
+	sample->frequency = rate;
+	sample->length = (u32)(seconds * rate);
+	f32* data = wArenaPush(arena, sizeof(f32) * sample->length);
+	for(u32 i = 0; i < sample->length; ++i) {
+		data[i] = 0.5f * sinf(Math_Tau * freq * i / rate);
+	}
+	sample->data = data;
+}
+
+// Microseconds a block, best of Bench_Runs after a block to run commands
+static
+f64 timeBlocks(wMixer* mixer, f32* out, u32 frames, i32 blocks)
+{
+	wMixerMixAudio(mixer, out, frames);
+	f64 best = 1e9;
+	for(i32 run = 0; run < Bench_Runs; ++run) {
+		f64 start = wGetTime();
+		for(i32 i = 0; i < blocks; ++i) {
+			wMixerMixAudio(mixer, out, frames);
+		}
+		f64 t = (wGetTime() - start) / blocks;
+		if(t < best) best = t;
+	}
+	return best * 1e6;
+}
+
+static
+wMixer* makeMixer(isize voices, wMemoryArena* arena)
+{
+	wMixer* mixer = wArenaPush(arena, sizeof(wMixer));
+	wMixerInit(mixer, voices, arena);
+	mixer->frequency = Bench_Frequency;
+	return mixer;
+}
+
+/* The per-sample loop wMixerMixAudio was before block mixing, kept to
+ * check the block mixer against. Only what the check plays is here: float
+ * samples, no streams, voices started by hand.
+ */
+typedef struct
+{
+	wMixerSample* sample;
+	f32 position, gain, pitch, pan;
+	i32 playing;
+} RefVoice;
+
+static
+f32 refClamp1(f32 sample)
+{
+	if(sample < -1.0f) return -1.0f;
+	else if(sample > 1.0f) return 1.0f;
+	else return sample;
+}
+
+static
+void refMixAudio(RefVoice* voices, isize voiceCount, u32 frequency,
+		f32* out, u32 samples)
+{
+	f32 advance = 1.0f / (f32)frequency;
+	for(; samples > 0; --samples) {
+		f32 left = 0.0f;
+		f32 right = 0.0f;
+		for(isize i = 0; i < voiceCount; ++i) {
+			RefVoice* voice = voices + i;
+			if(!voice->playing) continue;
+			wMixerSample* vsample = voice->sample;
+			u32 position = (u32)voice->position;
+			if(position < vsample->length) {
+				f32 sample = refClamp1(((f32*)vsample->data)[position] * voice->gain);
+				left += refClamp1(sample * (0.5f - voice->pan));
+				right += refClamp1(sample * (0.5f + voice->pan));
+				voice->position += (f32)vsample->frequency * advance * voice->pitch;
+			} else {
+				voice->playing = 0;
+			}
+		}
+		*out++ = refClamp1(left);
+		*out++ = refClamp1(right);
+	}
+}
+
+/* 256 staggered voices through wAudioRender and through the old loop.
+ * Nearest interpolation, pitches whose steps are exact either way, and a
+ * mix that stays under the soft limiter's knee and every old clamp, so
+ * the two should only differ by summing order.
+ */
+static
+i32 checkReference(wMemoryArena* arena)
+{
+	wMixerSample sines[4];
+	f32 freqs[] = {220.0f, 440.0f, 1250.0f, 3000.0f};
+	for(i32 i = 0; i < 4; ++i) {
+		makeSine(sines + i, freqs[i], Bench_Frequency, 0.25f + 0.5f * i, arena);
+	}
+	f32 pitches[] = {0.5f, 1.0f, 2.0f};
+
+	isize count = Bench_BlockVoices;
+	i64 frames = Bench_RefSeconds * Bench_Frequency;
+	wRenderEvent* events = wArenaPush(arena, sizeof(wRenderEvent) * count);
+	RefVoice* voices = wArenaPush(arena, sizeof(RefVoice) * count);
+	for(isize i = 0; i < count; ++i) {
+		wRenderEvent* e = events + i;
+		memset(e, 0, sizeof(wRenderEvent));
+		e->frame = i * 97;
+		e->type = wRender_Play;
+		e->voice = -1;
+		e->sample = sines + i % 4;
+		e->gain = 0.006f;
+		e->pitch = pitches[i % 3];
+		e->pan = (i % 5) * 0.5f - 1.0f;
+	}
+
+	wMixer* mixer = makeMixer(count, arena);
+	mixer->interpolation = wMixer_InterpNearest;
+	wAudioRender render;
+	wInitAudioRender(&render, mixer, events, count, frames,
+			Mixer_BlockSize, arena);
+	wRunAudioRender(&render);
+
+	memset(voices, 0, sizeof(RefVoice) * count);
+	f32* reference = wArenaPush(arena, sizeof(f32) * 2 * frames);
+	isize next = 0;
+	f64 start = wGetTime();
+	for(i64 frame = 0; frame < frames; ++frame) {
+		for(; next < count && events[next].frame == frame; ++next) {
+			RefVoice* v = voices + next;
+			v->sample = events[next].sample;
+			v->gain = events[next].gain;
+			v->pitch = events[next].pitch;
+			v->pan = events[next].pan * 0.5f;
+			v->playing = 1;
+		}
+		refMixAudio(voices, count, Bench_Frequency, reference + frame * 2, 1);
+	}
+	f64 refTime = wGetTime() - start;
+
+	isize size = Wav_HeaderSize + frames * 2 * sizeof(f32);
+	void* wav = wArenaPush(arena, size);
+	wEncodeWav(wav, reference, frames, 2, Bench_Frequency);
+	f32 diff = wCompareAudioRender(&render, wav, size);
+	if(diff < 0.0f) {
+		return 2;
+	}
+
+	f64 blocks = (f64)frames / Mixer_BlockSize;
+	printf("mixer: %d voices against the old per-sample loop: "
+			"%.1fus vs %.1fus a block (%.1fx), largest difference %g\n",
+			(i32)count, render.totalTime * 1e6 / blocks, refTime * 1e6 / blocks,
+			refTime / render.totalTime, diff);
+	if(diff > Bench_RefTolerance) {
+		printf("FAILED: more than %g from the old loop\n", Bench_RefTolerance);
+		return 1;
+	}
+	return 0;
+}
+
+static
+i32 benchMixer(wMemoryArena* arena)
+{
+	f32* out = wArenaPush(arena, sizeof(f32) * 2 * Bench_Frequency);
+	const char* names[] = {"nearest", "linear", "cubic", "sinc"};
+
+	i32 failed = checkReference(arena);
+	wMixerSample tone;
+	makeSine(&tone, 440.0f, Bench_Frequency, 10.0f, arena);
+	printf("mixer: %d voices at %dHz, %d frame blocks\n",
+			Bench_BlockVoices, Bench_Frequency, Mixer_BlockSize);
+	for(i32 mode = wMixer_InterpNearest; mode <= wMixer_InterpSinc; ++mode) {
+		for(i32 pitched = 0; pitched < 2; ++pitched) {
+			wMixer* mixer = makeMixer(Bench_BlockVoices, arena);
+			mixer->interpolation = mode;
+			for(i32 i = 0; i < Bench_BlockVoices; ++i) {
+				wMixerPlaySample(mixer, &tone, 0.002f,
+						pitched ? 1.37f : 1.0f, (i % 5) * 0.1f - 0.2f);
+			}
+			f64 us = timeBlocks(mixer, out, Mixer_BlockSize, 64);
+			printf("  %-7s %s: %7.1fus a block, %4.1f%% of the block\n",
+					names[mode], pitched ? "pitched  " : "unpitched", us,
+					us * 1e-4 * Bench_Frequency / Mixer_BlockSize);
+		}
+	}
+
+	// A 22.05k sine played at 44.1k; the error is whatever's left after
+	// fitting the ideal sine's gain, so pan and master gain don't count
+	printf("mixer: interpolating 22.05kHz up to 44.1kHz\n");
+	i32 rate = 44100;
+	f32 tones[] = {1000.0f, 5000.0f};
+	for(i32 t = 0; t < 2; ++t) {
+		wMixerSample low;
+		makeSine(&low, tones[t], 22050, 1.5f, arena);
+		printf("  %4.0fHz SNR:", tones[t]);
+		for(i32 mode = wMixer_InterpNearest; mode <= wMixer_InterpSinc; ++mode) {
+			wMixer* mixer = makeMixer(4, arena);
+			mixer->frequency = rate;
+			mixer->interpolation = mode;
+			wMixerPlaySample(mixer, &low, 1.0f, 1.0f, 0.0f);
+			wMixerMixAudio(mixer, out, rate);
+			f64 cross = 0.0, power = 0.0;
+			for(i32 i = 100; i < rate; ++i) {
+				f64 ideal = sin(Math_Tau * tones[t] * i / rate);
+				cross += out[i * 2] * ideal;
+				power += ideal * ideal;
+			}
+			f64 gain = cross / power, error = 0.0, signal = 0.0;
+			for(i32 i = 100; i < rate; ++i) {
+				f64 ideal = gain * sin(Math_Tau * tones[t] * i / rate);
+				error += (out[i * 2] - ideal) * (out[i * 2] - ideal);
+				signal += ideal * ideal;
+			}
+			printf(" %s %.0fdB%s", names[mode], 10.0 * log10(signal / error),
+					mode < wMixer_InterpSinc ? "," : "\n");
+		}
+	}
+	printf("  cost:");
+	for(i32 mode = wMixer_InterpNearest; mode <= wMixer_InterpSinc; ++mode) {
+		wMixer* mixer = makeMixer(Bench_ConvertVoices, arena);
+		mixer->interpolation = mode;
+		for(i32 i = 0; i < Bench_ConvertVoices; ++i) {
+			wMixerPlaySample(mixer, &tone, 0.01f, 1.37f, 0.0f);
+		}
+		f64 us = timeBlocks(mixer, out, 512, 64);
+		printf(" %s %.1fns%s", names[mode], us * 1000.0 / (512 * Bench_ConvertVoices),
+				mode < wMixer_InterpSinc ? "," : " a voice-frame\n");
+	}
+
+	// Fill the pool, stop it oldest first, with the audio thread's share
+	// (a 1 frame mix) every 512 calls
+	wMixerSample silence;
+	memset(&silence, 0, sizeof(wMixerSample));
+	silence.frequency = Bench_Frequency;
+	silence.length = Bench_Frequency * 60;
+	silence.data = wArenaPush(arena, sizeof(f32) * silence.length);
+	memset(silence.data, 0, sizeof(f32) * silence.length);
+	wMixer* pool = makeMixer(Bench_PoolVoices, arena);
+	i32* handles = wArenaPush(arena, sizeof(i32) * Bench_PoolVoices);
+	i64 calls = 0;
+	f64 start = wGetTime();
+	for(i32 round = 0; round < 200; ++round) {
+		for(i32 i = 0; i < Bench_PoolVoices; ++i) {
+			handles[i] = wMixerPlaySample(pool, &silence, (i % 7) * 0.1f, 1.0f, 0.0f);
+			calls++;
+			if(i % 512 == 511) wMixerMixAudio(pool, out, 1);
+		}
+		for(i32 i = 0; i < Bench_PoolVoices; ++i) {
+			wMixerStopVoice(pool, handles[i]);
+			calls++;
+			if(i % 512 == 511) wMixerMixAudio(pool, out, 1);
+		}
+		wMixerMixAudio(pool, out, 1);
+	}
+	f64 elapsed = wGetTime() - start;
+	printf("mixer: play/stop on a %d voice pool: %.2fM calls a second\n",
+			Bench_PoolVoices, calls / elapsed / 1e6);
+
+	wMixerSample shorts = tone;
+	i16* data = wArenaPush(arena, sizeof(i16) * tone.length);
+	for(u32 i = 0; i < tone.length; ++i) {
+		data[i] = (i16)(((f32*)tone.data)[i] * 32767.0f);
+	}
+	shorts.data = data;
+	shorts.format = wMixer_FormatS16;
+	f64 formatUs[2];
+	for(i32 format = 0; format < 2; ++format) {
+		wMixer* mixer = makeMixer(Bench_ConvertVoices, arena);
+		for(i32 i = 0; i < Bench_ConvertVoices; ++i) {
+			wMixerPlaySample(mixer, format ? &shorts : &tone, 0.01f, 1.37f, 0.0f);
+		}
+		formatUs[format] = timeBlocks(mixer, out, 512, 64);
+	}
+	printf("mixer: %d voices from float %.1fus, from int16 %.1fus a block "
+			"(%+.0f%%)\n",
+			Bench_ConvertVoices, formatUs[0], formatUs[1],
+			(formatUs[1] / formatUs[0] - 1.0) * 100.0);
+
+	// A voice on each bus; with no effects that's the baseline the
+	// effects are measured against
+	i32 chains[][3] = {
+		{-1, -1, -1},
+		{wMixer_EffectLowPass, -1, -1},
+		{wMixer_EffectLimiter, -1, -1},
+		{wMixer_EffectReverb, -1, -1},
+		{wMixer_EffectLowPass, wMixer_EffectReverb, wMixer_EffectLimiter}
+	};
+	const char* chainNames[] = {"none", "biquad", "limiter", "reverb", "all three"};
+	f32 params[][3] = {
+		{2000.0f, 0.0f, 0.0f}, {2000.0f, 0.0f, 0.0f},
+		{0.6f, 0.5f, 0.3f}, {0.8f, 0.1f, 0.0f}
+	};
+	f64 baseline = 0.0;
+	printf("mixer: %d buses at %d frame blocks\n", Bench_Buses, Bench_EffectFrames);
+	for(i32 c = 0; c < 5; ++c) {
+		wMixer* mixer = makeMixer(Bench_Buses, arena);
+		for(i32 b = 0; b < Bench_Buses; ++b) {
+			char name[16];
+			snprintf(name, sizeof(name), "bus%d", b);
+			i32 bus = wMixerAddBus(mixer, name, 0);
+			for(i32 e = 0; e < 3 && chains[c][e] >= 0; ++e) {
+				f32* p = params[chains[c][e]];
+				wMixerAddEffect(mixer, bus, chains[c][e], p[0], p[1], p[2], arena);
+			}
+			i32 voice = wMixerPlaySample(mixer, &tone, 0.1f, 1.0f, 0.0f);
+			wMixerSetVoiceBus(mixer, voice, bus);
+		}
+		f64 us = timeBlocks(mixer, out, Bench_EffectFrames, 64);
+		if(c == 0) {
+			baseline = us;
+			printf("  %-9s %6.1fus a block\n", chainNames[c], us);
+		} else {
+			printf("  %-9s %6.1fus a block, %4.1fus an effect, %.1f%% of the block\n",
+					chainNames[c], us,
+					(us - baseline) / (Bench_Buses * (c == 4 ? 3 : 1)),
+					us * 1e-4 * Bench_Frequency / Bench_EffectFrames);
+		}
+	}
+	return failed;
+}
+
+/* Upload
+ * Streams the same instances through wDrawBatch with the batch left on
+ * glBufferData orphaning and then switched to the ring, the way the test
+ * apps' createSpriteBatch does. Instances draw at scale 0, so nothing
+ * rasterizes and software GL times the upload rather than the fill.
+ */
+
+typedef struct
+{
+	f32 x, y;
+	f32 vw, vh;
+	f32 scale;
+	u32 tint;
+	f32 itw, ith;
+} UploadUniforms;
+
+// Hidden window for the sections that need a context; wCreateWindow
+// doesn't say if the context failed, but the procs stay NULL if it did
+static
+i32 openBenchWindow(wWindow* window, wState* state, wInputState* input)
+{
+	wWindowDef def = wDefineWindow("bench");
+	def.hidden = 1;
+	def.width = 64;
+	def.height = 64;
+	memset(window, 0, sizeof(wWindow));
+	wCreateWindow(&def, window);
+	if(!window->windowHandle || !glFinish || !glGenBuffers) {
+		printf("couldn't create a GL context\n");
+		return 0;
+	}
+	wInitState(state, input);
+	return 1;
+}
+
+static
+wShader* makeSpriteShader(wMemoryArena* arena)
+{
+	wShader* shader = wArenaPush(arena, sizeof(wShader));
+	wInitShader(shader, sizeof(wSprite));
+	shader->defaultDivisor = 1;
+	wCreateAttrib(shader, "vFlags", wShader_Float, 1, offsetof(wSprite, flags));
+	wCreateAttrib(shader, "vColor", wShader_NormalizedByte, 4, offsetof(wSprite, color));
+	wCreateAttrib(shader, "vPos", wShader_Float, 3, offsetof(wSprite, x));
+	wCreateAttrib(shader, "vAngle", wShader_Float, 1, offsetof(wSprite, angle));
+	wCreateAttrib(shader, "vSize", wShader_Float, 2, offsetof(wSprite, w));
+	wCreateAttrib(shader, "vCenter", wShader_Float, 2, offsetof(wSprite, cx));
+	wCreateAttrib(shader, "vTexture", wShader_FloatShort, 4, offsetof(wSprite, tx));
+	wCreateUniform(shader, "uOffset", wShader_Float, 2, offsetof(UploadUniforms, x));
+	wCreateUniform(shader, "uViewport", wShader_Float, 2, offsetof(UploadUniforms, vw));
+	wCreateUniform(shader, "uScale", wShader_Float, 1, offsetof(UploadUniforms, scale));
+	wCreateUniform(shader, "uTint", wShader_NormalizedByte, 4, offsetof(UploadUniforms, tint));
+	wCreateUniform(shader, "uInvTextureSize", wShader_Float, 2, offsetof(UploadUniforms, itw));
+	wAddSourceToShader(shader, EGL3_vert, wShader_Vertex);
+	wAddSourceToShader(shader, EGL3_frag, wShader_Frag);
+	if(!wFinalizeShader(shader)) {
+		return NULL;
+	}
+	return shader;
+}
+
+static
+i32 benchUpload(wMemoryArena* arena)
+{
+	wWindow window;
+	wState state;
+	wInputState input;
+	if(!openBenchWindow(&window, &state, &input)) {
+		return 2;
+	}
+	wShader* shader = makeSpriteShader(arena);
+	if(!shader) {
+		wQuit();
+		return 2;
+	}
+	wTexture texture;
+	memset(&texture, 0, sizeof(wTexture));
+	UploadUniforms uniforms = {0, 0, 64, 64, 0.0f, 0xFFFFFFFF, 1, 1};
+
+	const char* modeNames[] = {"orphan", "ring (unsynchronized)", "ring (persistent)"};
+	isize counts[] = {10000, 100000};
+	wSprite* sprites = wArenaPush(arena, sizeof(wSprite) * counts[1]);
+	makeSprites(sprites, counts[1], Bench_ViewW, 3);
+	printf("upload: %s, %d frames a run\n",
+			(const char*)glGetString(GL_RENDERER), Bench_UploadFrames);
+
+	for(i32 c = 0; c < 2; ++c) {
+		isize count = counts[c];
+		f64 orphanFrame = 0.0;
+		for(i32 ring = 0; ring < 2; ++ring) {
+			wRenderBatch batch;
+			wInitBatch(&batch, &texture, shader,
+					wRenderBatch_ArraysInstanced, wRenderBatch_TriangleStrip,
+					sizeof(wSprite), 4, sprites, NULL);
+			wConstructBatchGraphicsState(&batch);
+			i32 mode = wRenderBatch_UploadOrphan;
+			if(ring) {
+				mode = wEnableBatchStreaming(&batch, count);
+				if(mode == wRenderBatch_UploadOrphan) {
+					printf("  %6d: no ring here (needs glMapBufferRange and fences)\n",
+							(i32)count);
+					continue;
+				}
+			}
+
+			// Frame time is everything up to glFinish at the end of the
+			// run, so a ring waiting on its fences shows up too
+			f64 bestFrame = 1e9, worstSubmit = 0.0;
+			for(i32 run = 0; run < Bench_Runs; ++run) {
+				glFinish();
+				f64 start = wGetTime();
+				for(i32 f = 0; f < Bench_UploadFrames; ++f) {
+					sprites[f % count].x += 1.0f;
+					batch.elementCount = count;
+					f64 submit = wGetTime();
+					wDrawBatch(&state, &batch, &uniforms);
+					submit = wGetTime() - submit;
+					if(submit > worstSubmit) worstSubmit = submit;
+				}
+				glFinish();
+				f64 frame = (wGetTime() - start) / Bench_UploadFrames;
+				if(frame < bestFrame) bestFrame = frame;
+			}
+			if(!ring) {
+				orphanFrame = bestFrame;
+			}
+
+			f64 mb = sizeof(wSprite) * count / 1048576.0;
+			printf("  %6d: %-22s %6.3fms a frame, %5.0fMB/s, "
+					"worst submit %6.3fms%s",
+					(i32)count, modeNames[mode], bestFrame * 1000.0,
+					mb / bestFrame, worstSubmit * 1000.0, ring ? "" : "\n");
+			if(ring) {
+				printf(", %.2fx orphan\n", orphanFrame / bestFrame);
+			}
+			glDeleteBuffers(1, &batch.vbo);
+			if(batch.vao) glDeleteVertexArrays(1, &batch.vao);
+		}
+	}
+	wQuit();
+	return 0;
+}
+
+/* Queue
+ * A frame of the test apps' sprite batches: three batches, two in the
+ * full layout and one packed, each flushing Bench_QueueRanges times a
+ * frame, interleaved. Drawn straight through that's a program switch on
+ * nearly every draw; queued, the two full batches have the same shader,
+ * texture and view, so they merge even though their uniforms live in
+ * different batches.
+ */
+
+static
+void drawQueueFrame(SpriteBatch** batches, Sprite* sprites)
+{
+	for(i32 r = 0; r < Bench_QueueRanges; ++r) {
+		for(i32 b = 0; b < Bench_QueueBatches; ++b) {
+			Sprite* range = sprites + (r * Bench_QueueBatches + b) * Bench_QueueRange;
+			for(i32 i = 0; i < Bench_QueueRange; ++i) {
+				addSprite(batches[b], range + i);
+			}
+			drawSprites(batches[b]);
+		}
+	}
+	flushSpriteQueue(batches[0]->renderer);
+}
+
+static
+i32 benchQueue(wMemoryArena* arena)
+{
+	wWindow window;
+	wState state;
+	wInputState input;
+	if(!openBenchWindow(&window, &state, &input)) {
+		return 2;
+	}
+	wTexture texture;
+	memset(&texture, 0, sizeof(wTexture));
+	texture.w = texture.h = 256;
+	SpriteRenderer renderer;
+	memset(&renderer, 0, sizeof(SpriteRenderer));
+	renderer.texture = &texture;
+	renderer.state = &state;
+	createSpriteShaders(&renderer, arena);
+	if(!renderer.packedShader) {
+		printf("queue: needs instancing\n");
+		wQuit();
+		return 2;
+	}
+
+	isize count = Bench_QueueBatches * Bench_QueueRanges * Bench_QueueRange;
+	Sprite* sprites = wArenaPush(arena, sizeof(Sprite) * count);
+	makeSprites(sprites, count, 64.0f, 4);
+	for(isize i = 0; i < count; ++i) {
+		sprites[i].tw = sprites[i].th = 16;
+	}
+	SpriteBatch* batches[Bench_QueueBatches];
+	i32 layouts[] = {SpriteLayout_Full, SpriteLayout_Packed, SpriteLayout_Full};
+	for(i32 b = 0; b < Bench_QueueBatches; ++b) {
+		batches[b] = createSpriteBatch(&renderer,
+				Bench_QueueRange, layouts[b], arena);
+	}
+	printf("queue: %s, %d batches, %d draws of %d sprites a frame\n",
+			(const char*)glGetString(GL_RENDERER), Bench_QueueBatches,
+			Bench_QueueBatches * Bench_QueueRanges, Bench_QueueRange);
+
+	const char* names[] = {"direct", "queued"};
+	for(i32 queued = 0; queued < 2; ++queued) {
+		if(queued) {
+			enableSpriteQueue(&renderer, 256, wGetMemoryInfo(), arena);
+		}
+
+		// One frame to settle the caches, then count a frame's worth
+		wInvalidateRenderState();
+		drawQueueFrame(batches, sprites);
+		wRenderStats stats;
+		wGetRenderStats(NULL, 1);
+		isize queuedDraws = queued ? renderer.queue->queuedDraws : 0;
+		drawQueueFrame(batches, sprites);
+		wGetRenderStats(&stats, 1);
+		if(queued) {
+			queuedDraws = renderer.queue->queuedDraws - queuedDraws;
+		}
+
+		f64 best = 1e9;
+		for(i32 run = 0; run < Bench_Runs; ++run) {
+			glFinish();
+			f64 start = wGetTime();
+			for(i32 f = 0; f < Bench_UploadFrames; ++f) {
+				drawQueueFrame(batches, sprites);
+			}
+			glFinish();
+			f64 frame = (wGetTime() - start) / Bench_UploadFrames;
+			if(frame < best) best = frame;
+		}
+
+		printf("  %s: %3d draws", names[queued], (i32)stats.draws);
+		if(queued) {
+			printf(" (%d queued)", (i32)queuedDraws);
+		}
+		printf(", program binds %d (%d skipped), texture binds %d (%d skipped), "
+				"uniforms %d (%d skipped), %.3fms a frame\n",
+				(i32)stats.programBinds, (i32)stats.programBindsSkipped,
+				(i32)stats.textureBinds, (i32)stats.textureBindsSkipped,
+				(i32)stats.uniformsUploaded, (i32)stats.uniformsSkipped,
+				best * 1000.0);
+	}
+	wQuit();
+	return 0;
+}
+
+/* Textures
+ * Loads the same PNG Bench_Textures times, first one after another on the
+ * main thread the way startup used to, then through wTextureLoader with
+ * frames calling wUpdateTextureLoader back to back. Every copy is read,
+ * decoded and uploaded on its own, so it costs what that many different
+ * images that size would.
+ */
+static
+i32 benchTextures(string filename, i32 count, wMemoryArena* arena)
+{
+	wWindow window;
+	wState state;
+	wInputState input;
+	if(!openBenchWindow(&window, &state, &input)) {
+		return 2;
+	}
+	// Names are relative to where it's run from, not where bench is
+	window.basePath = (i8*)"";
+	wTexture* textures = wArenaPush(arena, sizeof(wTexture) * count);
+
+	f64 start = wGetTime();
+	for(i32 i = 0; i < count; ++i) {
+		isize size = 0;
+		wArenaStartTemp(arena);
+		u8* data = wLoadFile(filename, &size, arena);
+		i32 ok = data && wInitTexture(textures + i, data, size);
+		wArenaEndTemp(arena);
+		if(!ok) {
+			printf("couldn't load %s\n", filename);
+			wQuit();
+			return 2;
+		}
+		wUploadTexture(textures + i);
+		stbi_image_free(textures[i].pixels);
+	}
+	glFinish();
+	f64 syncTime = wGetTime() - start;
+	printf("textures: %d copies of %s (%dx%d)\n",
+			count, filename, (i32)textures[0].w, (i32)textures[0].h);
+	printf("  synchronous: %7.1fms, all of it one stall\n", syncTime * 1000.0);
+	for(i32 i = 0; i < count; ++i) {
+		glDeleteTextures(1, &textures[i].glIndex);
+	}
+
+	wTextureLoader loader;
+	wInitTextureLoader(&loader, &window, count, 0, arena);
+	for(i32 i = 0; i < count; ++i) {
+		wQueueTexture(&loader, filename);
+	}
+	i32 frames = 0;
+	start = wGetTime();
+	wStartTextureLoader(&loader);
+	while(!wTextureLoaderDone(&loader)) {
+		wUpdateTextureLoader(&loader, Bench_TextureBudget);
+		frames++;
+	}
+	glFinish();
+	f64 asyncTime = wGetTime() - start;
+	printf("  loader:      %7.1fms over %d frames (%d workers), "
+			"worst frame %.2fms, %d failed\n",
+			asyncTime * 1000.0, frames, loader.workerCount,
+			loader.worstFrame * 1000.0, (i32)loader.failed);
+	printf("  %.1fx faster to load, worst stall %.1fx shorter\n",
+			syncTime / asyncTime, syncTime / loader.worstFrame);
+	wQuit();
+	return loader.failed ? 1 : 0;
+}
+
+static
+i32 benchVorbis(const char* filename, wMemoryArena* arena)
+{
+	isize size = 0;
+	void* data = wLoadFile(filename, &size, arena);
+	if(!data) {
+		return 2;
+	}
+	wVorbisStream vs;
+	if(!wInitVorbisStream(&vs, data, size, 4096, arena)) {
+		return 2;
+	}
+	wMixer* mixer = makeMixer(4, arena);
+	mixer->frequency = vs.frequency;
+	if(wMixerPlayStream(mixer, &vs.stream, 1.0f) < 0) {
+		wDestroyVorbisStream(&vs);
+		return 2;
+	}
+
+	// Mixed Bench_VorbisSpeed times faster than it plays, so starved
+	// says whether the decoder keeps up with that much headroom
+	f32 out[2 * 512];
+	f64 mixed = 0.0, limit = 2.0 * vs.totalFrames / vs.frequency / Bench_VorbisSpeed + 10.0;
+	f64 start = wGetTime();
+	while(wMixerGetActiveVoices(mixer) > 0) {
+		f64 now = wGetTime() - start;
+		if(now > limit) {
+			printf("FAILED: the stream never finished\n");
+			wDestroyVorbisStream(&vs);
+			return 1;
+		}
+		if(now * Bench_VorbisSpeed < mixed) continue;
+		wMixerMixAudio(mixer, out, 512);
+		mixed += 512.0 / vs.frequency;
+	}
+
+	f64 seconds = (f64)vs.totalFrames / vs.frequency;
+	printf("vorbis: %s, %.1fs, %d channels at %dHz\n",
+			filename, seconds, vs.channels, vs.frequency);
+	printf("  resident %.0fKB, all decoded as float %.1fMB\n",
+			vs.residentBytes / 1024.0,
+			sizeof(f32) * 2.0 * vs.totalFrames / 1048576.0);
+	printf("  decoded %lld frames in %.1fms, %.0fx realtime; "
+			"starved %d times at %.0fx\n",
+			(long long)vs.decodedFrames, vs.decodeTime * 1000.0,
+			vs.decodeTime > 0.0 ? vs.decodedFrames / (vs.decodeTime * vs.frequency) : 0.0,
+			vs.starved, Bench_VorbisSpeed);
+	wDestroyVorbisStream(&vs);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	wMemoryArena* arena = wArenaBootstrap(wGetMemoryInfo(), 0);
+	if(argc > 1 && strcmp(argv[1], "vorbis") == 0) {
+		if(argc < 3) {
+			printf("usage: bench vorbis <music.ogg>\n");
+			return 2;
+		}
+		return benchVorbis(argv[2], arena);
+	}
+
+	if(argc > 1 && strcmp(argv[1], "upload") == 0) {
+		return benchUpload(arena);
+	}
+	if(argc > 1 && strcmp(argv[1], "queue") == 0) {
+		return benchQueue(arena);
+	}
+	if(argc > 1 && strcmp(argv[1], "textures") == 0) {
+		string filename = argc > 2 ? argv[2] : "texture.png";
+		i32 count = argc > 3 ? atoi(argv[3]) : Bench_Textures;
+		if(count <= 0) {
+			printf("usage: bench textures [image.png] [count]\n");
+			return 2;
+		}
+		return benchTextures(filename, count, arena);
+	}
+
+	i32 failed = 0;
+	if(argc == 1 || strcmp(argv[1], "sprites") == 0) {
+		failed |= benchSprites(arena);
+	} else if(strcmp(argv[1], "mixer") != 0) {
+		printf("usage: bench [sprites | mixer | upload | queue | "
+				"textures [image.png] [count] | vorbis <music.ogg>]\n");
+		return 2;
+	}
+	if(argc == 1 || strcmp(argv[1], "mixer") == 0) {
+		failed |= benchMixer(arena);
+	}
+	return failed;
+}
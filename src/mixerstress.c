@@ -0,0 +1,243 @@
+/* mixerstress: hammers the mixer from the game thread while a second
+ * thread mixes, to shake out races on the command and finished rings.
+ * usage:
+ * mixerstress [calls]
+ *
+ * The game thread makes random play, stop and set calls (samples,
+ * streams, stealing, instance limits, buses and effects added on the fly)
+ * and checks the voice counts after each one. Then it stops everything,
+ * waits for the audio thread to hand every voice back, and checks nothing
+ * is left playing or held. Exits 0 if the counts come out right, 1 if
+ * not, 2 if it couldn't run.
+ *
+ * The counts only catch races that lose a voice. To have TSan check the
+ * rings themselves, build it with -fsanitize=thread (gcc or clang) along
+ * with wpl.c; it should run without reports.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wpl/wpl.h"
+
+#define Stress_Voices (64)
+#define Stress_Handles (128)
+#define Stress_Samples (4)
+#define Stress_Streams (2)
+#define Stress_BlockFrames (300)
+#define Stress_Calls (500000)
+// Calls per game "frame"; each waits for a block to be mixed, so the
+// command queue (Mixer_CommandCapacity) never fills
+#define Stress_FrameCalls (256)
+#define Stress_DrainSeconds (10.0)
+
+typedef struct
+{
+	wMixer* mixer;
+	volatile i32 done;
+	volatile i32 blocks;
+} StressState;
+
+// Same numbers on every platform, unlike rand()
+static
+u32 stressRandom(u32* state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+// Loops one short buffer for as long as the voice lasts
+static
+void stressStreamProc(wMixerSample* sample, void* userdata)
+{
+	sample->data = userdata;
+	sample->length = 2 * 256;
+}
+
+static
+i32 stressMixThread(void* data)
+{
+	StressState* state = data;
+	f32 out[Stress_BlockFrames * 2];
+	while(!wAtomicLoad(&state->done)) {
+		wMixerMixAudio(state->mixer, out, Stress_BlockFrames);
+		wAtomicAdd(&state->blocks, 1);
+	}
+	// Whatever was queued last still gets run
+	wMixerMixAudio(state->mixer, out, Stress_BlockFrames);
+	return 0;
+}
+
+static
+i32 checkInstances(wMixerSample* samples)
+{
+	for(i32 i = 0; i < Stress_Samples; ++i) {
+		wMixerSample* s = samples + i;
+		if(s->instances < 0 ||
+				(s->maxInstances > 0 && s->instances > s->maxInstances)) {
+			printf("FAILED: sample %d has %d instances\n", i, s->instances);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	i64 calls = argc > 1 ? atoi(argv[1]) : Stress_Calls;
+	if(calls <= 0) {
+		printf("usage: mixerstress [calls]\n");
+		return 2;
+	}
+
+	wMemoryArena* arena = wArenaBootstrap(wGetMemoryInfo(), 0);
+	wMixer* mixer = wArenaPush(arena, sizeof(wMixer));
+	wMixerInit(mixer, Stress_Voices, arena);
+
+	wMixerSample samples[Stress_Samples];
+	for(i32 i = 0; i < Stress_Samples; ++i) {
+		wMixerSample* s = samples + i;
+		memset(s, 0, sizeof(wMixerSample));
+		s->frequency = 44100;
+		s->length = 500 + i * 1000;
+		s->data = wArenaPush(arena, sizeof(f32) * s->length);
+		for(u32 j = 0; j < s->length; ++j) {
+			((f32*)s->data)[j] = (j & 64) ? 0.1f : -0.1f;
+		}
+	}
+	// One sample with a limit, so dropped plays get exercised too
+	samples[1].maxInstances = 3;
+
+	f32* loop = wArenaPush(arena, sizeof(f32) * 2 * 256);
+	memset(loop, 0, sizeof(f32) * 2 * 256);
+	wMixerStream streams[Stress_Streams];
+	for(i32 i = 0; i < Stress_Streams; ++i) {
+		memset(streams + i, 0, sizeof(wMixerStream));
+		streams[i].userdata = loop;
+		streams[i].callback = stressStreamProc;
+		streams[i].sample.frequency = 44100;
+	}
+
+	StressState state;
+	memset(&state, 0, sizeof(StressState));
+	state.mixer = mixer;
+	void* thread = wCreateThread(stressMixThread, &state);
+	if(!thread) {
+		printf("couldn't start the mixing thread\n");
+		return 2;
+	}
+
+	i32 handles[Stress_Handles];
+	for(i32 i = 0; i < Stress_Handles; ++i) {
+		handles[i] = -1;
+	}
+	i64 plays = 0, dropped = 0;
+	i32 busCount = 1;
+	u32 seed = 2;
+	i32 failed = 0;
+	for(i64 n = 0; n < calls && !failed; ++n) {
+		if(n % Stress_FrameCalls == 0) {
+			i32 blocks = wAtomicLoad(&state.blocks);
+			while(wAtomicLoad(&state.blocks) == blocks);
+		}
+		u32 r = stressRandom(&seed) % 100;
+		i32* handle = handles + stressRandom(&seed) % Stress_Handles;
+		if(r < 35) {
+			wMixerSample* s = samples + stressRandom(&seed) % Stress_Samples;
+			i32 h = wMixerPlaySampleEx(mixer, s, 0.1f,
+					1.0f + (stressRandom(&seed) % 3) * 0.1f, 0.0f,
+					(i32)(stressRandom(&seed) % 3));
+			if(h < 0) {
+				dropped++;
+			} else {
+				plays++;
+				*handle = h;
+			}
+		} else if(r < 38) {
+			i32 h = wMixerPlayStream(mixer,
+					streams + stressRandom(&seed) % Stress_Streams, 0.1f);
+			if(h >= 0) {
+				*handle = h;
+			}
+		} else if(r < 55) {
+			wMixerStopVoice(mixer, *handle);
+		} else if(r < 65) {
+			wMixerSetVoiceGain(mixer, *handle,
+					(stressRandom(&seed) % 100) * 0.01f);
+		} else if(r < 72) {
+			wMixerSetVoicePitch(mixer, *handle, 1.5f);
+		} else if(r < 79) {
+			wMixerSetVoicePan(mixer, *handle, 0.3f);
+		} else if(r < 84) {
+			wMixerSetVoiceInterpolation(mixer, *handle,
+					(i32)(stressRandom(&seed) % 4));
+		} else if(r < 90) {
+			wMixerSetVoiceBus(mixer, *handle,
+					(i32)(stressRandom(&seed) % busCount));
+		} else if(r < 94) {
+			wMixerSetBusGain(mixer, (i32)(stressRandom(&seed) % busCount), 0.5f);
+		} else if(r < 99) {
+			// Quiet; reaping happens on the next play
+			wMixerGetActiveVoices(mixer);
+		} else if(stressRandom(&seed) % 16 == 0) {
+			wMixerStopSample(mixer, samples + stressRandom(&seed) % Stress_Samples);
+			wMixerStopStream(mixer, streams + stressRandom(&seed) % Stress_Streams);
+		} else if(busCount < Mixer_MaxBuses && stressRandom(&seed) % 64 == 0) {
+			char name[16];
+			snprintf(name, sizeof(name), "bus%d", busCount);
+			i32 bus = wMixerAddBus(mixer, name, 0);
+			wMixerAddEffect(mixer, bus, wMixer_EffectLowPass + busCount % 4,
+					0.5f, 0.3f, 0.2f, arena);
+			busCount++;
+		}
+
+		i32 active = wMixerGetActiveVoices(mixer);
+		if(active < 0 || active > Stress_Voices) {
+			printf("FAILED: %d active voices\n", active);
+			failed = 1;
+		}
+		if(!checkInstances(samples)) {
+			failed = 1;
+		}
+	}
+
+	for(i32 i = 0; i < Stress_Samples; ++i) {
+		wMixerStopSample(mixer, samples + i);
+	}
+	for(i32 i = 0; i < Stress_Streams; ++i) {
+		wMixerStopStream(mixer, streams + i);
+	}
+	f64 start = wGetTime();
+	while(wMixerGetActiveVoices(mixer) > 0) {
+		if(wGetTime() - start > Stress_DrainSeconds) {
+			printf("FAILED: %d voices never came back\n",
+					wMixerGetActiveVoices(mixer));
+			failed = 1;
+			break;
+		}
+	}
+	wAtomicStore(&state.done, 1);
+	wWaitThread(thread);
+
+	for(i32 i = 0; i < Stress_Samples; ++i) {
+		if(samples[i].instances != 0) {
+			printf("FAILED: sample %d still has %d instances\n",
+					i, samples[i].instances);
+			failed = 1;
+		}
+	}
+	if(mixer->firstPlaying != -1) {
+		printf("FAILED: the audio thread still has voices playing\n");
+		failed = 1;
+	}
+
+	printf("%lld calls, %lld plays, %lld dropped, %d buses, %d blocks mixed\n",
+			(long long)calls, (long long)plays, (long long)dropped,
+			busCount, state.blocks);
+	if(failed) {
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
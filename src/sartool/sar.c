@@ -1,6 +1,11 @@
 /* Sar, the sane archive
  * usage:
- * sar <archive.sar> x|c <files>
+ * sar <archive.sar> x <directory>
+ * sar <archive.sar> c [-j <threads>] [-z fast|small|auto] <files or folders>
+ * sar <archive.sar> t <atlas name> <width> <height> <pngs or folders>
+ *
+ * c on an archive that's already there only packs the files that changed
+ * since it was last built.
  */ 
 
 #include <Windows.h>
@@ -26,57 +31,18 @@
 #define WB_ALLOC_BACKEND_API static
 #include "..\wpl\thirdparty\wb_alloc.h"
 
-typedef uint32_t u32;
-typedef uint64_t u64;
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_NO_HDR
+#define STBI_NO_LINEAR
+#include "..\wpl\thirdparty\stb_image.h"
 
-#define wSar_Magic (0x77536172)
-#define wSar_Version (101)
-#pragma pack(push, 4)
-#define wSar_NameLen (55)
-typedef struct wSarId wSarId;
-typedef struct wSarHeader wSarHeader;
-typedef struct wSarFile wSarFile;
-typedef struct wSarArchive wSarArchive;
-typedef struct wSarEditingArchive wSarEditingArchive;
+#define WB_LZ4_IMPLEMENTATION
+#define WB_LZ4_ENCODER
+#include "..\wpl\thirdparty\wb_lz4.h"
 
-struct wSarId
-{
-	u64 hash;
-	char name[wSar_NameLen], zero;
-};
-
-struct wSarFile
-{
-	wSarId id;
-	u32 kind;
-	u32 version;
-	u64 compressedSize;
-	u64 fullSize;
-	u64 location;
-};
-
-struct wSarHeader
-{
-	u32 magic;
-	u32 version;
-	u64 unused[3];
-
-	wSarId id;
-	u64 archiveSize;
-	u64 fileCount;
-	u64 fileTableLocation;
-	u64 descriptionLength;
-};
-
-struct wSarArchive
-{
-	char* base;
-	wSarHeader* header;
-	char* description;
-	wSarFile* files;
-};
-
-#pragma pack(pop)
+#include "..\wpl\wplUtil.c"
+#include "..\wpl\wplAtlas.c"
 
 wSarArchive* wSarLoad(void* file, wMemoryArena* alloc)
 {
@@ -120,22 +86,75 @@ isize wSarGetFileIndexByHash(wSarArchive* archive, u64 key)
 
 wSarFile* wSarGetFile(wSarArchive* archive, string name)
 {
-	u64 hash = wSarHashString(name);
+	u64 hash = wHashString(name);
 	isize index = wSarGetFileIndexByHash(archive, hash);
-	if(hash == -1) return NULL;
+	if(index == -1) return NULL;
 	return archive->files + index;
 }
 
+// One stream in codec; returns 0 if it didn't come out as size bytes
+static
+i32 sarDecode(u32 codec, u8* output, usize size, u8* input, usize inputSize)
+{
+	if(codec == wSar_KindLz4) {
+		return wbLz4Decode(input, inputSize, output, size) == (isize)size;
+	} else if(codec == wSar_KindDeflate) {
+		return tinfl_decompress_mem_to_mem(output, size, 
+				input, inputSize, 0) == size;
+	}
+	return 0;
+}
+
+/* Any kind, into output, which needs fullSize bytes. Returns how many
+ * bytes came out.
+ */
+usize sarInflate(wSarFile* file, u8* input, u8* output)
+{
+	u32 layout = wSarKindLayout(file->kind);
+	if(layout == wSar_KindStored) {
+		memcpy(output, input, file->fullSize);
+		return file->fullSize;
+	} else if(layout != wSar_KindChunked) {
+		if(!sarDecode(layout, output, file->fullSize, 
+					input, file->compressedSize)) {
+			return 0;
+		}
+		return file->fullSize;
+	}
+
+	u32 codec = wSarKindChunkCodec(file->kind);
+	usize count = (file->fullSize + wSar_ChunkSize - 1) / wSar_ChunkSize;
+	usize total = 0;
+	for(usize i = 0; i < count; ++i) {
+		u64 start, end;
+		memcpy(&start, input + sizeof(u64) * i, sizeof(u64));
+		memcpy(&end, input + sizeof(u64) * (i + 1), sizeof(u64));
+		usize size = file->fullSize - total;
+		if(size > wSar_ChunkSize) size = wSar_ChunkSize;
+		if(end - start == size) {
+			memcpy(output + total, input + start, size);
+		} else if(!sarDecode(codec, output + total, size, 
+					input + start, end - start)) {
+			break;
+		}
+		total += size;
+	}
+	return total;
+}
+
 void* wSarGetFileData(wSarArchive* archive, string name, 
 		isize* sizeOut, wMemoryArena* arena)
 {
 	wSarFile* file = wSarGetFile(archive, name);
 	void* input = archive->base + file->location;
+	if(file->kind == wSar_KindStored) {
+		if(sizeOut) {
+			*sizeOut = file->fullSize;
+		}
+		return input;
+	}
 	void* output = wArenaPush(arena, file->fullSize + 8);
-	tinfl_decompress_mem_to_mem(
-			output, file->fullSize + 8, 
-			input, file->compressedSize, 
-			0);
+	sarInflate(file, input, output);
 	if(sizeOut) {
 		*sizeOut = file->fullSize;
 	}
@@ -146,20 +165,31 @@ void* wSarGetFileData(wSarArchive* archive, string name,
 #ifdef wSar_Editing_Implementation
 struct wSarEditingArchive
 {
-	wMemoryArena *finalAlloc, *tableAlloc, *dataAlloc;
+	wMemoryArena *finalAlloc, *tableAlloc, *dataAlloc, *sourceAlloc;
 
 
 	wSarHeader* header;
 	char* description;
 	
 	u64 fileCount;
-	//While in the editingarchive, file->location refers
-	//to the offset within the dataAlloc thing
+	//While in the editingarchive, file->location is the address of
+	//the file's data: in dataAlloc, a worker's arena, or the archive
+	//it was opened from. writeArchive lays it all out.
 	wSarFile* fileTable;
-	void* fileData;
-
+	//One for each file in fileTable, in the same order
+	wSarSource* sources;
 };
 
+// NULL for archives from before there were sources
+wSarSource* wSarGetSources(wSarArchive* archive)
+{
+	wSarHeader* header = archive->header;
+	if(header->version < 103 || header->sourceTableLocation == 0) {
+		return NULL;
+	}
+	return (void*)(archive->base + header->sourceTableLocation);
+}
+
 wSarEditingArchive* wSarCreateEditingArchive(wSarArchive* existing)
 {
 	wSarEditingArchive local = {0}, *e; 
@@ -167,13 +197,14 @@ wSarEditingArchive* wSarCreateEditingArchive(wSarArchive* existing)
 	local.finalAlloc = wArenaBootstrap(memInfo, 0);
 	local.tableAlloc = wArenaBootstrap(memInfo, 0);
 	local.dataAlloc = wArenaBootstrap(memInfo, 0);
+	local.sourceAlloc = wArenaBootstrap(memInfo, 0);
 	e = wArenaPush(local.finalAlloc, sizeof(wSarEditingArchive));
 	*e = local;
 
 	e->header = wArenaPush(e->finalAlloc, sizeof(wSarHeader));
 	e->fileCount = 0;
 	e->fileTable = e->tableAlloc->head;
-	e->fileData = e->dataAlloc->head;
+	e->sources = e->sourceAlloc->head;
 
 	if(existing) {
 		wSarHeader* exhead = existing->header;
@@ -182,9 +213,11 @@ wSarEditingArchive* wSarCreateEditingArchive(wSarArchive* existing)
 		e->header->version = wSar_Version;
 		if(exhead->descriptionLength > 0) {
 			e->description = wArenaPush(e->finalAlloc, exhead->descriptionLength);
+			memcpy(e->description, existing->description, 
+					exhead->descriptionLength);
 		}
 
-		// copy file table and data over
+		// The data stays where it is until it's written out
 		if(exhead->fileCount > 0) {
 			usize ftsize = sizeof(wSarFile) * exhead->fileCount;
 			wArenaPush(e->tableAlloc, ftsize);
@@ -193,9 +226,17 @@ wSarEditingArchive* wSarCreateEditingArchive(wSarArchive* existing)
 			e->header->fileCount = e->fileCount;
 			for(usize i = 0; i < e->fileCount; ++i) {
 				wSarFile* f = e->fileTable + i;
-				void* data = wArenaPush(e->dataAlloc, f->compressedSize);
-				memcpy(data, existing->base + f->location, f->compressedSize);
-				f->location = (usize)data - (usize)e->fileData;
+				f->location += (usize)existing->base;
+			}
+
+			// Without them, everything counts as changed
+			usize stsize = sizeof(wSarSource) * exhead->fileCount;
+			wArenaPush(e->sourceAlloc, stsize);
+			wSarSource* sources = wSarGetSources(existing);
+			if(sources) {
+				memcpy(e->sources, sources, stsize);
+			} else {
+				memset(e->sources, 0, stsize);
 			}
 
 		}
@@ -204,90 +245,481 @@ wSarEditingArchive* wSarCreateEditingArchive(wSarArchive* existing)
 	return e;
 }
 
-/*		void *tdefl_compress_mem_to_heap(
- * 			void *src, 
- * 			size_t src_len, 
- * 			size_t *out_len, 
- * 			int flags);
- **/
-void wSarAddFile(wSarEditingArchive* e, string name, void* data, isize size)
+/* deflate is for small files, so it gets the probes zip's default level
+ * uses; with the one it used to get, it was barely better than storing.
+ */
+#define Sar_DeflateFlags (TDEFL_DEFAULT_MAX_PROBES)
+// Deeper finds longer matches; LZ4 decodes just as fast either way
+#define Sar_Lz4Attempts (64)
+
+// Each codec's state, one for each thread
+typedef struct
 {
-	e->fileCount++;
-	e->header->fileCount++;
-	wSarFile* file = wArenaPush(e->tableAlloc, sizeof(wSarFile));
-	isize namelen = strlen(name);
-	memcpy(file->id.name, name, namelen <= wSar_NameLen ? namelen : wSar_NameLen);
-	file->id.hash = wSarHashString(file->id.name);
+	tdefl_compressor* deflate;
+	wbLz4Encoder* lz4;
+} SarEncoder;
+
+typedef struct
+{
+	u8* at;
+	usize size, capacity;
+} SarOutput;
+
+static
+mz_bool sarPutBytes(const void* buf, int len, void* user)
+{
+	SarOutput* out = user;
+	if(out->size + len > out->capacity) return MZ_FALSE;
+	memcpy(out->at + out->size, buf, len);
+	out->size += len;
+	return MZ_TRUE;
+}
+
+/* Compresses with codec into the capacity bytes at output; a new codec
+ * goes here. Returns the size, or 0 if it didn't fit.
+ */
+static
+usize sarEncode(SarEncoder* encoder, u32 codec, 
+		u8* data, isize size, u8* output, usize capacity)
+{
+	if(codec == wSar_KindLz4) {
+		return (usize)wbLz4Encode(encoder->lz4, data, size, 
+				output, capacity, Sar_Lz4Attempts);
+	}
+	SarOutput out = {0};
+	out.at = output;
+	out.capacity = capacity;
+	tdefl_init(encoder->deflate, sarPutBytes, &out, Sar_DeflateFlags);
+	if(tdefl_compress_buffer(encoder->deflate, data, size, TDEFL_FINISH) != 
+			TDEFL_STATUS_DONE) {
+		return 0;
+	}
+	return out.size;
+}
+
+// Files this big are chunked, so the game can inflate them on threads
+#define Sar_ChunkAbove (4 * wSar_ChunkSize)
+
+/* Compresses each chunk on its own, after the offset table; chunks that
+ * don't shrink are stored. If that doesn't save a 32nd overall, it gives
+ * the space back and returns 0.
+ */
+static
+i32 sarPackChunks(wSarFile* file, SarEncoder* encoder, u32 codec,
+		wMemoryArena* arena, u8* data, isize size)
+{
+	isize count = (size + wSar_ChunkSize - 1) / wSar_ChunkSize;
+	usize tableSize = sizeof(u64) * (count + 1);
+	u8* start = wArenaPush(arena, tableSize + size);
+	u64* offsets = (u64*)start;
+	usize at = tableSize;
+	for(isize i = 0; i < count; ++i) {
+		isize chunkSize = size - i * wSar_ChunkSize;
+		if(chunkSize > wSar_ChunkSize) chunkSize = wSar_ChunkSize;
+		u8* chunk = data + i * wSar_ChunkSize;
+		// A chunk that isn't shorter than it started reads as stored
+		usize packed = sarEncode(encoder, codec, chunk, chunkSize, 
+				start + at, chunkSize - 1);
+		if(!packed) {
+			memcpy(start + at, chunk, chunkSize);
+			packed = chunkSize;
+		}
+		offsets[i] = at;
+		at += packed;
+	}
+	offsets[count] = at;
+	if(at - tableSize + size / 32 >= (usize)size) {
+		arena->head = start;
+		return 0;
+	}
+	file->kind = wSar_KindChunked | (codec << 8);
+	file->compressedSize = at;
 	file->fullSize = size;
-	//TODO(will) compress and copy data
-	usize compressedSize = 0;
-	void* compressed = tdefl_compress_mem_to_heap(data, size, &compressedSize, 0);
-	if(compressed) {
-		void* finalBuf = wArenaPush(e->dataAlloc, compressedSize);
-		memcpy(finalBuf, compressed, compressedSize);
-		file->compressedSize = compressedSize;
-		file->location = (usize)finalBuf - (usize)e->fileData;
+	file->location = (usize)start;
+	arena->head = (void*)alignTo((usize)start + at, arena->align);
+	return 1;
+}
+
+/* Compresses straight onto the end of arena, where it stays. Things that
+ * are already compressed, like pngs and oggs, barely shrink; if codec
+ * can't save a 32nd, it gives up early and the data is stored as is, so
+ * the game can use it straight out of the archive. Big files are chunked.
+ */
+void wSarPackFile(wSarFile* file, SarEncoder* encoder, u32 codec,
+		wMemoryArena* arena, void* data, isize size)
+{
+	if(size >= Sar_ChunkAbove && 
+			sarPackChunks(file, encoder, codec, arena, data, size)) {
+		return;
+	}
+	u8* at = wArenaPush(arena, size);
+	usize capacity = size - size / 32;
+	usize packed = sarEncode(encoder, codec, data, size, at, capacity);
+	if(packed && packed < capacity) {
+		file->kind = codec;
+		file->compressedSize = packed;
+		// Give back what it didn't use
+		arena->head = (void*)alignTo((usize)at + packed, arena->align);
 	} else {
-		//we've got an error
-		//... but no way to handle it
+		memcpy(at, data, size);
+		file->kind = wSar_KindStored;
+		file->compressedSize = size;
+	}
+	file->fullSize = size;
+	file->location = (usize)at;
+}
+
+// What an entry was packed with; stored is its own codec
+static
+u32 sarFileCodec(wSarFile* file)
+{
+	u32 layout = wSarKindLayout(file->kind);
+	return layout == wSar_KindChunked ? wSarKindChunkCodec(file->kind) : layout;
+}
+
+enum {
+	// By extension, from sarFastExtensions
+	Sar_PolicyAuto,
+	// Everything LZ4
+	Sar_PolicyFast,
+	// Everything deflate
+	Sar_PolicySmall
+};
+
+/* Things the game reads at load time, and needs straight away, want to
+ * decode fast; everything else wants to be small.
+ */
+static
+string sarFastExtensions[] = {
+	".glsl", ".vert", ".frag", ".wav", ".bmp", ".tga", ".rgba",
+	".obj", ".ttf", ".bin", ".lvl", ".map", ".atlas", NULL
+};
+
+static
+u32 sarChooseCodec(string name, i32 policy)
+{
+	if(policy == Sar_PolicyFast) return wSar_KindLz4;
+	if(policy == Sar_PolicySmall) return wSar_KindDeflate;
+	string extension = strrchr(name, '.');
+	if(extension) {
+		for(isize i = 0; sarFastExtensions[i]; ++i) {
+			if(strcmp(extension, sarFastExtensions[i]) == 0) {
+				return wSar_KindLz4;
+			}
+		}
+	}
+	return wSar_KindDeflate;
+}
+
+/* Four FNV lanes, eight bytes at a time, so hashing keeps up with reading.
+ * It only has to tell a file from the last version of itself.
+ */
+static
+u64 sarHashContent(const u8* data, isize size)
+{
+	u64 lanes[4] = {
+		wHash_FNV64_Basis, wHash_FNV64_Basis + 1, 
+		wHash_FNV64_Basis + 2, wHash_FNV64_Basis + 3
+	};
+	isize i = 0;
+	for(; i + 32 <= size; i += 32) {
+		for(i32 k = 0; k < 4; ++k) {
+			u64 x;
+			memcpy(&x, data + i + k * 8, 8);
+			u64 h = (lanes[k] ^ x) * wHash_FNV64_Prime;
+			lanes[k] = h ^ (h >> 29);
+		}
+	}
+	u64 hash = (u64)size;
+	for(i32 k = 0; k < 4; ++k) {
+		hash = (hash ^ lanes[k]) * wHash_FNV64_Prime;
+	}
+	for(; i < size; ++i) {
+		hash = (hash ^ data[i]) * wHash_FNV64_Prime;
+	}
+	return hash;
+}
+
+// Fills in everything but the hash; returns 0 if it can't see the file
+static
+i32 sarStatFile(string path, wSarSource* source)
+{
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if(!GetFileAttributesExA(path, GetFileExInfoStandard, &info)) {
+		return 0;
 	}
-	free(compressed);
+	source->contentHash = 0;
+	source->modified = ((u64)info.ftLastWriteTime.dwHighDateTime << 32) |
+		info.ftLastWriteTime.dwLowDateTime;
+	source->size = ((u64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	return 1;
+}
+
+static
+void sarNameFile(wSarFile* file, string name)
+{
+	isize namelen = strlen(name);
+	memcpy(file->id.name, name, namelen <= wSar_NameLen ? namelen : wSar_NameLen);
+	file->id.hash = wHashString(file->id.name);
+}
+
+void wSarAddFile(wSarEditingArchive* e, string name, void* data, isize size, 
+		u32 codec)
+{
+	static SarEncoder encoder;
+	if(!encoder.deflate) {
+		encoder.deflate = malloc(sizeof(tdefl_compressor));
+		encoder.lz4 = malloc(sizeof(wbLz4Encoder));
+	}
+	e->fileCount++;
+	e->header->fileCount++;
+	wSarFile* file = wArenaPush(e->tableAlloc, sizeof(wSarFile));
+	sarNameFile(file, name);
+	wSarPackFile(file, &encoder, codec, e->dataAlloc, data, size);
+	// Not from a file, so the next build can only go by the hash
+	wSarSource* source = wArenaPush(e->sourceAlloc, sizeof(wSarSource));
+	source->contentHash = sarHashContent(data, size);
+	source->modified = 0;
+	source->size = size;
 	//You're also free to free the input data too
 }
 
-void wSarSortFiles(wSarFile* array, isize count)
+/* Files to add, packed on a pool of threads. Each worker reads and
+ * compresses whichever file is next into its own arena, with its own
+ * encoders. The order they finish in doesn't matter: they go in
+ * the table in the order they were queued.
+ *
+ * When the archive's being rebuilt, a file with the same size and time
+ * as last time isn't even read, and one with the same contents isn't
+ * compressed again: it keeps the bytes it already has in the archive.
+ */
+#define Sar_MaxThreads (64)
+
+typedef struct
+{
+	char* path;
+	char* name;
+	wSarFile file;
+	wSarSource source;
+	u32 codec;
+	i32 failed, packed;
+} SarJob;
+
+typedef struct
+{
+	SarJob* jobs;
+	LONG count;
+	volatile LONG next;
+	// What's being rebuilt, if anything
+	wSarArchive* existing;
+	wSarSource* sources;
+} SarPool;
+
+typedef struct
+{
+	SarPool* pool;
+	wMemoryArena* arena;
+	SarEncoder encoder;
+	HANDLE thread;
+	isize bytes;
+} SarWorker;
+
+u8* loadFile(char* filename, isize* size_out);
+
+static
+DWORD WINAPI sarWorkerMain(LPVOID data)
 {
-	for(isize i = 1; i < count; ++i) {
-		isize j = i - 1;
-		if(array[j].id.hash > array[i].id.hash) {
-			wSarFile temp = array[i];
-			while((j >= 0) && (array[j].id.hash > temp.id.hash)) {
-				array[j + 1] = array[j];
-				j--;
+	SarWorker* worker = data;
+	SarPool* pool = worker->pool;
+	while(1) {
+		LONG index = InterlockedIncrement(&pool->next) - 1;
+		if(index >= pool->count) break;
+		SarJob* job = pool->jobs + index;
+		if(!sarStatFile(job->path, &job->source)) {
+			job->failed = 1;
+			continue;
+		}
+		sarNameFile(&job->file, job->name);
+
+		wSarFile* oldFile = NULL;
+		wSarSource* oldSource = NULL;
+		if(pool->sources) {
+			isize old = wSarGetFileIndexByHash(pool->existing, job->file.id.hash);
+			if(old != -1) {
+				oldFile = pool->existing->files + old;
+				oldSource = pool->sources + old;
 			}
-			array[j + 1] = temp;
 		}
+		// Unless the policy's changed what it should be packed with
+		if(oldFile && sarFileCodec(oldFile) != job->codec && 
+				sarFileCodec(oldFile) != wSar_KindStored) {
+			oldFile = NULL;
+			oldSource = NULL;
+		}
+		if(oldSource && oldSource->contentHash != 0 &&
+				oldSource->modified == job->source.modified &&
+				oldSource->size == job->source.size) {
+			job->source.contentHash = oldSource->contentHash;
+			job->file = *oldFile;
+			job->file.location += (usize)pool->existing->base;
+			continue;
+		}
+
+		isize size = 0;
+		u8* fileData = loadFile(job->path, &size);
+		if(!fileData) {
+			job->failed = 1;
+			continue;
+		}
+		job->source.size = size;
+		job->source.contentHash = sarHashContent(fileData, size);
+		if(oldSource && oldSource->contentHash == job->source.contentHash &&
+				oldSource->size == job->source.size) {
+			// Only touched
+			job->file = *oldFile;
+			job->file.location += (usize)pool->existing->base;
+		} else {
+			wSarPackFile(&job->file, &worker->encoder, job->codec, 
+					worker->arena, fileData, size);
+			job->packed = 1;
+			worker->bytes += size;
+		}
+		free(fileData);
 	}
+	return 0;
 }
 
-void* wSarFinalizeArchive(wSarEditingArchive* e, isize* outSize)
-{
-	//at this point:
-	// 		all files we want are in the archive
-	// 		all the data we want is in the data array
-	// 		the header is set up correctly
-	//here's what we need to do:
-	//		sort all files by hash
-	//		contiguify the three arenas into one
-	//		relocate file->location based on new base position 
-	//			right now file->location points to the start of the file
-	//			from e->fileData.
-	//			We need it to point to the start of the file from the
-	//			archive's base (from 0)
-	//		....write it to file??? (not here)
-	wSarSortFiles(e->fileTable, e->fileCount);
-
-	usize fileTableSize = sizeof(wSarFile) * e->fileCount;
-	wSarFile* newFileTable = wArenaPush(e->finalAlloc, fileTableSize);
-	memcpy(newFileTable, e->fileTable, fileTableSize);
-	//A reminder that (usize)e->header represents the start of the file
-	e->header->fileTableLocation = (usize)newFileTable - (usize)e->header;
-
-	usize fileDataSize = (usize)e->dataAlloc->head - (usize)e->fileData;
-	void* newDataBuf = wArenaPush(e->finalAlloc, fileDataSize);
-	memcpy(newDataBuf, e->fileData, fileDataSize);
+/* Packs all the jobs on threadCount threads (0 for one per core), and
+ * adds them to the archive in the order they're in. The workers' arenas
+ * hold the data until it's written, so they're never freed. existing is
+ * the archive e came from, or NULL.
+ */
+void wSarAddFiles(wSarEditingArchive* e, wSarArchive* existing, 
+		SarJob* jobs, isize count, i32 threadCount)
+{
+	if(threadCount <= 0) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		threadCount = (i32)info.dwNumberOfProcessors;
+	}
+	if(threadCount > Sar_MaxThreads) threadCount = Sar_MaxThreads;
+	if(threadCount > count) threadCount = (i32)count;
+	if(threadCount < 1) threadCount = 1;
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	SarPool pool = {0};
+	pool.jobs = jobs;
+	pool.count = (LONG)count;
+	pool.next = 0;
+	if(existing) {
+		pool.existing = existing;
+		pool.sources = wSarGetSources(existing);
+	}
+	SarWorker workers[Sar_MaxThreads];
+	wMemoryInfo memInfo = wGetMemoryInfo();
+	for(i32 i = 0; i < threadCount; ++i) {
+		SarWorker* worker = workers + i;
+		memset(worker, 0, sizeof(SarWorker));
+		worker->pool = &pool;
+		worker->arena = wArenaBootstrap(memInfo, 0);
+		worker->encoder.deflate = malloc(sizeof(tdefl_compressor));
+		worker->encoder.lz4 = malloc(sizeof(wbLz4Encoder));
+	}
+	// The main thread is the last worker
+	for(i32 i = 0; i < threadCount - 1; ++i) {
+		workers[i].thread = CreateThread(NULL, 0, sarWorkerMain,
+				workers + i, 0, NULL);
+	}
+	sarWorkerMain(workers + threadCount - 1);
+	isize bytes = 0;
+	for(i32 i = 0; i < threadCount; ++i) {
+		if(workers[i].thread) {
+			WaitForSingleObject(workers[i].thread, INFINITE);
+			CloseHandle(workers[i].thread);
+		}
+		free(workers[i].encoder.deflate);
+		free(workers[i].encoder.lz4);
+		bytes += workers[i].bytes;
+	}
 
-	for(usize i = 0; i < e->fileCount; ++i) {
-		wSarFile* f = newFileTable + i;
-		f->location += (usize)newDataBuf - (usize)e->header;
+	isize added = 0, packed = 0;
+	for(isize i = 0; i < count; ++i) {
+		SarJob* job = jobs + i;
+		if(job->failed) {
+			fprintf(stderr, "Error: couldn't read %s. Skipping...\n", job->path);
+			continue;
+		}
+		if(job->packed) {
+			printf("| Adding %s\n", job->name);
+			packed++;
+		}
+		wSarFile* file = wArenaPush(e->tableAlloc, sizeof(wSarFile));
+		*file = job->file;
+		wSarSource* source = wArenaPush(e->sourceAlloc, sizeof(wSarSource));
+		*source = job->source;
+		added++;
+	}
+	e->fileCount += added;
+	e->header->fileCount += added;
+
+	QueryPerformanceCounter(&end);
+	f64 seconds = (f64)(end.QuadPart - start.QuadPart) / (f64)frequency.QuadPart;
+	if(seconds <= 0) seconds = 1e-6;
+	printf("Packed %d files, %.1f MB, in %.2fs on %d threads: "
+			"%.0f files/s, %.1f MB/s\n",
+			(i32)packed, bytes / 1048576.0, seconds, threadCount,
+			packed / seconds, bytes / 1048576.0 / seconds);
+	if(added > packed) {
+		printf("Kept %d unchanged files as they were\n", (i32)(added - packed));
 	}
+}
 
-	isize size = (isize)e->finalAlloc->head - (isize)e->header;
-	if(outSize) *outSize = size;
+typedef struct
+{
+	u64 hash;
+	isize index;
+} SarSortKey;
 
-	e->header->magic = wSar_Magic;
-	e->header->version = wSar_Version;
-	return e->header;
+static
+i32 compareSortKeys(const void* a, const void* b)
+{
+	const SarSortKey* x = a;
+	const SarSortKey* y = b;
+	if(x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+	return x->index < y->index ? -1 : (x->index > y->index ? 1 : 0);
+}
+
+/* Sorts by hash, and the sources along with them. The keys carry the
+ * order files were added in, so this comes out the same every time, and
+ * where a name was added more than once, the last one wins. Returns how
+ * many files are left.
+ */
+isize wSarSortFiles(wSarFile* array, wSarSource* sources, isize count)
+{
+	if(count <= 0) return 0;
+	SarSortKey* keys = malloc(sizeof(SarSortKey) * count);
+	wSarFile* sorted = malloc(sizeof(wSarFile) * count);
+	wSarSource* sortedSources = malloc(sizeof(wSarSource) * count);
+	for(isize i = 0; i < count; ++i) {
+		keys[i].hash = array[i].id.hash;
+		keys[i].index = i;
+	}
+	atlasSort(keys, count, sizeof(SarSortKey), compareSortKeys);
+	isize kept = 0;
+	for(isize i = 0; i < count; ++i) {
+		if(i + 1 < count && keys[i + 1].hash == keys[i].hash) continue;
+		sortedSources[kept] = sources[keys[i].index];
+		sorted[kept++] = array[keys[i].index];
+	}
+	memcpy(array, sorted, sizeof(wSarFile) * kept);
+	memcpy(sources, sortedSources, sizeof(wSarSource) * kept);
+	free(sortedSources);
+	free(sorted);
+	free(keys);
+	return kept;
 }
 #endif
 
@@ -312,7 +744,26 @@ u8* loadFile(char* filename, isize* size_out)
 	return str;
 }
 
-void recursivelyAddToArchive(wSarEditingArchive* e, string path)
+static
+char* copyString(string str)
+{
+	isize len = strlen(str);
+	char* copy = malloc(len + 1);
+	memcpy(copy, str, len + 1);
+	return copy;
+}
+
+// Jobs go one after another in their own arena, so they're an array
+void queueFile(wMemoryArena* jobs, string path, string name, i32 policy)
+{
+	SarJob* job = wArenaPush(jobs, sizeof(SarJob));
+	memset(job, 0, sizeof(SarJob));
+	job->path = copyString(path);
+	job->name = copyString(name);
+	job->codec = sarChooseCodec(name, policy);
+}
+
+void recursivelyQueueFiles(wMemoryArena* jobs, string path, i32 policy)
 {
 	tinydir_dir dir;
 	printf("Folder %s\n", path);
@@ -323,32 +774,137 @@ void recursivelyAddToArchive(wSarEditingArchive* e, string path)
 
 	while(dir.has_next) {
 		tinydir_file file;
-		if(tinydir_readfile(&dir, &file)) {
+		if(tinydir_readfile(&dir, &file) != -1) {
+			if(file.is_dir) {
+				if(file.name[0] != '.') {
+					recursivelyQueueFiles(jobs, file.path, policy);
+				}
+			} else if(file.is_reg) {
+				queueFile(jobs, file.path, file.name, policy);
+			}
+		} else {
 			fprintf(stderr, "Error: couldn't open file %s. Skipping...\n", file.path);
 		}
-
-		if(file.is_dir) {
-			if(file.name[0] != '.') {
-				recursivelyAddToArchive(e, file.path);
-			}
-			goto iterContinue;
+		if(tinydir_next(&dir) == -1) {
+			break;
 		}
-		else if(!file.is_reg) goto iterContinue;
+	}
+	tinydir_close(&dir);
+}
 
-		printf("| Adding %s\n", file.name);
-		isize size = 0;
-		u8* fileData = loadFile(file.path, &size);
-		wSarAddFile(e, file.name, fileData, size);
-		free(fileData);
 
-iterContinue:
+
+#define Sar_MaxAtlasImages 4096
+
+void addAtlasImage(wAtlasImage* images, isize* count, string path, string name)
+{
+	if(*count >= Sar_MaxAtlasImages) {
+		fprintf(stderr, "Error: too many images, skipping %s\n", path);
+		return;
+	}
+
+	isize size = 0;
+	u8* fileData = loadFile((char*)path, &size);
+	if(!fileData) return;
+	i32 w = 0, h = 0, bpp = 0;
+	u8* pixels = stbi_load_from_memory(fileData, size, &w, &h, &bpp, STBI_rgb_alpha);
+	free(fileData);
+	if(!pixels) {
+		fprintf(stderr, "Error: %s isn't a png. Skipping...\n", path);
+		return;
+	}
+
+	isize namelen = strlen(name);
+	char* nameCopy = malloc(namelen + 1);
+	memcpy(nameCopy, name, namelen + 1);
+
+	printf("| Adding %s (%dx%d)\n", name, w, h);
+	wAtlasImage* image = images + (*count)++;
+	image->name = nameCopy;
+	image->pixels = pixels;
+	image->w = w;
+	image->h = h;
+}
+
+void recursivelyAddImages(wAtlasImage* images, isize* count, string path)
+{
+	tinydir_dir dir;
+	if(tinydir_open(&dir, path) == -1) {
+		fprintf(stderr, "Error: couldn't open directory %s. Skipping...\n", path);
+		return;
+	}
+
+	while(dir.has_next) {
+		tinydir_file file;
+		if(tinydir_readfile(&dir, &file) != -1) {
+			if(file.is_dir) {
+				if(file.name[0] != '.') {
+					recursivelyAddImages(images, count, file.path);
+				}
+			} else if(file.is_reg) {
+				addAtlasImage(images, count, file.path, file.name);
+			}
+		}
 		if(tinydir_next(&dir) == -1) {
-			return;
+			break;
 		}
 	}
+	tinydir_close(&dir);
 }
 
+/* Lays the archive out as header, description, file table, sources, then
+ * the data in table order, and writes each piece from wherever it is.
+ */
+void writeArchive(wSarEditingArchive* e, string filename)
+{
+	e->fileCount = wSarSortFiles(e->fileTable, e->sources, e->fileCount);
+	wSarHeader* header = e->header;
+	header->magic = wSar_Magic;
+	header->version = wSar_Version;
+	header->fileCount = e->fileCount;
+	if(!e->description) {
+		header->descriptionLength = 0;
+	}
 
+	usize tableSize = sizeof(wSarFile) * e->fileCount;
+	wSarFile* table = malloc(tableSize + 1);
+	memcpy(table, e->fileTable, tableSize);
+	usize location = sizeof(wSarHeader) + header->descriptionLength;
+	header->fileTableLocation = location;
+	location += tableSize;
+	usize sourcesSize = sizeof(wSarSource) * e->fileCount;
+	header->sourceTableLocation = location;
+	location += sourcesSize;
+	for(usize i = 0; i < e->fileCount; ++i) {
+		table[i].location = location;
+		location += table[i].compressedSize;
+	}
+	header->archiveSize = location;
+
+	FILE* output = fopen(filename, "wb");
+	if(!output) {
+		fprintf(stderr, 
+				"Error: Can't open final archive %s for writing\n",
+				filename);
+		free(table);
+		return;
+	}
+	usize written = fwrite(header, 1, sizeof(wSarHeader), output);
+	written += fwrite(e->description, 1, header->descriptionLength, output);
+	written += fwrite(table, 1, tableSize, output);
+	written += fwrite(e->sources, 1, sourcesSize, output);
+	for(usize i = 0; i < e->fileCount; ++i) {
+		wSarFile* f = e->fileTable + i;
+		written += fwrite((void*)(usize)f->location, 1, f->compressedSize, output);
+	}
+	fclose(output);
+	free(table);
+	if(written < location) {
+		fprintf(stderr, "Error: archive writing failed!\n"
+				"Incomplete archive written to disk\n");
+	}
+	printf("%zu|%zuk bytes written\n", written, written >> 10);
+}
 
 int main(int argc, char** argv)
 {
@@ -358,7 +914,8 @@ int main(int argc, char** argv)
 
 	if(argc < 3) {
 		printf("Warning: archive and command not specified\n"
-				"Usage: sar archive.sar [extract|x, compress|add|c|a, print|p] ...files...\n");
+				"Usage: sar archive.sar [extract|x, compress|add|c|a, print|p] "
+				"[-j threads] [-z fast|small|auto] ...files...\n");
 		return 0;
 	}
 
@@ -370,6 +927,8 @@ int main(int argc, char** argv)
 		mode = 2;
 	} else if(c == 'p') {
 		mode = 3;
+	} else if(c == 't') {
+		mode = 4;
 	}
 
 	if(mode == 0) {
@@ -410,9 +969,14 @@ int main(int argc, char** argv)
 			wSarFile* file = fileTable + i;
 			void* compressedData = (void*)((usize)archive->header + file->location);
 			usize outputSize = 0;
-			void* data = tinfl_decompress_mem_to_heap(
-					compressedData, file->compressedSize, 
-					&outputSize, 0);
+			void* data = NULL;
+			if(file->kind == wSar_KindStored) {
+				outputSize = file->compressedSize;
+				data = compressedData;
+			} else {
+				data = malloc(file->fullSize + 1);
+				outputSize = sarInflate(file, compressedData, data);
+			}
 			if(outputSize != file->fullSize) {
 				fprintf(stderr, "Warning: %s uncompressed size discrepancy:\n"
 						"Got: %zu | Expected %zu\n", 
@@ -434,7 +998,9 @@ int main(int argc, char** argv)
 			} else {
 				fprintf(stderr, "Error: couldn't open %s for writing\n", filename);
 			}
-
+			if(data != compressedData) {
+				free(data);
+			}
 		}
 
 	}
@@ -457,47 +1023,104 @@ int main(int argc, char** argv)
 			printf("Creating archive %s...\n", argv[1]);
 		}
 
+		i32 threads = 0, policy = Sar_PolicyAuto;
+		isize first = 3;
+		while(first + 1 < argc && argv[first][0] == '-') {
+			string value = argv[first + 1];
+			if(strcmp(argv[first], "-j") == 0) {
+				threads = atoi(value);
+			} else if(strcmp(argv[first], "-z") == 0) {
+				if(strcmp(value, "fast") == 0) {
+					policy = Sar_PolicyFast;
+				} else if(strcmp(value, "small") == 0) {
+					policy = Sar_PolicySmall;
+				} else if(strcmp(value, "auto") == 0) {
+					policy = Sar_PolicyAuto;
+				} else {
+					fprintf(stderr, "Error: -z is fast, small or auto, not %s\n", 
+							value);
+					return 1;
+				}
+			} else {
+				break;
+			}
+			first += 2;
+		}
+
 		wSarEditingArchive* e = wSarCreateEditingArchive(archive);
-		for(isize i = 3; i < argc; ++i) {
+		wMemoryArena* jobArena = wArenaBootstrap(meminfo, 0);
+		SarJob* jobs = jobArena->head;
+		for(isize i = first; i < argc; ++i) {
 			if(tinydir_file_open(&file, argv[i]) == -1) {
 				fprintf(stderr, "Error: couldn't open file %s. Skipping...\n", argv[i]);
 				continue;
 			}
 
 			if(file.is_dir) {
-				recursivelyAddToArchive(e, file.path);
+				recursivelyQueueFiles(jobArena, file.path, policy);
+			} else if(file.is_reg) {
+				queueFile(jobArena, file.path, file.name, policy);
+			}
+		}
+		isize jobCount = ((usize)jobArena->head - (usize)jobs) / sizeof(SarJob);
+		wSarAddFiles(e, archive, jobs, jobCount, threads);
+		writeArchive(e, argv[1]);
+		return 0;
+	}
+
+	if(mode == 4) {
+		if(argc < 7) {
+			printf("Usage: sar archive.sar t atlasname width height ...pngs...\n");
+			return 0;
+		}
+
+		string atlasName = argv[3];
+		i32 w = atoi(argv[4]);
+		i32 h = atoi(argv[5]);
+		if(w <= 0 || h <= 0) {
+			fprintf(stderr, "Error: bad atlas size %sx%s\n", argv[4], argv[5]);
+			return 0;
+		}
+
+		wAtlasImage* images = wArenaPush(arena, 
+				sizeof(wAtlasImage) * Sar_MaxAtlasImages);
+		isize imageCount = 0;
+		for(isize i = 6; i < argc; ++i) {
+			tinydir_file file;
+			if(tinydir_file_open(&file, argv[i]) == -1) {
+				fprintf(stderr, "Error: couldn't open file %s. Skipping...\n", argv[i]);
 				continue;
 			}
-			if(!file.is_reg) continue;
-
-			printf("| Adding %s\n", file.name);
-			isize size = 0;
-			u8* fileData = loadFile(file.path, &size);
-			wSarAddFile(e, file.name, fileData, size);
-			free(fileData);
-		}
-		{
-			isize  size = 0;
-			void* data = wSarFinalizeArchive(e, &size);
-			
-			FILE* output = fopen(argv[1], "wb");
-			if(output) {
-				isize bytesWritten = fwrite(data, 1, size, output);
-				if(bytesWritten < size) {
-					fprintf(stderr, "Error: archive writing failed!\n"
-							"Incomplete archive written to disk\n");
-				}
-				fclose(output);
-			} else {
-				fprintf(stderr, 
-						"Error: Can't open final archive %s for writing\n",
-						argv[1]);
+			if(file.is_dir) {
+				recursivelyAddImages(images, &imageCount, file.path);
+			} else if(file.is_reg) {
+				addAtlasImage(images, &imageCount, file.path, file.name);
 			}
-			printf("%d|%dk bytes written\n", size, size >> 10);
 		}
 
+		wAtlas atlas;
+		wInitAtlas(&atlas, w, h, 1, imageCount, arena);
+		isize added = wAtlasAddImages(&atlas, images, imageCount, arena);
+		printf("Packed %d of %d images into %s\n", added, imageCount, atlasName);
 
-		return;
+		isize atlasSize = wAtlasSerializedSize(&atlas);
+		void* atlasData = wArenaPush(arena, atlasSize);
+		wSerializeAtlas(&atlas, atlasData);
+
+		wSarArchive* archive = NULL;
+		tinydir_file file;
+		if(tinydir_file_open(&file, argv[1]) != -1 && file.is_reg) {
+			void* data = loadFile(file.path, NULL);
+			archive = wSarLoad(data, arena);
+		} else {
+			printf("Creating archive %s...\n", argv[1]);
+		}
+
+		wSarEditingArchive* e = wSarCreateEditingArchive(archive);
+		// Atlases are read at startup
+		wSarAddFile(e, atlasName, atlasData, atlasSize, wSar_KindLz4);
+		writeArchive(e, argv[1]);
+		return 0;
 	}
 
 
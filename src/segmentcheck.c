@@ -0,0 +1,149 @@
+/* segmentcheck: submits the same 1M sprites from one thread and from
+ * worker segments, and checks flushing the segments gives them back in
+ * exactly the single-threaded order.
+ * usage:
+ * segmentcheck [sprites]
+ *
+ * Sprites are generated from their index, so every run checks the same
+ * thing. Each worker count runs twice, so the segments get reused after a
+ * flush the way they are from frame to frame. Exits 0 if every sprite
+ * came back in order, 1 if not, 2 if it couldn't run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wpl/wpl.h"
+#include "spritesegments.c"
+
+#define Check_Sprites (1000000)
+#define Check_Passes (2)
+
+typedef struct
+{
+	wSprite* expected;
+	isize count;
+	isize at;
+	isize chunks;
+	isize wrong;
+	isize firstWrong;
+} CheckState;
+
+static
+u32 checkHash(u32 x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static
+void makeSprite(wSprite* s, isize index)
+{
+	u32 h = checkHash((u32)index);
+	memset(s, 0, sizeof(wSprite));
+	s->flags = (f32)(h % 7);
+	s->color = h | 0xFF;
+	s->x = (f32)(h & 0xFFF);
+	s->y = (f32)((h >> 12) & 0xFFF);
+	s->z = (f32)index;
+	s->angle = (f32)(h >> 24) / 256.0f;
+	s->w = s->h = 8.0f + (f32)(h % 32);
+	s->tx = (i16)(index & 0x7FFF);
+	s->ty = (i16)((index >> 15) & 0x7FFF);
+	s->tw = s->th = 16;
+}
+
+// Each segment gets its slice of [0, total) in order, the way a game
+// splitting its entities across workers would
+static
+void submitSlice(SpriteSegment* segment, isize index, isize count, void* userdata)
+{
+	CheckState* state = userdata;
+	isize start = state->count * index / count;
+	isize end = state->count * (index + 1) / count;
+	for(isize i = start; i < end; ++i) {
+		makeSprite(segmentPushSprite(segment), i);
+	}
+}
+
+static
+void checkRange(wSprite* sprites, isize count, void* userdata)
+{
+	CheckState* state = userdata;
+	state->chunks++;
+	for(isize i = 0; i < count; ++i) {
+		isize at = state->at++;
+		if(at >= state->count ||
+				memcmp(sprites + i, state->expected + at, sizeof(wSprite)) != 0) {
+			if(!state->wrong) {
+				state->firstWrong = at;
+			}
+			state->wrong++;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	isize total = argc > 1 ? atoi(argv[1]) : Check_Sprites;
+	if(total <= 0) {
+		printf("usage: segmentcheck [sprites]\n");
+		return 2;
+	}
+
+	wMemoryInfo info = wGetMemoryInfo();
+	wMemoryArena* arena = wArenaBootstrap(info, 0);
+	CheckState state;
+	memset(&state, 0, sizeof(CheckState));
+	state.count = total;
+	state.expected = wArenaPush(arena, sizeof(wSprite) * total);
+	for(isize i = 0; i < total; ++i) {
+		makeSprite(state.expected + i, i);
+	}
+
+	i32 workerCounts[] = {1, 2, 3, 4, 7, 8, 16, 0};
+	workerCounts[7] = wGetProcessorCount();
+	i32 failed = 0;
+	for(i32 w = 0; w < (i32)(sizeof(workerCounts) / sizeof(i32)); ++w) {
+		if(workerCounts[w] <= 0) continue;
+		SpriteSegments segments;
+		memset(&segments, 0, sizeof(SpriteSegments));
+		initSpriteSegments(&segments, workerCounts[w], info, arena);
+		for(i32 pass = 0; pass < Check_Passes; ++pass) {
+			state.at = 0;
+			state.chunks = 0;
+			state.wrong = 0;
+			f64 start = wGetTime();
+			submitSpritesParallel(&segments, submitSlice, &state);
+			f64 submitted = wGetTime();
+			flushSpriteSegments(&segments, checkRange, &state);
+			f64 flushed = wGetTime();
+
+			i32 ok = state.wrong == 0 && state.at == total;
+			printf("%2d workers, pass %d: %s, %d sprites in %d chunks "
+					"(submit %.1fms, flush and check %.1fms)\n",
+					workerCounts[w], pass + 1, ok ? "in order" : "WRONG",
+					(i32)state.at, (i32)state.chunks,
+					(submitted - start) * 1000.0, (flushed - submitted) * 1000.0);
+			if(!ok) {
+				printf("FAILED: %d sprites out of place, the first at %d; "
+						"got %d of %d\n",
+						(i32)state.wrong, (i32)state.firstWrong,
+						(i32)state.at, (i32)total);
+				failed = 1;
+			}
+		}
+		destroySpriteSegments(&segments);
+	}
+
+	if(failed) {
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
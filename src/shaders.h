@@ -35,7 +35,7 @@ const char* EGL3_frag = "" "#version 300 es\n"
 "		float sigDist = median(sdfVal.r, sdfVal.g, sdfVal.b) - 0.5;\n"
 "		sigDist *= dot(msdfUnit, 0.5/fwidth(uv));\n"
 "		float opacity = clamp(sigDist + 0.5, 0.0, 1.0);\n"
-"		baseColor *= vec4(1, 1, 1, opacity) * uTint;\n"
+"		baseColor *= vec4(1, 1, 1, opacity);\n"
 "		//baseColor = vec4(0.5/fwidth(uv), 1, 1);\n"
 "	} else if(fHasTexture > 0.5) {\n"
 "		vec2 uv;\n"
@@ -46,7 +46,8 @@ const char* EGL3_frag = "" "#version 300 es\n"
 "		}\n"
 "		baseColor *= texture(uTexture, uv * uInvTextureSize);\n"
 "	}\n"
-"	gColor = baseColor;\n"
+"	// Every kind of sprite is tinted, not just SDF text\n"
+"	gColor = baseColor * uTint;\n"
 "	if(fIsCircle > 0.5) {\n"
 "		vec2 dl = fPos - vec2(0.5, 0.5);\n"
 "		//dist^2 = mag^2 - (0.5)^2\n"
@@ -154,6 +155,73 @@ const char* EGL3_vert = "" "#version 300 es\n"
 "	fTextureScale = (uScale * vSize) / vTexture.zw;\n"
 "} \n"
 ;
+const char* EGL3Packed_vert = "" "#version 300 es\n"
+"precision mediump float;\n"
+"// wPackedSprite; position and size are in 1/4 pixels\n"
+"// (PackedSprite_Subpixel), the angle is in 1/255ths of a turn, and the\n"
+"// texture size is stored minus one so 256 fits in a byte\n"
+"layout(location=0) in vec2 vPos;\n"
+"layout(location=1) in vec2 vSize;\n"
+"layout(location=2) in vec2 vTexturePos;\n"
+"layout(location=3) in vec2 vTextureSize;\n"
+"layout(location=4) in float vAngle;\n"
+"layout(location=5) in float vFlags;\n"
+"out vec2 fPos;\n"
+"out vec2 fTexture; \n"
+"out vec2 fTextureScale;\n"
+"out vec4 fColor;\n"
+"flat out float fIsCircle;\n"
+"flat out float fIsSDF;\n"
+"flat out float fHasTexture;\n"
+"flat out float fHasAA;\n"
+"uniform vec2 uOffset;\n"
+"uniform vec2 uViewport;\n"
+"uniform float uScale;\n"
+"float[4] corners = float[4](-0.5, -0.5, 0.5, 0.5); \n"
+"float[9] offsetX = float[9](0.0, 0.5, 0.0, -0.5, -0.5, -0.5,  0.0,  0.5, 0.5); \n"
+"float[9] offsetY = float[9](0.0, 0.5, 0.5,  0.5,  0.0, -0.5, -0.5, -0.5, 0.0); \n"
+"void main() \n"
+"{ \n"
+"	fColor = vec4(1, 1, 1, 1);\n"
+"	fIsCircle = 0.0;\n"
+"	fIsSDF = 0.0;\n"
+"	fHasTexture = 1.0;\n"
+"	fHasAA = 1.0;\n"
+"	if(vFlags >= 10.0 && vFlags < 40.0) fIsCircle = 1.0;\n"
+"	if(vFlags >= 20.0 && vFlags < 30.0) fHasTexture = 0.0;\n"
+"	else if(vFlags >= 40.0 && vFlags < 50.0) fHasTexture = 0.0;\n"
+"	if(vFlags >= 30.0 && vFlags < 40.0) fHasAA = 0.0;\n"
+"	else if(vFlags >= 50.0 && vFlags < 60.0) fHasAA = 0.0;\n"
+"	if(vFlags >= 60.0 && vFlags < 70.0) fIsSDF = 1.0;\n"
+"	int vx = gl_VertexID & 2; \n"
+"	int vy = ((gl_VertexID & 1) << 1) ^ 3; \n"
+"	float lastDigit = vFlags - float(int(vFlags / 10.0) * 10);\n"
+"	int anchor = int(lastDigit);\n"
+"	vec2 size = vSize * 0.25; \n"
+"	vec2 pos = vec2(corners[vx], corners[vy]);\n"
+"	fPos = pos + vec2(0.5, 0.5);\n"
+"	pos += vec2(offsetX[anchor], offsetY[anchor]);\n"
+"	pos *= size; \n"
+"	float angle = vAngle * 6.2831853;\n"
+"	vec2 rot = vec2(cos(angle), sin(angle));\n"
+"	mat2 rotmat = mat2(\n"
+"			rot.x, rot.y,\n"
+"			-rot.y, rot.x);\n"
+"	pos = rotmat * pos;\n"
+"	pos += vPos * 0.25;\n"
+"	pos -= uOffset;\n"
+"	pos *= uScale; \n"
+"	vec2 normalPos = pos * vec2(2, -2) / uViewport - vec2(1, -1);\n"
+"	gl_Position = vec4(normalPos, 0, 1);\n"
+"	vec2 texSize = vTextureSize + 1.0; \n"
+"	vec4 texVec = vec4(vTexturePos, vTexturePos + texSize); \n"
+"	float[4] texCoords = float[4](\n"
+"			texVec.x, texVec.y,\n"
+"			texVec.z, texVec.w); \n"
+"	fTexture = vec2(texCoords[vx], texCoords[vy]); \n"
+"	fTextureScale = (uScale * size) / texSize;\n"
+"} \n"
+;
 const char* GL33_frag = "" "#version 300\n"
 "in vec2 fPos;\n"
 "in vec2 fTexture;\n"
@@ -186,13 +254,14 @@ const char* GL33_frag = "" "#version 300\n"
 "		float sigDist = median(sdfVal.r, sdfVal.g, sdfVal.b) - 0.5;\n"
 "		sigDist *= dot(msdfUnit, 0.5/fwidth(uv));\n"
 "		float opacity = clamp(sigDist + 0.5, 0.0, 1.0);\n"
-"		baseColor *= vec4(1, 1, 1, opacity) * uTint;\n"
+"		baseColor *= vec4(1, 1, 1, opacity);\n"
 "		//baseColor = vec4(0.5/fwidth(uv), 1, 1);\n"
 "	} else if(!((fFlags & (1<<5)) > 0)) {\n"
 "		vec2 uv = subpixelAA(fTexture, fTextureScale);\n"
 "		baseColor *= texture(uTexture, uv * uInvTextureSize);\n"
 "	}\n"
-"	gColor = baseColor;\n"
+"	// Every kind of sprite is tinted, not just SDF text\n"
+"	gColor = baseColor * uTint;\n"
 "	if((fFlags & (1<<10)) > 0) {\n"
 "		vec2 dl = fPos - vec2(0.5, 0.5);\n"
 "		//dist^2 = mag^2 - (0.5)^2\n"
@@ -279,3 +348,97 @@ const char* GL33_vert = "" "#version 330\n"
 "	fTextureScale = (uScale * vSize) / vTexture.zw;\n"
 "} \n"
 ;
+const char* GLES2_frag = "" "#version 100\n"
+"#extension GL_OES_standard_derivatives : enable\n"
+"precision mediump float;\n"
+"varying vec2 fPos;\n"
+"varying vec2 fTexture;\n"
+"varying vec2 fTextureScale;\n"
+"varying vec4 fColor;\n"
+"varying float fIsCircle;\n"
+"varying float fIsSDF;\n"
+"varying float fHasTexture;\n"
+"varying float fHasAA;\n"
+"uniform sampler2D uTexture; \n"
+"uniform vec4 uTint; \n"
+"uniform vec2 uInvTextureSize;\n"
+"float median(float a, float b, float c)\n"
+"{\n"
+"	return max(min(a, b), min(max(a, b), c));\n"
+"}\n"
+"vec2 subpixelAA(vec2 pixel, vec2 zoom)\n"
+"{\n"
+"	vec2 uv = floor(pixel) + 0.5;\n"
+"    uv += 1.0 - clamp((1.0 - fract(pixel)) * zoom, 0.0, 1.0);\n"
+"	return uv;\n"
+"}\n"
+"void main()\n"
+"{\n"
+"	vec4 baseColor = fColor;\n"
+"	if(fIsSDF > 0.5) {\n"
+"		vec2 msdfUnit = vec2(8.0) * uInvTextureSize;\n"
+"		vec2 uv = subpixelAA(fTexture, fTextureScale) * uInvTextureSize;\n"
+"		vec4 sdfVal = texture2D(uTexture, uv);\n"
+"		float sigDist = median(sdfVal.r, sdfVal.g, sdfVal.b) - 0.5;\n"
+"		sigDist *= dot(msdfUnit, 0.5/fwidth(uv));\n"
+"		float opacity = clamp(sigDist + 0.5, 0.0, 1.0);\n"
+"		baseColor *= vec4(1, 1, 1, opacity);\n"
+"	} else if(fHasTexture > 0.5) {\n"
+"		vec2 uv;\n"
+"		if(fHasAA > 0.5) {\n"
+"			uv = subpixelAA(fTexture, fTextureScale);\n"
+"		} else {\n"
+"			uv = floor(fTexture) + 0.5;\n"
+"		}\n"
+"		baseColor *= texture2D(uTexture, uv * uInvTextureSize);\n"
+"	}\n"
+"	// Every kind of sprite is tinted, not just SDF text\n"
+"	gl_FragColor = baseColor * uTint;\n"
+"	if(fIsCircle > 0.5) {\n"
+"		vec2 dl = fPos - vec2(0.5, 0.5);\n"
+"		//dist^2 = mag^2 - (0.5)^2\n"
+"		float dist2 = dot(dl, dl) - 0.25;\n"
+"		if(dist2 > 0.0) {\n"
+"			gl_FragColor = vec4(0, 0, 0, 0);\n"
+"		}\n"
+"	}\n"
+"}\n"
+;
+const char* GLES2_vert = "" "#version 100\n"
+"precision mediump float;\n"
+"// Sprites are expanded on the CPU (see wplSprites.c), so everything\n"
+"// arrives per-vertex and already in clip space.\n"
+"attribute vec2 vPos;\n"
+"attribute vec2 vLocal;\n"
+"attribute vec2 vTexture;\n"
+"attribute vec2 vTextureScale;\n"
+"attribute vec4 vColor;\n"
+"attribute float vFlags;\n"
+"varying vec2 fPos;\n"
+"varying vec2 fTexture;\n"
+"varying vec2 fTextureScale;\n"
+"varying vec4 fColor;\n"
+"// No flat in GLES2, but these are the same across a sprite anyway\n"
+"varying float fIsCircle;\n"
+"varying float fIsSDF;\n"
+"varying float fHasTexture;\n"
+"varying float fHasAA;\n"
+"void main() \n"
+"{ \n"
+"	fColor = vColor.wzyx;\n"
+"	fIsCircle = 0.0;\n"
+"	fIsSDF = 0.0;\n"
+"	fHasTexture = 1.0;\n"
+"	fHasAA = 1.0;\n"
+"	if(vFlags >= 10.0 && vFlags < 40.0) fIsCircle = 1.0;\n"
+"	if(vFlags >= 20.0 && vFlags < 30.0) fHasTexture = 0.0;\n"
+"	else if(vFlags >= 40.0 && vFlags < 50.0) fHasTexture = 0.0;\n"
+"	if(vFlags >= 30.0 && vFlags < 40.0) fHasAA = 0.0;\n"
+"	else if(vFlags >= 50.0 && vFlags < 60.0) fHasAA = 0.0;\n"
+"	if(vFlags >= 60.0 && vFlags < 70.0) fIsSDF = 1.0;\n"
+"	fPos = vLocal;\n"
+"	fTexture = vTexture;\n"
+"	fTextureScale = vTextureScale;\n"
+"	gl_Position = vec4(vPos, 0, 1);\n"
+"} \n"
+;
@@ -0,0 +1,78 @@
+#version 300 es
+precision mediump float;
+
+// wPackedSprite; position and size are in 1/4 pixels
+// (PackedSprite_Subpixel), the angle is in 1/255ths of a turn, and the
+// texture size is stored minus one so 256 fits in a byte
+layout(location=0) in vec2 vPos;
+layout(location=1) in vec2 vSize;
+layout(location=2) in vec2 vTexturePos;
+layout(location=3) in vec2 vTextureSize;
+layout(location=4) in float vAngle;
+layout(location=5) in float vFlags;
+
+out vec2 fPos;
+out vec2 fTexture; 
+out vec2 fTextureScale;
+out vec4 fColor;
+flat out float fIsCircle;
+flat out float fIsSDF;
+flat out float fHasTexture;
+flat out float fHasAA;
+
+uniform vec2 uOffset;
+uniform vec2 uViewport;
+uniform float uScale;
+
+float[4] corners = float[4](-0.5, -0.5, 0.5, 0.5); 
+float[9] offsetX = float[9](0.0, 0.5, 0.0, -0.5, -0.5, -0.5,  0.0,  0.5, 0.5); 
+float[9] offsetY = float[9](0.0, 0.5, 0.5,  0.5,  0.0, -0.5, -0.5, -0.5, 0.0); 
+
+void main() 
+{ 
+	fColor = vec4(1, 1, 1, 1);
+	fIsCircle = 0.0;
+	fIsSDF = 0.0;
+	fHasTexture = 1.0;
+	fHasAA = 1.0;
+
+	if(vFlags >= 10.0 && vFlags < 40.0) fIsCircle = 1.0;
+	if(vFlags >= 20.0 && vFlags < 30.0) fHasTexture = 0.0;
+	else if(vFlags >= 40.0 && vFlags < 50.0) fHasTexture = 0.0;
+	if(vFlags >= 30.0 && vFlags < 40.0) fHasAA = 0.0;
+	else if(vFlags >= 50.0 && vFlags < 60.0) fHasAA = 0.0;
+	if(vFlags >= 60.0 && vFlags < 70.0) fIsSDF = 1.0;
+
+	int vx = gl_VertexID & 2; 
+	int vy = ((gl_VertexID & 1) << 1) ^ 3; 
+	float lastDigit = vFlags - float(int(vFlags / 10.0) * 10);
+	int anchor = int(lastDigit);
+
+	vec2 size = vSize * 0.25; 
+	vec2 pos = vec2(corners[vx], corners[vy]);
+	fPos = pos + vec2(0.5, 0.5);
+	pos += vec2(offsetX[anchor], offsetY[anchor]);
+	pos *= size; 
+
+	float angle = vAngle * 6.2831853;
+	vec2 rot = vec2(cos(angle), sin(angle));
+	mat2 rotmat = mat2(
+			rot.x, rot.y,
+			-rot.y, rot.x);
+	pos = rotmat * pos;
+
+	pos += vPos * 0.25;
+	pos -= uOffset;
+	pos *= uScale; 
+
+	vec2 normalPos = pos * vec2(2, -2) / uViewport - vec2(1, -1);
+	gl_Position = vec4(normalPos, 0, 1);
+
+	vec2 texSize = vTextureSize + 1.0; 
+	vec4 texVec = vec4(vTexturePos, vTexturePos + texSize); 
+	float[4] texCoords = float[4](
+			texVec.x, texVec.y,
+			texVec.z, texVec.w); 
+	fTexture = vec2(texCoords[vx], texCoords[vy]); 
+	fTextureScale = (uScale * size) / texSize;
+} 
@@ -36,13 +36,14 @@ void main()
 		float sigDist = median(sdfVal.r, sdfVal.g, sdfVal.b) - 0.5;
 		sigDist *= dot(msdfUnit, 0.5/fwidth(uv));
 		float opacity = clamp(sigDist + 0.5, 0.0, 1.0);
-		baseColor *= vec4(1, 1, 1, opacity) * uTint;
+		baseColor *= vec4(1, 1, 1, opacity);
 		//baseColor = vec4(0.5/fwidth(uv), 1, 1);
 	} else if(!((fFlags & (1<<5)) > 0)) {
 		vec2 uv = subpixelAA(fTexture, fTextureScale);
 		baseColor *= texture(uTexture, uv * uInvTextureSize);
 	}
-	gColor = baseColor;
+	// Every kind of sprite is tinted, not just SDF text
+	gColor = baseColor * uTint;
 
 	if((fFlags & (1<<10)) > 0) {
 		vec2 dl = fPos - vec2(0.5, 0.5);
@@ -0,0 +1,42 @@
+#version 100
+precision mediump float;
+
+// Sprites are expanded on the CPU (see wplSprites.c), so everything
+// arrives per-vertex and already in clip space.
+attribute vec2 vPos;
+attribute vec2 vLocal;
+attribute vec2 vTexture;
+attribute vec2 vTextureScale;
+attribute vec4 vColor;
+attribute float vFlags;
+
+varying vec2 fPos;
+varying vec2 fTexture;
+varying vec2 fTextureScale;
+varying vec4 fColor;
+// No flat in GLES2, but these are the same across a sprite anyway
+varying float fIsCircle;
+varying float fIsSDF;
+varying float fHasTexture;
+varying float fHasAA;
+
+void main() 
+{ 
+	fColor = vColor.wzyx;
+	fIsCircle = 0.0;
+	fIsSDF = 0.0;
+	fHasTexture = 1.0;
+	fHasAA = 1.0;
+
+	if(vFlags >= 10.0 && vFlags < 40.0) fIsCircle = 1.0;
+	if(vFlags >= 20.0 && vFlags < 30.0) fHasTexture = 0.0;
+	else if(vFlags >= 40.0 && vFlags < 50.0) fHasTexture = 0.0;
+	if(vFlags >= 30.0 && vFlags < 40.0) fHasAA = 0.0;
+	else if(vFlags >= 50.0 && vFlags < 60.0) fHasAA = 0.0;
+	if(vFlags >= 60.0 && vFlags < 70.0) fIsSDF = 1.0;
+
+	fPos = vLocal;
+	fTexture = vTexture;
+	fTextureScale = vTextureScale;
+	gl_Position = vec4(vPos, 0, 1);
+} 
@@ -0,0 +1,503 @@
+/* Sprite batches for the test apps. A SpriteBatch collects sprites and
+ * draws them instanced, in the full or packed layout (see SpriteLayout),
+ * or expanded on the CPU when the context can't instance.
+ * Batches can be culled against the view, kept on the GPU as static
+ * layers, and filled from worker threads through their segments.
+ * With enableSpriteQueue, draws go through a wRenderQueue and are sent
+ * sorted and merged by flushSpriteQueue.
+ *
+ * Included by main.c and multi_main.c, after shaders.h.
+ */
+#include <string.h>
+
+#include "spritesegments.c"
+
+typedef wSprite Sprite;
+
+// Instance layout a SpriteBatch uploads; Packed quantizes to wPackedSprite
+// at draw time, which is a third of the bandwidth but drops color/center
+// (everything draws in the batch's tint), keeps positions and sizes within
+// +-8191px in quarter pixels, and texture rects within 1..256 texels.
+// Anything outside that clamps, which debug builds log.
+enum
+{
+	SpriteLayout_Full,
+	SpriteLayout_Packed
+};
+
+void initSprite(Sprite* s,
+		f32 flags, u32 color, 
+		f32 x, f32 y, f32 z,
+		f32 angle, f32 w, f32 h, f32 cx, f32 cy, 
+		i16 tx, i16 ty, i16 tw, i16 th)
+{
+	s->flags = flags;
+	s->color = color;
+	s->x = x;
+	s->y = y;
+	s->z = z;
+	s->angle = angle;
+	s->w = w;
+	s->h = h;
+	s->cx = cx;
+	s->cy = cy;
+	s->tx = tx;
+	s->ty = ty;
+	s->tw = tw;
+	s->th = th;
+}
+
+// What every SpriteBatch draws with. createSpriteShaders makes the
+// shaders; texture and state are the app's.
+typedef struct
+{
+	wShader* shader;
+	wShader* packedShader;
+	wShader* expandShader;
+	wTexture* texture;
+	wState* state;
+
+	// Set by enableSpriteQueue; frame holds what's queued until the flush
+	wRenderQueue* queue;
+	wMemoryArena* frame;
+} SpriteRenderer;
+
+typedef struct
+{
+	SpriteRenderer* renderer;
+	wRenderBatch batch;
+	Sprite* sprites;
+	isize count, capacity;
+	i32 layout;
+	wPackedSprite* packed;
+
+	// Optional culling against the view (see enableSpriteCulling)
+	wSpriteGrid* grid;
+	Sprite* culled;
+
+	// Used instead of batch when instancing isn't available
+	i32 expand;
+	wRenderBatch expandBatch;
+	wVertex* verts;
+
+	// Filled from worker threads; see spritesegments.c
+	SpriteSegments segments;
+
+	// Sort order when queued. Batches in the same layer can be drawn in
+	// any order relative to each other.
+	u32 layer;
+
+	f32 x, y;
+	f32 vw, vh;
+	f32 scale;
+	u32 tint;
+	f32 itw, ith;
+} SpriteBatch;
+
+static
+void createPackedShader(SpriteRenderer* r, wMemoryArena* arena)
+{
+	r->packedShader = wArenaPush(arena, sizeof(wShader));
+	wInitShader(r->packedShader, sizeof(wPackedSprite));
+	r->packedShader->defaultDivisor = 1;
+
+	wCreateAttrib(r->packedShader,
+			"vPos", wShader_FloatShort, 2, offsetof(wPackedSprite, x));
+	wCreateAttrib(r->packedShader,
+			"vSize", wShader_FloatShort, 2, offsetof(wPackedSprite, w));
+	wCreateAttrib(r->packedShader,
+			"vTexturePos", wShader_FloatShort, 2, offsetof(wPackedSprite, tx));
+	wCreateAttrib(r->packedShader,
+			"vTextureSize", wShader_FloatByte, 2, offsetof(wPackedSprite, tw));
+	wCreateAttrib(r->packedShader,
+			"vAngle", wShader_NormalizedByte, 1, offsetof(wPackedSprite, angle));
+	wCreateAttrib(r->packedShader,
+			"vFlags", wShader_FloatByte, 1, offsetof(wPackedSprite, flags));
+
+	wCreateUniform(r->packedShader, 
+			"uOffset", wShader_Float, 2, offsetof(SpriteBatch, x));
+	wCreateUniform(r->packedShader, 
+			"uViewport", wShader_Float, 2, offsetof(SpriteBatch, vw));
+	wCreateUniform(r->packedShader, 
+			"uScale", wShader_Float, 1, offsetof(SpriteBatch, scale));
+	wCreateUniform(r->packedShader, 
+			"uTint", wShader_NormalizedByte, 4, offsetof(SpriteBatch, tint));
+	wCreateUniform(r->packedShader, 
+			"uInvTextureSize", wShader_Float, 2, offsetof(SpriteBatch, itw));
+
+	wAddSourceToShader(r->packedShader, EGL3Packed_vert, wShader_Vertex);
+	wAddSourceToShader(r->packedShader, EGL3_frag, wShader_Frag);
+
+	wFinalizeShader(r->packedShader);
+}
+
+static
+void createExpandShader(SpriteRenderer* r, wMemoryArena* arena)
+{
+	r->expandShader = wArenaPush(arena, sizeof(wShader));
+	wInitShader(r->expandShader, sizeof(wVertex));
+	r->expandShader->targetVersion = 20;
+
+	wCreateAttrib(r->expandShader,
+			"vPos", wShader_Float, 2, offsetof(wVertex, x));
+	wCreateAttrib(r->expandShader,
+			"vLocal", wShader_Float, 2, offsetof(wVertex, px));
+	wCreateAttrib(r->expandShader,
+			"vTexture", wShader_Float, 2, offsetof(wVertex, u));
+	wCreateAttrib(r->expandShader,
+			"vTextureScale", wShader_Float, 2, offsetof(wVertex, sx));
+	wCreateAttrib(r->expandShader,
+			"vColor", wShader_NormalizedByte, 4, offsetof(wVertex, color));
+	wCreateAttrib(r->expandShader,
+			"vFlags", wShader_Float, 1, offsetof(wVertex, flags));
+
+	wCreateUniform(r->expandShader, 
+			"uTint", wShader_NormalizedByte, 4, offsetof(SpriteBatch, tint));
+	wCreateUniform(r->expandShader, 
+			"uInvTextureSize", wShader_Float, 2, offsetof(SpriteBatch, itw));
+
+	wAddSourceToShader(r->expandShader, GLES2_vert, wShader_Vertex);
+	wAddSourceToShader(r->expandShader, GLES2_frag, wShader_Frag);
+
+	wFinalizeShader(r->expandShader);
+}
+
+// Packed needs instancing; expand is what's used without it
+void createSpriteShaders(SpriteRenderer* r, wMemoryArena* arena)
+{
+	r->packedShader = NULL;
+	r->expandShader = NULL;
+	r->shader = wArenaPush(arena, sizeof(wShader));
+	wInitShader(r->shader, sizeof(Sprite));
+	r->shader->defaultDivisor = 1;
+
+	wCreateAttrib(r->shader,
+			"vFlags", wShader_Float, 1, offsetof(Sprite, flags));
+	wCreateAttrib(r->shader, 
+			"vColor", wShader_NormalizedByte, 4, offsetof(Sprite, color));
+	wCreateAttrib(r->shader,
+			"vPos", wShader_Float, 3, offsetof(Sprite, x));
+	wCreateAttrib(r->shader,
+			"vAngle", wShader_Float, 1, offsetof(Sprite, angle));
+	wCreateAttrib(r->shader,
+			"vSize", wShader_Float, 2, offsetof(Sprite, w));
+	wCreateAttrib(r->shader, 
+			"vCenter", wShader_Float, 2, offsetof(Sprite, cx));
+	wCreateAttrib(r->shader, 
+			"vTexture", wShader_FloatShort, 4, offsetof(Sprite, tx));
+
+	wCreateUniform(r->shader, 
+			"uOffset", wShader_Float, 2, offsetof(SpriteBatch, x));
+	wCreateUniform(r->shader, 
+			"uViewport", wShader_Float, 2, offsetof(SpriteBatch, vw));
+	wCreateUniform(r->shader, 
+			"uScale", wShader_Float, 1, offsetof(SpriteBatch, scale));
+	wCreateUniform(r->shader, 
+			"uTint", wShader_NormalizedByte, 4, offsetof(SpriteBatch, tint));
+	wCreateUniform(r->shader, 
+			"uInvTextureSize", wShader_Float, 2, offsetof(SpriteBatch, itw));
+
+	wAddSourceToShader(r->shader, EGL3_vert, wShader_Vertex);
+	wAddSourceToShader(r->shader, EGL3_frag, wShader_Frag);
+
+	wFinalizeShader(r->shader);
+
+	if(!wSupportsInstancing()) {
+		createExpandShader(r, arena);
+	} else {
+		createPackedShader(r, arena);
+	}
+}
+
+static
+SpriteBatch* allocSpriteBatch(SpriteRenderer* r,
+		isize cap, i32 layout, wMemoryArena* arena)
+{
+	SpriteBatch* batch = wArenaPush(arena, sizeof(SpriteBatch));
+	batch->renderer = r;
+	batch->sprites = wArenaPush(arena, sizeof(Sprite) * cap);
+	batch->capacity = cap;
+	batch->layout = SpriteLayout_Full;
+	if(layout == SpriteLayout_Packed && r->packedShader) {
+		// Segment chunks are packed/expanded whole, so these buffers
+		// need room for one of those too
+		isize packedCap = cap > SpriteChunk_Capacity ? cap : SpriteChunk_Capacity;
+		batch->layout = SpriteLayout_Packed;
+		batch->packed = wArenaPush(arena, sizeof(wPackedSprite) * packedCap);
+		wInitBatch(&batch->batch,
+				r->texture, r->packedShader,
+				wRenderBatch_ArraysInstanced, wRenderBatch_TriangleStrip,
+				sizeof(wPackedSprite), 4,
+				batch->packed, NULL);
+	} else {
+		wInitBatch(&batch->batch,
+				r->texture, r->shader,
+				wRenderBatch_ArraysInstanced, wRenderBatch_TriangleStrip,
+				sizeof(Sprite), 4,
+				batch->sprites, NULL);
+	}
+	wConstructBatchGraphicsState(&batch->batch);
+
+	if(r->expandShader) {
+		isize vertCap = 6 * (cap > SpriteChunk_Capacity ? cap : SpriteChunk_Capacity);
+		batch->expand = 1;
+		batch->verts = wArenaPush(arena, sizeof(wVertex) * vertCap);
+		wInitBatch(&batch->expandBatch,
+				r->texture, r->expandShader,
+				wRenderBatch_Arrays, wRenderBatch_Triangles,
+				sizeof(wVertex), 1,
+				batch->verts, NULL);
+		wConstructBatchGraphicsState(&batch->expandBatch);
+		wEnableBatchStreaming(&batch->expandBatch, vertCap);
+	}
+
+	batch->scale = 1.0;
+	batch->tint = 0xFFFFFFFF;
+	return batch;
+}
+
+SpriteBatch* createSpriteBatch(SpriteRenderer* r,
+		isize cap, i32 layout, wMemoryArena* arena)
+{
+	SpriteBatch* batch = allocSpriteBatch(r, cap, layout, arena);
+	wEnableBatchStreaming(&batch->batch, cap);
+	return batch;
+}
+
+/* Static layers keep their sprites on the GPU between frames, for things
+ * like tilemaps. Fill them with setStaticSprite, which only re-sends the
+ * sprites that changed, and draw any sub-range with drawStaticSprites.
+ * addSprite/drawSprites don't apply to them.
+ */
+SpriteBatch* createStaticSpriteLayer(SpriteRenderer* r,
+		isize cap, i32 layout, wMemoryArena* arena)
+{
+	SpriteBatch* batch = allocSpriteBatch(r, cap, layout, arena);
+	if(!batch->expand) {
+		wEnableBatchStatic(&batch->batch, cap);
+	}
+	return batch;
+}
+
+void setStaticSprite(SpriteBatch* batch, isize index, Sprite* s)
+{
+	if(index < 0 || index >= batch->capacity) return;
+	batch->sprites[index] = *s;
+	if(batch->layout == SpriteLayout_Packed) {
+		wPackSprites(batch->packed + index, s, 1);
+	}
+	if(batch->grid) {
+		wSpriteGridInsert(batch->grid, s, index);
+	}
+	wMarkBatchDirty(&batch->batch, index, 1);
+}
+
+/* Only draw sprites that can be seen from the batch's current view. The
+ * grid covers w by h world units from (x, y); sprites outside that still
+ * work, they just all land in the edge cells. cellSize should be larger
+ * than most sprites, anything bigger gets tested every draw.
+ *
+ * Static layers keep the grid up to date in setStaticSprite, so call this
+ * before filling them. Otherwise it's rebuilt for every range drawn,
+ * which is still a win when most of the world is off screen.
+ */
+void enableSpriteCulling(SpriteBatch* batch, 
+		f32 x, f32 y, f32 w, f32 h, f32 cellSize,
+		i32 isStatic, wMemoryArena* arena)
+{
+	isize cap = batch->capacity;
+	if(!isStatic && cap < SpriteChunk_Capacity) cap = SpriteChunk_Capacity;
+	batch->grid = wArenaPush(arena, sizeof(wSpriteGrid));
+	wInitSpriteGrid(batch->grid, x, y, 
+			(i32)(w / cellSize) + 1, (i32)(h / cellSize) + 1,
+			cellSize, cap, arena);
+	if(!isStatic) {
+		batch->culled = wArenaPush(arena, sizeof(Sprite) * cap);
+	}
+}
+
+static
+void updateSpriteUniforms(SpriteBatch* batch)
+{
+	wTexture* texture = batch->batch.texture;
+	batch->vw = batch->renderer->state->width;
+	batch->vh = batch->renderer->state->height;
+	batch->itw = 1.0f / texture->w;
+	batch->ith = 1.0f / texture->h;
+}
+
+/* Queues draws instead of sending them, until flushSpriteQueue. The
+ * queue sorts by layer, then shader and texture, and draws whose state and
+ * uniform values match go out as one; stats has the counters for both.
+ * commands is how many draws a frame can queue before it flushes early.
+ */
+#define SpriteQueue_Staging (4 * SpriteChunk_Capacity * sizeof(Sprite))
+
+void enableSpriteQueue(SpriteRenderer* r, isize commands,
+		wMemoryInfo info, wMemoryArena* arena)
+{
+	r->queue = wArenaPush(arena, sizeof(wRenderQueue));
+	wInitRenderQueue(r->queue, commands, SpriteQueue_Staging, arena);
+	r->frame = wArenaBootstrap(info, 0);
+	wArenaStartTemp(r->frame);
+}
+
+void flushSpriteQueue(SpriteRenderer* r)
+{
+	if(!r->queue) return;
+	wFlushRenderQueue(r->state, r->queue);
+	wArenaEndTemp(r->frame);
+	wArenaStartTemp(r->frame);
+}
+
+// What the queue saved, since the start (or the last wGetRenderStats reset)
+void logSpriteQueueStats(SpriteRenderer* r)
+{
+	if(!r->queue) return;
+	wRenderStats stats;
+	wGetRenderStats(&stats, 0);
+	wLogError(0, "Sprite queue: %d draws queued, %d issued; "
+			"program binds %d (%d skipped), texture binds %d (%d skipped), "
+			"uniforms %d (%d skipped)\n",
+			(i32)r->queue->queuedDraws, (i32)r->queue->issuedDraws,
+			(i32)stats.programBinds, (i32)stats.programBindsSkipped,
+			(i32)stats.textureBinds, (i32)stats.textureBindsSkipped,
+			(i32)stats.uniformsUploaded, (i32)stats.uniformsSkipped);
+}
+
+static
+void submitSpriteBatch(SpriteBatch* batch, wRenderBatch* rb)
+{
+	SpriteRenderer* r = batch->renderer;
+	if(!r->queue) {
+		wDrawBatch(r->state, rb, batch);
+		return;
+	}
+
+	// The buffers ranges are built in get reused by the next range, and
+	// the view can move before the flush, so queue copies of both.
+	// Static layers draw from what's already on the GPU.
+	void* data = rb->data;
+	if(rb->uploadMode != wRenderBatch_UploadStatic) {
+		isize size = rb->elementCount * rb->elementSize;
+		rb->data = wArenaPush(r->frame, size);
+		memcpy(rb->data, data, size);
+	}
+	SpriteBatch* view = wArenaPush(r->frame, sizeof(SpriteBatch));
+	*view = *batch;
+	wQueueBatch(r->state, r->queue, rb, view, 
+			wMakeSortKey(rb, batch->layer, 0));
+	rb->data = data;
+}
+
+static
+void drawSpriteRange(SpriteBatch* batch, Sprite* sprites, isize count)
+{
+	if(count <= 0) return;
+	wRenderBatch* rb = &batch->batch;
+	updateSpriteUniforms(batch);
+
+	if(batch->expand) {
+		rb = &batch->expandBatch;
+		rb->elementCount = wExpandSprites(batch->verts, sprites, count,
+				batch->x, batch->y, batch->scale, batch->vw, batch->vh);
+	} else if(batch->layout == SpriteLayout_Packed) {
+		wPackSprites(batch->packed, sprites, count);
+		rb->data = batch->packed;
+		rb->elementCount = count;
+	} else {
+		rb->data = sprites;
+		rb->elementCount = count;
+	}
+
+	submitSpriteBatch(batch, rb);
+}
+
+static
+void drawCulledRange(SpriteBatch* batch, Sprite* sprites, isize count)
+{
+	if(batch->grid && count > 0) {
+		updateSpriteUniforms(batch);
+		wBuildSpriteGrid(batch->grid, sprites, count);
+		count = wCullSprites(batch->grid, sprites,
+				batch->x, batch->y, 
+				batch->x + batch->vw / batch->scale,
+				batch->y + batch->vh / batch->scale,
+				batch->culled);
+		sprites = batch->culled;
+	}
+	drawSpriteRange(batch, sprites, count);
+}
+
+static
+void drawStaticRange(SpriteBatch* batch, isize start, isize count)
+{
+	// Without instancing there's nothing to keep on the GPU; sprites are
+	// expanded for the current view every frame
+	if(batch->expand) {
+		drawSpriteRange(batch, batch->sprites + start, count);
+		return;
+	}
+
+	updateSpriteUniforms(batch);
+	batch->batch.startOffset = start;
+	batch->batch.elementCount = count;
+	submitSpriteBatch(batch, &batch->batch);
+}
+
+#define SpriteCull_MaxRuns 256
+
+void drawStaticSprites(SpriteBatch* batch, isize start, isize count)
+{
+	if(start < 0) start = 0;
+	if(start + count > batch->capacity) count = batch->capacity - start;
+	if(count <= 0) return;
+
+	if(!batch->grid) {
+		drawStaticRange(batch, start, count);
+		return;
+	}
+
+	// Draw the visible runs that fall inside [start, start + count)
+	isize runs[SpriteCull_MaxRuns * 2];
+	updateSpriteUniforms(batch);
+	isize runCount = wCullSpriteRuns(batch->grid, batch->sprites,
+			batch->x, batch->y, 
+			batch->x + batch->vw / batch->scale,
+			batch->y + batch->vh / batch->scale,
+			runs, SpriteCull_MaxRuns);
+	isize end = start + count;
+	for(isize i = 0; i < runCount; ++i) {
+		isize runStart = runs[i * 2];
+		isize runEnd = runStart + runs[i * 2 + 1];
+		if(runStart < start) runStart = start;
+		if(runEnd > end) runEnd = end;
+		if(runEnd > runStart) {
+			drawStaticRange(batch, runStart, runEnd - runStart);
+		}
+	}
+}
+
+static
+void drawSegmentRange(wSprite* sprites, isize count, void* userdata)
+{
+	drawCulledRange(userdata, sprites, count);
+}
+
+// The batch's own sprites, then whatever workers submitted, in order
+void drawSprites(SpriteBatch* batch)
+{
+	drawCulledRange(batch, batch->sprites, batch->count);
+	batch->count = 0;
+
+	flushSpriteSegments(&batch->segments, drawSegmentRange, batch);
+}
+
+void addSprite(SpriteBatch* batch, Sprite* s)
+{
+	if(batch->count >= batch->capacity) {
+		drawCulledRange(batch, batch->sprites, batch->count);
+		batch->count = 0;
+	}
+	batch->sprites[batch->count++] = *s;
+}
@@ -0,0 +1,189 @@
+/* Sprites submitted from worker threads go into per-thread segments.
+ * A segment is a chain of chunks pushed from that thread's own arena, so
+ * submitting needs no locking and never runs out of room. Flushing hands
+ * the chunks over segment by segment, in index order, which is the same
+ * order you'd get submitting everything from one thread, as long as job
+ * gives each segment its slice of the work in order.
+ *
+ * Workers only start on the first submitSpritesParallel, so a batch that
+ * never uses them costs a few arenas and no threads.
+ *
+ * Included by spritebatch.c and by segmentcheck, which checks that order.
+ */
+#define SpriteChunk_Capacity 4096
+
+typedef struct SpriteChunk SpriteChunk;
+struct SpriteChunk
+{
+	SpriteChunk* next;
+	isize count;
+	wSprite sprites[SpriteChunk_Capacity];
+};
+
+typedef struct
+{
+	wMemoryArena* arena;
+	SpriteChunk *first, *last;
+} SpriteSegment;
+
+typedef void (*SpriteJobProc)(SpriteSegment* segment,
+		isize index, isize count, void* userdata);
+typedef void (*SpriteRangeProc)(wSprite* sprites, isize count, void* userdata);
+
+typedef struct SpriteWorker SpriteWorker;
+
+typedef struct
+{
+	SpriteSegment* segments;
+	SpriteWorker* workers;
+	isize count;
+	i32 started;
+	volatile i32 quit;
+	SpriteJobProc job;
+	void* jobData;
+} SpriteSegments;
+
+struct SpriteWorker
+{
+	SpriteSegments* owner;
+	isize index;
+	void* thread;
+	void *start, *done;
+};
+
+wSprite* segmentPushSprite(SpriteSegment* segment)
+{
+	SpriteChunk* chunk = segment->last;
+	if(!chunk || chunk->count >= SpriteChunk_Capacity) {
+		chunk = wArenaPush(segment->arena, sizeof(SpriteChunk));
+		chunk->next = NULL;
+		chunk->count = 0;
+		if(segment->last) {
+			segment->last->next = chunk;
+		} else {
+			segment->first = chunk;
+		}
+		segment->last = chunk;
+	}
+	return chunk->sprites + chunk->count++;
+}
+
+static
+i32 spriteWorkerProc(void* data)
+{
+	SpriteWorker* worker = data;
+	SpriteSegments* owner = worker->owner;
+	while(1) {
+		wSemaphoreWait(worker->start);
+		if(wAtomicLoad(&owner->quit)) {
+			break;
+		}
+		owner->job(owner->segments + worker->index,
+				worker->index, owner->count,
+				owner->jobData);
+		wSemaphorePost(worker->done);
+	}
+	return 0;
+}
+
+void initSpriteSegments(SpriteSegments* s, isize count,
+		wMemoryInfo info, wMemoryArena* arena)
+{
+	s->count = count;
+	s->started = 0;
+	s->quit = 0;
+	s->segments = wArenaPush(arena, sizeof(SpriteSegment) * count);
+	s->workers = wArenaPush(arena, sizeof(SpriteWorker) * count);
+	for(isize i = 0; i < count; ++i) {
+		SpriteSegment* segment = s->segments + i;
+		segment->arena = wArenaBootstrap(info,
+				Arena_NoRecommit | Arena_NoZeroMemory);
+		segment->first = NULL;
+		segment->last = NULL;
+		wArenaStartTemp(segment->arena);
+
+		SpriteWorker* worker = s->workers + i;
+		worker->owner = s;
+		worker->index = i;
+		worker->thread = NULL;
+		worker->start = NULL;
+		worker->done = NULL;
+	}
+}
+
+static
+void startSpriteWorkers(SpriteSegments* s)
+{
+	s->started = 1;
+	for(isize i = 0; i < s->count; ++i) {
+		SpriteWorker* worker = s->workers + i;
+		worker->start = wCreateSemaphore(0);
+		worker->done = wCreateSemaphore(0);
+		if(worker->start && worker->done) {
+			worker->thread = wCreateThread(spriteWorkerProc, worker);
+		}
+	}
+}
+
+// Runs job once per segment on that segment's worker and waits for all
+// of them. Segments whose worker didn't start are filled inline.
+void submitSpritesParallel(SpriteSegments* s, SpriteJobProc job, void* userdata)
+{
+	if(!s->started) {
+		startSpriteWorkers(s);
+	}
+	s->job = job;
+	s->jobData = userdata;
+	for(isize i = 0; i < s->count; ++i) {
+		SpriteWorker* worker = s->workers + i;
+		if(worker->thread) {
+			wSemaphorePost(worker->start);
+		} else {
+			job(s->segments + i, i, s->count, userdata);
+		}
+	}
+
+	for(isize i = 0; i < s->count; ++i) {
+		SpriteWorker* worker = s->workers + i;
+		if(worker->thread) {
+			wSemaphoreWait(worker->done);
+		}
+	}
+}
+
+// Stops and joins the workers and frees the segments' arenas; anything
+// still unflushed is dropped
+void destroySpriteSegments(SpriteSegments* s)
+{
+	wAtomicStore(&s->quit, 1);
+	for(isize i = 0; i < s->count; ++i) {
+		SpriteWorker* worker = s->workers + i;
+		if(worker->thread) {
+			wSemaphorePost(worker->start);
+			wWaitThread(worker->thread);
+			worker->thread = NULL;
+		}
+		if(worker->start) wDestroySemaphore(worker->start);
+		if(worker->done) wDestroySemaphore(worker->done);
+		worker->start = NULL;
+		worker->done = NULL;
+		wArenaDestroy(s->segments[i].arena);
+	}
+	s->count = 0;
+	s->started = 0;
+}
+
+// Hands every chunk to proc in submission order, then empties the segments
+void flushSpriteSegments(SpriteSegments* s, SpriteRangeProc proc, void* userdata)
+{
+	for(isize i = 0; i < s->count; ++i) {
+		SpriteSegment* segment = s->segments + i;
+		for(SpriteChunk* c = segment->first; c; c = c->next) {
+			proc(c->sprites, c->count, userdata);
+		}
+		segment->first = NULL;
+		segment->last = NULL;
+		wArenaEndTemp(segment->arena);
+		wArenaStartTemp(segment->arena);
+	}
+}
@@ -0,0 +1,259 @@
+/* wb_lz4.h
+ *
+ * LZ4 block format, for things that need to come out of an archive
+ * quickly: decoding is mostly memcpy, several times faster than inflate,
+ * for a somewhat worse ratio. Blocks only, no frames or checksums; the
+ * s-archive keeps the sizes.
+ *
+ * Define WB_LZ4_IMPLEMENTATION in one file before including this, and
+ * WB_LZ4_ENCODER as well to get the encoder (the game only decodes).
+ * Uses the integer types from wpl.h.
+ *
+ * The format, for reference: a block is sequences of
+ *   token, [literal length bytes], literals, offset (u16 LE),
+ *   [match length bytes]
+ * where the token's high nibble is the literal length and its low nibble
+ * the match length minus 4; 15 in either means more bytes follow, added
+ * on until one isn't 255. The last sequence is just literals.
+ */
+
+#ifndef WB_LZ4_H
+#define WB_LZ4_H
+
+#define WB_LZ4_MIN_MATCH (4)
+#define WB_LZ4_MAX_OFFSET (65535)
+#define WB_LZ4_HASH_BITS (16)
+#define WB_LZ4_WINDOW (1 << 16)
+
+/* Decodes a block into output, which has to be exactly as big as what
+ * went in. Malformed input can't write or read out of bounds. Returns the
+ * size, or -1.
+ */
+isize wbLz4Decode(const void* input, isize inputSize,
+		void* output, isize outputSize);
+
+#ifdef WB_LZ4_ENCODER
+// About 384k; the encoder doesn't allocate
+typedef struct
+{
+	i32 head[1 << WB_LZ4_HASH_BITS];
+	u16 chain[WB_LZ4_WINDOW];
+} wbLz4Encoder;
+
+// The most an encoded block can take up
+#define wbLz4Bound(size) ((size) + (size) / 255 + 16)
+
+/* Greedy, walking a hash chain up to attempts deep for each match; more
+ * attempts find longer matches, which makes a smaller block that decodes
+ * just as fast. Returns the size, or 0 if it didn't fit in capacity.
+ */
+isize wbLz4Encode(wbLz4Encoder* encoder, const void* input, isize size,
+		void* output, isize capacity, i32 attempts);
+#endif
+
+#endif
+
+#ifdef WB_LZ4_IMPLEMENTATION
+#ifndef WB_LZ4_IMPLEMENTED
+#define WB_LZ4_IMPLEMENTED
+
+// Lengths of 15 carry on in bytes until one isn't 255
+#define WB_LZ4_READ_LENGTH(length) \
+	if(length == 15) { \
+		u32 more; \
+		do { \
+			if(ip >= iend) return -1; \
+			more = *ip++; \
+			length += more; \
+		} while(more == 255); \
+	}
+
+isize wbLz4Decode(const void* input, isize inputSize,
+		void* output, isize outputSize)
+{
+	const u8* ip = input;
+	const u8* iend = ip + inputSize;
+	u8* start = output;
+	u8* op = start;
+	u8* oend = op + outputSize;
+
+	while(ip < iend) {
+		u32 token = *ip++;
+		isize length = token >> 4;
+		WB_LZ4_READ_LENGTH(length);
+		if(length > iend - ip || length > oend - op) return -1;
+		// Most runs are short; copy a whole 16 when there's room
+		if(length <= 16 && iend - ip >= 16 && oend - op >= 16) {
+			memcpy(op, ip, 16);
+		} else {
+			memcpy(op, ip, length);
+		}
+		op += length;
+		ip += length;
+		if(ip == iend) break;
+
+		if(iend - ip < 2) return -1;
+		isize offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > op - start) return -1;
+		length = token & 15;
+		WB_LZ4_READ_LENGTH(length);
+		length += WB_LZ4_MIN_MATCH;
+		if(length > oend - op) return -1;
+
+		// Far enough back that each copy only reads what's already there
+		const u8* match = op - offset;
+		if(offset >= 16 && oend - op >= length + 16) {
+			for(isize i = 0; i < length; i += 16) {
+				memcpy(op + i, match + i, 16);
+			}
+		} else if(offset >= 8 && oend - op >= length + 8) {
+			for(isize i = 0; i < length; i += 8) {
+				memcpy(op + i, match + i, 8);
+			}
+		} else if(oend - op >= length + 8) {
+			// Runs: write out the pattern until a whole number of
+			// repeats of it is 8 long, then copy from that far back
+			for(isize i = 0; i < 8; ++i) {
+				op[i] = match[i];
+			}
+			isize distance = offset * ((8 + offset - 1) / offset);
+			for(isize i = 8; i < length; i += 8) {
+				memcpy(op + i, op + i - distance, 8);
+			}
+		} else {
+			for(isize i = 0; i < length; ++i) {
+				op[i] = match[i];
+			}
+		}
+		op += length;
+	}
+	return op == oend ? op - start : -1;
+}
+
+#ifdef WB_LZ4_ENCODER
+
+static
+u32 wbLz4Read32(const u8* p)
+{
+	u32 x;
+	memcpy(&x, p, 4);
+	return x;
+}
+
+static
+u32 wbLz4Hash(u32 x)
+{
+	return (x * 2654435761u) >> (32 - WB_LZ4_HASH_BITS);
+}
+
+static
+void wbLz4Insert(wbLz4Encoder* encoder, const u8* base, isize at)
+{
+	u32 h = wbLz4Hash(wbLz4Read32(base + at));
+	isize previous = encoder->head[h];
+	isize delta = previous >= 0 ? at - previous : 0;
+	encoder->chain[at & (WB_LZ4_WINDOW - 1)] =
+		(u16)(delta <= WB_LZ4_MAX_OFFSET ? delta : 0);
+	encoder->head[h] = (i32)at;
+}
+
+// Returns 0 if it doesn't fit
+static
+u8* wbLz4PutLength(u8* op, u8* oend, isize length)
+{
+	while(length >= 255) {
+		if(op >= oend) return 0;
+		*op++ = 255;
+		length -= 255;
+	}
+	if(op >= oend) return 0;
+	*op++ = (u8)length;
+	return op;
+}
+
+static
+u8* wbLz4PutSequence(u8* op, u8* oend, const u8* literals, isize literalLength,
+		isize offset, isize matchLength)
+{
+	if(op >= oend) return 0;
+	u8* token = op++;
+	*token = (u8)((literalLength >= 15 ? 15 : literalLength) << 4);
+	if(literalLength >= 15) {
+		op = wbLz4PutLength(op, oend, literalLength - 15);
+		if(!op) return 0;
+	}
+	if(literalLength > oend - op) return 0;
+	memcpy(op, literals, literalLength);
+	op += literalLength;
+	if(matchLength == 0) return op;
+
+	if(oend - op < 2) return 0;
+	*op++ = (u8)offset;
+	*op++ = (u8)(offset >> 8);
+	isize length = matchLength - WB_LZ4_MIN_MATCH;
+	*token |= (u8)(length >= 15 ? 15 : length);
+	if(length >= 15) {
+		op = wbLz4PutLength(op, oend, length - 15);
+	}
+	return op;
+}
+
+isize wbLz4Encode(wbLz4Encoder* encoder, const void* input, isize size,
+		void* output, isize capacity, i32 attempts)
+{
+	const u8* base = input;
+	u8* op = output;
+	u8* oend = op + capacity;
+	memset(encoder->head, 0xFF, sizeof(encoder->head));
+
+	// The format wants the last 5 bytes as literals, and no match
+	// starting in the last 12
+	isize matchLimit = size - 5;
+	isize lastMatch = size - 12;
+	isize ip = 0, anchor = 0;
+	while(ip < lastMatch) {
+		u32 seq = wbLz4Read32(base + ip);
+		isize candidate = encoder->head[wbLz4Hash(seq)];
+		wbLz4Insert(encoder, base, ip);
+
+		isize best = 0, bestAt = 0;
+		for(i32 i = 0; i < attempts && candidate >= 0 &&
+				ip - candidate <= WB_LZ4_MAX_OFFSET; ++i) {
+			if(wbLz4Read32(base + candidate) == seq) {
+				isize length = WB_LZ4_MIN_MATCH;
+				while(ip + length < matchLimit &&
+						base[candidate + length] == base[ip + length]) {
+					length++;
+				}
+				if(length > best) {
+					best = length;
+					bestAt = candidate;
+				}
+			}
+			isize delta = encoder->chain[candidate & (WB_LZ4_WINDOW - 1)];
+			if(delta == 0) break;
+			candidate -= delta;
+		}
+		if(best < WB_LZ4_MIN_MATCH) {
+			ip++;
+			continue;
+		}
+
+		op = wbLz4PutSequence(op, oend, base + anchor, ip - anchor,
+				ip - bestAt, best);
+		if(!op) return 0;
+		for(isize at = ip + 1; at < ip + best && at < lastMatch; ++at) {
+			wbLz4Insert(encoder, base, at);
+		}
+		ip += best;
+		anchor = ip;
+	}
+	op = wbLz4PutSequence(op, oend, base + anchor, size - anchor, 0, 0);
+	if(!op) return 0;
+	return op - (u8*)output;
+}
+
+#endif
+#endif
+#endif
@@ -57,14 +57,18 @@
    (this is the zlib license)
 */
 
+#ifdef _MSC_VER
 #include <intrin.h>
+#endif
 #include <emmintrin.h>
 #include <xmmintrin.h>
 
+#ifndef WBTM_NO_TYPES
 typedef __m128 vf128;
 typedef __m128i vi128;
 typedef float f32;
 typedef int i32;
+#endif
 
 /*
 #ifdef WB_STATIC_IMPLEMENTATION
@@ -21,12 +21,25 @@
 #endif
 #endif
 
+// SIMD math
+#define WBTM_NO_TYPES
+#include "thirdparty/wb_tm.c"
+
 // Stuff that relies on the backend
 #include "wplRender.c"
+#include "wplSprites.c"
 #include "wplFileHandling.c"
 #include "wplArchive.c"
+#include "wplAtlas.c"
+#include "wplTextureLoader.c"
 #include "wplUtil.c"
 
+// Audio
+#include "wplMixer.c"
+#include "wplSampleCache.c"
+#include "wplVorbis.c"
+#include "wplAudioRender.c"
+
 // Other functions
 wWindowDef wDefineWindow(string title)
 {
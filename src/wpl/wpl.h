@@ -72,6 +72,9 @@ typedef union vf32x4 vf32x4;
 
 #define Shader_MaxAttribs 16
 #define Shader_MaxUniforms 16
+#define Shader_UniformShadowSize 64
+#define RenderBatch_StreamRegions 3
+#define RenderBatch_MaxDirtyRanges 8
 
 #define Arena_Normal 0
 #define Arena_FixedSIze 1
@@ -102,21 +105,48 @@ typedef struct wWindowDef wWindowDef;
 typedef struct wWindow wWindow;
 typedef struct wInputState wInputState;
 typedef struct wState wState;
+typedef struct wAudioState wAudioState;
 
 typedef struct wSprite wSprite;
 typedef struct wVertex wVertex;
+typedef struct wPackedSprite wPackedSprite;
+typedef struct wSpriteGrid wSpriteGrid;
 typedef struct wRenderGroup wRenderGroup;
 typedef struct wRenderBatch wRenderBatch;
+typedef struct wRenderCommand wRenderCommand;
+typedef struct wRenderQueue wRenderQueue;
+typedef struct wRenderStats wRenderStats;
 typedef struct wShaderComponent wShaderComponent;
 typedef struct wShader wShader;
 typedef struct wTexture wTexture;
+typedef struct wAtlasRegion wAtlasRegion;
+typedef struct wAtlasHeader wAtlasHeader;
+typedef struct wAtlasImage wAtlasImage;
+typedef struct wAtlas wAtlas;
+typedef struct wTextureRequest wTextureRequest;
+typedef struct wTextureWorker wTextureWorker;
+typedef struct wTextureLoader wTextureLoader;
 
 typedef struct wMixer wMixer;
 typedef struct wMixerVoice wMixerVoice;
 typedef struct wMixerStream wMixerStream;
 typedef struct wMixerSample wMixerSample;
+typedef struct wMixerCommand wMixerCommand;
+typedef struct wMixerSlot wMixerSlot;
+typedef struct wMixerReverb wMixerReverb;
+typedef struct wMixerEffect wMixerEffect;
+typedef struct wMixerBus wMixerBus;
+typedef struct wVorbisBuffer wVorbisBuffer;
+typedef struct wCachedSample wCachedSample;
+typedef struct wSampleBlock wSampleBlock;
+typedef struct wSampleCache wSampleCache;
+typedef struct wVorbisStream wVorbisStream;
+typedef struct wRenderEvent wRenderEvent;
+typedef struct wAudioRender wAudioRender;
 typedef void (*wMixerStreamProc)(wMixerSample* sample, void* userdata);
 
+typedef i32 (*wThreadProc)(void* data);
+
 typedef struct wSlice wSlice;
 typedef struct wSpriteList wSpriteList;
 typedef struct wGlyph wGlyph;
@@ -168,12 +198,17 @@ i32 wCheckHotFile(wHotFile* file);
 /* s-archive types */
 
 #define wSar_Magic (0x77536172)
-#define wSar_Version (101)
+// 102 added wSar_KindStored
+// 103 added the source table
+// 104 added wSar_KindChunked
+// 105 added wSar_KindLz4
+#define wSar_Version (105)
 #pragma pack(push, 4)
 #define wSar_NameLen (55)
 typedef struct wSarId wSarId;
 typedef struct wSarHeader wSarHeader;
 typedef struct wSarFile wSarFile;
+typedef struct wSarSource wSarSource;
 typedef struct wSarArchive wSarArchive;
 typedef struct wSarEditingArchive wSarEditingArchive;
 
@@ -183,6 +218,25 @@ struct wSarId
 	char name[wSar_NameLen], zero;
 };
 
+// How a file's data is kept, in wSarFile::kind: mostly, the codec
+enum {
+	wSar_KindDeflate,
+	// As is: for files that are already compressed, like pngs and oggs
+	wSar_KindStored,
+	// Big files, in wSar_ChunkSize pieces that inflate on their own. The
+	// data starts with a u64 offset, from the start of the data, for each
+	// chunk and one for the end; a chunk as long as its size is stored.
+	// The chunks' codec is in the next byte up (deflate, for 104).
+	wSar_KindChunked,
+	// LZ4 blocks (thirdparty/wb_lz4.h): decodes several times faster than
+	// deflate, for a worse ratio. For things read at load time.
+	wSar_KindLz4
+};
+#define wSarKindLayout(kind) ((kind) & 0xFF)
+#define wSarKindChunkCodec(kind) (((kind) >> 8) & 0xFF)
+#define wSar_ChunkSize (256 * 1024)
+#define wSar_MaxThreads (16)
+
 struct wSarFile
 {
 	wSarId id;
@@ -193,11 +247,24 @@ struct wSarFile
 	u64 location;
 };
 
+/* What the sar tool made each file from, so it can skip the ones that
+ * haven't changed: one for each file, in the same order as the table.
+ * Archives from before 103 don't have them; the game never reads them.
+ */
+struct wSarSource
+{
+	u64 contentHash;
+	u64 modified;
+	u64 size;
+};
+
 struct wSarHeader
 {
 	u32 magic;
 	u32 version;
-	u64 unused[3];
+	// 0 if there aren't any
+	u64 sourceTableLocation;
+	u64 unused[2];
 
 	wSarId id;
 	u64 archiveSize;
@@ -212,6 +279,9 @@ struct wSarArchive
 	wSarHeader* header;
 	char* description;
 	wSarFile* files;
+	// Set by wSarOpen; size is 0 for archives from wSarLoad
+	isize size;
+	i32 mapped;
 };
 
 #pragma pack(pop)
@@ -266,12 +336,28 @@ struct wTaggedHeap
 };
 
 /* inherited sts_mixer types */
+enum {
+	wMixer_FormatF32,
+	wMixer_FormatS16
+};
+
 struct wMixerSample
 {
-	//in samples (4 bytes)
+	// In samples (frames for mono, floats for streams)
 	u32 length;
 	u32 frequency;        
 	void* data;
+	// Mono samples can be int16; streams are always float
+	i32 format;
+	// Where voices playing it go; 0 is the master bus
+	i32 bus;
+
+	// Game thread; 0 for no limit. Plays past the limit are dropped.
+	i32 maxInstances;
+	i32 instances;
+	// Game thread; mixer->commandHead when a voice last let go of it.
+	// The audio thread can still be reading it until commandTail gets there.
+	i32 lastCommand;
 };
 
 struct wMixerStream 
@@ -281,15 +367,196 @@ struct wMixerStream
 	wMixerSample sample;           
 };
 
+enum {
+	wMixer_InterpNearest,
+	wMixer_InterpLinear,
+	wMixer_InterpCubic,
+	wMixer_InterpSinc
+};
+
 struct wMixerVoice 
 {
 	wMixerSample* sample;
 	wMixerStream* stream;
-	f32 position;
+	// In frames, 32.32 fixed point
+	u64 position;
 	f32 gain;
 	f32 pitch;
 	f32 pan;
 	i32 state;
+	i32 interpolation;
+	i32 bus;
+	u32 generation;
+	// Neighbours in mixer's playing list, or -1 at either end
+	i32 prevPlaying, nextPlaying;
+
+	// Positional voices work out their gain and pan from where they are
+	// relative to the listener, and ramp to it over each block.
+	// lastLeft is -1 before the first block.
+	i32 rolloff;
+	f32 x, y;
+	f32 minDistance, maxDistance;
+	f32 lastLeft, lastRight;
+};
+
+/* Voices are referred to by handles: the voice index in the low 16 bits,
+ * and a generation counter above that, so a handle to a voice that has
+ * since been reused doesn't touch the new sound.
+ */
+#define Mixer_MaxVoices (0xFFFF)
+#define Mixer_CommandCapacity (1024)
+// Streams play at this, so sound effects never steal music
+#define Mixer_StreamPriority (0x7FFFFFFF)
+
+/* How positional voices fade with distance. All of them are full
+ * volume inside minDistance and silent past maxDistance; t is how far
+ * between the two they are, 0 to 1.
+ */
+enum {
+	// Not positional: gain and pan are as set
+	wMixer_RolloffNone,
+	// 1 - t
+	wMixer_RolloffLinear,
+	// minDistance / distance, shifted to reach 0 at maxDistance
+	wMixer_RolloffInverse,
+	// (1 - t)^2
+	wMixer_RolloffQuadratic
+};
+
+// Voices quieter than this aren't mixed, just moved along; see wMixer
+#define Mixer_VirtualGain (1.0f / 1024.0f)
+
+// Who gets cut off when there are no free voices
+enum {
+	wMixer_StealNone,
+	// Lowest priority, then quietest, then oldest
+	wMixer_StealQuietest,
+	// Lowest priority, then oldest
+	wMixer_StealOldest
+};
+
+enum {
+	wMixer_CmdPlay,
+	wMixer_CmdPlayStream,
+	wMixer_CmdStop,
+	wMixer_CmdStopSample,
+	wMixer_CmdStopStream,
+	wMixer_CmdSetGain,
+	wMixer_CmdSetPitch,
+	wMixer_CmdSetPan,
+	wMixer_CmdSetInterpolation,
+	wMixer_CmdSetBus,
+	wMixer_CmdSetBusGain,
+	wMixer_CmdSetEffect,
+	wMixer_CmdSetPosition,
+	wMixer_CmdSetRolloff,
+	wMixer_CmdSetListener
+};
+
+struct wMixerCommand
+{
+	i32 type;
+	i32 handle;
+	// wMixerSample or wMixerStream
+	void* source;
+	f32 gain, pitch, pan;
+	i32 interpolation;
+	i32 bus, effect;
+	f32 params[3];
+	i32 rolloff;
+	f32 x, y, minDistance, maxDistance;
+};
+
+// The game thread's idea of a voice
+struct wMixerSlot
+{
+	u32 generation;
+	i32 active;
+	// Free list link, or position in the steal heap while active
+	i32 next;
+	i32 heapIndex;
+
+	i32 priority;
+	f32 gain;
+	u32 serial;
+	wMixerSample* sample;
+
+	// For positional voices, so the steal heap goes by how loud they are
+	// where the listener is; loudness is gain for the rest
+	i32 rolloff;
+	f32 x, y, minDistance, maxDistance;
+	f32 loudness;
+};
+
+#define Mixer_BlockSize (256)
+// int16 samples get converted this many frames at a time
+#define Mixer_ConvertFrames (Mixer_BlockSize * 4)
+
+#define Mixer_MaxBuses (16)
+#define Mixer_MaxEffects (4)
+#define Mixer_ReverbCombs (4)
+#define Mixer_ReverbAllpasses (2)
+// Reverb delay lines are allocated long enough for this rate
+#define Mixer_ReverbMaxRate (96000)
+// The output is linear up to here, and eases into full scale past it
+#define Mixer_SoftLimitKnee (0.8f)
+
+/* Effect parameters:
+ *   LowPass, HighPass: cutoff in Hz, Q (0 for 0.707)
+ *   Reverb: room size 0-1, damping 0-1, wet level
+ *   Limiter: threshold (0 for 0.9), release in seconds (0 for 0.1)
+ */
+enum {
+	wMixer_EffectLowPass,
+	wMixer_EffectHighPass,
+	wMixer_EffectReverb,
+	wMixer_EffectLimiter
+};
+
+// A small Freeverb: four combs a side, then two allpasses in series
+struct wMixerReverb
+{
+	u32 frequency;
+	f32 feedback, damping, wet;
+	f32* combs[2][Mixer_ReverbCombs];
+	i32 combLength[2][Mixer_ReverbCombs];
+	i32 combIndex[2][Mixer_ReverbCombs];
+	f32 combFilter[2][Mixer_ReverbCombs];
+	f32* allpasses[2][Mixer_ReverbAllpasses];
+	i32 allpassLength[2][Mixer_ReverbAllpasses];
+	i32 allpassIndex[2][Mixer_ReverbAllpasses];
+};
+
+struct wMixerEffect
+{
+	i32 type;
+	f32 params[3];
+	// Set when params change; the audio thread works out the rest at
+	// its own rate
+	i32 dirty;
+
+	// Biquads run left and right in two lanes
+	f32 b0, b1, b2, a1, a2;
+	f32 z1[4], z2[4];
+
+	f32 threshold, release, envelope;
+	wMixerReverb* reverb;
+};
+
+/* Buses sum up their voices and child buses, run their effects in
+ * order, and add the result into their parent. Parents always come
+ * before their children, so one pass from the end does the whole graph.
+ */
+struct wMixerBus
+{
+	u64 hash;
+	i32 parent;
+	f32 gain;
+	wMixerEffect effects[Mixer_MaxEffects];
+	// Added to by the game thread; published with an atomic store
+	volatile i32 effectCount;
+	f32 left[Mixer_BlockSize];
+	f32 right[Mixer_BlockSize];
 };
 
 struct wMixer
@@ -297,8 +564,223 @@ struct wMixer
 	f32 gain; 
 	u32 frequency;
 	
+	// Owned by the audio thread. The voices that aren't stopped are
+	// linked through the voices themselves, in the order they started.
 	isize voiceCount;
 	wMixerVoice* voices;
+	i32 firstPlaying, lastPlaying;
+
+	// Owned by the game thread. Active slots are kept in a min-heap with
+	// the next voice to steal on top.
+	wMixerSlot* slots;
+	i32* heap;
+	isize activeCount;
+	i32 freeSlot;
+	u32 serial;
+	i32 stealPolicy;
+
+	// What wMixerPlaySample gives new voices, and wMixerPlaySampleAt
+	// positional ones
+	i32 interpolation;
+	i32 rolloff;
+	f32 minDistance, maxDistance;
+	// The game thread's copy of the listener; the audio thread's is below
+	f32 listenerX, listenerY;
+
+	// Single producer/single consumer rings; capacities are powers of two.
+	// The game thread queues commands, and the audio thread runs them at
+	// the start of each block and sends back handles of voices that
+	// stopped, so nothing else is shared between them.
+	wMixerCommand* commands;
+	i32 commandCapacity;
+	volatile i32 commandHead, commandTail;
+	i32* finished;
+	i32 finishedCapacity;
+	volatile i32 finishedHead, finishedTail;
+
+	// Bus 0 is the master. Buses are only ever added, so the audio
+	// thread can pick up new ones without locking.
+	wMixerBus* buses;
+	volatile i32 busCount;
+
+	// Each voice renders a block into voiceLeft/Right, which gets summed
+	// into its bus, and the master bus gets soft limited and interleaved
+	// into the output.
+	f32 voiceLeft[Mixer_BlockSize];
+	f32 voiceRight[Mixer_BlockSize];
+	f32 convert[Mixer_ConvertFrames];
+
+	// Sample voices quieter than virtualGain, after distance, keep
+	// their place in the sample but aren't mixed, and pick up where
+	// they'd be once they're louder again. 0 mixes everything.
+	f32 virtualGain;
+	// Audio thread: the listener, and how many voices the last block
+	// skipped
+	f32 earX, earY;
+	i32 virtualVoices;
+
+	// Time the last wMixerMixAudio took over the time it covered
+	f32 cpuLoad;
+};
+
+// What stb_vorbis gets to work in, setup and per-frame scratch together
+#define Vorbis_AllocSize (256 * 1024)
+// Played when the decoder falls behind
+#define Vorbis_SilenceFrames (Mixer_BlockSize)
+
+// Interleaved stereo. frames is 0 while the decoder owns it.
+struct wVorbisBuffer
+{
+	f32* data;
+	volatile i32 frames;
+	volatile i32 epoch;
+};
+
+/* Decodes a bit at a time into a pair of buffers that the mixer plays
+ * in turn, instead of holding the whole track as floats. Seeks bump
+ * seekEpoch, and buffers decoded before it get dropped unplayed.
+ */
+struct wVorbisStream
+{
+	// Play this with wMixerPlayStream
+	wMixerStream stream;
+	void* decoder;
+	i32 channels;
+	u32 frequency;
+	i32 totalFrames;
+	i32 bufferFrames;
+
+	// Set before playing; loopEnd of 0 is the end of the track
+	i32 loop;
+	i32 loopStart, loopEnd;
+
+	wVorbisBuffer buffers[2];
+	f32* silence;
+
+	// Decoder side
+	i32 fillIndex;
+	i32 decodeEpoch;
+	i32 decodeFrame;
+
+	// Audio side; playing is the buffer the mixer has, or -1
+	i32 playIndex;
+	i32 playing;
+
+	volatile i32 seekFrame, seekEpoch;
+	// The seekEpoch that decoded through to the end
+	volatile i32 endEpoch;
+	volatile i32 quit;
+	void* thread;
+	void* wake;
+
+	// Stats; decodeTime is in seconds
+	isize residentBytes;
+	i64 decodedFrames;
+	f64 decodeTime;
+	i32 starved;
+};
+
+// Keep cached samples as int16 instead of float
+#define SampleCache_Int16 (1)
+
+struct wCachedSample
+{
+	// First, so a wMixerSample* from the cache is a wCachedSample*
+	wMixerSample sample;
+	u64 hash;
+	i32 refs;
+	// Data lives in the cache's budget; sample.data is NULL once evicted
+	void* block;
+	isize size;
+	// Least recently used list of what's loaded
+	i32 prev, next;
+};
+
+// A free run of the budget, or the header of an allocated one
+struct wSampleBlock
+{
+	isize size;
+	wSampleBlock* next;
+};
+
+/* Samples by name, converted to mono at the mixer's rate when they're
+ * loaded. Everything loaded lives in one budget, and samples that nothing
+ * refers to get evicted, oldest use first, to make room.
+ */
+struct wSampleCache
+{
+	wMixer* mixer;
+	wWindow* window;
+	wMemoryArena* tempArena;
+	i32 flags;
+
+	wCachedSample* entries;
+	isize count, capacity;
+	// Open addressing on the hash; holds entry indices, -1 for empty
+	i32* table;
+	i32 tableMask;
+	i32 lruHead, lruTail;
+
+	u8* memory;
+	isize budget, used;
+	wSampleBlock* freeList;
+
+	// Stats
+	isize hits, misses, evictions, failed;
+};
+
+enum {
+	wRender_Play,
+	wRender_PlayStream,
+	wRender_Stop,
+	wRender_SetGain,
+	wRender_SetPitch,
+	wRender_SetPan,
+	wRender_SetBus,
+	wRender_SetBusGain
+};
+
+#define Render_MaxVoices (256)
+// 32-bit float stereo, canonical 44 byte header
+#define Wav_HeaderSize (44)
+
+/* One step of a render's timeline, applied exactly at its frame. voice is
+ * the script's own name for a voice: plays keep their handle in
+ * wAudioRender::voices[voice] for the events after them.
+ */
+struct wRenderEvent
+{
+	i64 frame;
+	i32 type;
+	i32 voice;
+	wMixerSample* sample;
+	wMixerStream* stream;
+	f32 gain, pitch, pan;
+	i32 bus;
+	i32 priority;
+};
+
+/* Runs a mixer with no device: events in frame order, mixed blockFrames
+ * at a time into output, timing every block.
+ */
+struct wAudioRender
+{
+	wMixer* mixer;
+	wRenderEvent* events;
+	isize eventCount;
+	i64 frames;
+	u32 blockFrames;
+	i32 voices[Render_MaxVoices];
+	// Interleaved stereo, frames * 2
+	f32* output;
+
+	// Stats
+	isize blockCount;
+	f64* blockTimes;
+	f64 totalTime;
+	f64 median, p90, p99, worst;
+	// Of the output rounded to 16 bits; see wAudioChecksum
+	u64 checksum;
 };
 
 /* core w types */
@@ -353,6 +835,26 @@ struct wInputState
 struct wAudioState
 {
 	wMixer mixer;
+
+	// What the device actually gave us
+	i32 frequency;
+	i32 bufferFrames;
+	u32 device;
+
+	// Written by the audio callback. An underrun is a callback that took
+	// longer than the audio it made, or one that came so late after the
+	// last that the device must have run dry.
+	// The lateness half only means something on a real device. SDL's
+	// dummy driver calls back, then sleeps the buffer's length rounded
+	// down to whole ms: callbacks come a little early, buffers under 1ms
+	// don't wait at all, and a coarse timer (Windows' 15.6ms, if
+	// SDL_HINT_TIMER_RESOLUTION is 0) makes nearly every callback with a
+	// short buffer count as late.
+	volatile i32 callbacks;
+	volatile i32 underruns;
+	volatile i32 lastCallbackMicros;
+	volatile i32 worstCallbackMicros;
+	f64 lastCallbackStart;
 };
 
 struct wState
@@ -409,6 +911,17 @@ enum {
 	wRenderBatch_ElementsInstanced,
 };
 
+enum {
+	//glBufferData every draw, letting the driver orphan the old storage
+	wRenderBatch_UploadOrphan,
+	//Ring buffer written with glMapBufferRange(UNSYNCHRONIZED)
+	wRenderBatch_UploadUnsynchronized,
+	//Ring buffer mapped once with glBufferStorage(PERSISTENT|COHERENT)
+	wRenderBatch_UploadPersistent,
+	//Kept on the GPU, only dirty ranges re-sent with glBufferSubData
+	wRenderBatch_UploadStatic,
+};
+
 enum {
 	wRenderBatch_BlendNormal,
 	wRenderBatch_BlendPremultiplied,
@@ -435,6 +948,85 @@ struct wShader
 	i32 attribCount, uniformCount;
 	wShaderComponent attribs[Shader_MaxAttribs];
 	wShaderComponent uniforms[Shader_MaxUniforms];
+
+	// Last value uploaded for each uniform; bit i of uniformShadowValid
+	// is set once uniforms[i] has been sent. Uniforms bigger than
+	// Shader_UniformShadowSize bytes aren't cached.
+	u32 uniformShadowValid;
+	u8 uniformShadow[Shader_MaxUniforms][Shader_UniformShadowSize];
+};
+
+/* Per-instance sprite layout read by the EGL3 sprite shader, and the
+ * input to wExpandSprites */
+struct wSprite
+{
+	f32 flags;
+	u32 color;
+	f32 x, y, z;
+	f32 angle;
+	f32 w, h;
+	f32 cx, cy;
+	i16 tx, ty, tw, th;
+};
+
+/* 16 byte version of wSprite for the EGL3Packed shader.
+ * Position and size are fixed point with PackedSprite_Subpixel steps per
+ * pixel (so +-8191px), z is folded into y, the angle is a fraction of a
+ * turn, and texture sizes are stored minus one (so 1..256 texels). There's
+ * no color or center; sprites are white, so their color is the batch's
+ * uTint (the fragment shaders apply it to every sprite), and rotate about
+ * the anchor.
+ */
+#define PackedSprite_Subpixel 4
+
+struct wPackedSprite
+{
+	i16 x, y;
+	i16 w, h;
+	i16 tx, ty;
+	u8 tw, th;
+	u8 angle;
+	u8 flags;
+};
+
+/* One corner of an expanded sprite, for contexts without instancing.
+ * Position is already in clip space; the rest is what the instanced
+ * vertex shader would have passed on to the fragment shader.
+ */
+struct wVertex
+{
+	f32 x, y;
+	f32 px, py;
+	f32 u, v;
+	f32 sx, sy;
+	u32 color;
+	f32 flags;
+};
+
+/* Uniform grid over sprite positions for culling (see wplSprites.c).
+ * Each cell is an intrusive doubly linked list of sprite indices; the
+ * extra list at heads[w * h] holds sprites too big to be found through
+ * their neighbouring cells.
+ */
+struct wSpriteGrid
+{
+	f32 x, y;
+	i32 w, h;
+	f32 cellSize, invCellSize;
+	isize count, capacity;
+
+	i32* heads;
+	i32* next;
+	i32* prev;
+	i32* cells;
+	u64* visible;
+};
+
+enum {
+	wSpriteExpand_Auto,
+	wSpriteExpand_Scalar,
+	wSpriteExpand_SSE,
+	wSpriteExpand_AVX2
 };
 
 struct wTexture
@@ -444,6 +1036,100 @@ struct wTexture
 	u32 glIndex;
 };
 
+/* Texture atlases
+ * Serialized as one blob: wAtlasHeader, then regionCount wAtlasRegions
+ * sorted by hash, then w * h RGBA pixels. Locations are byte offsets from
+ * the start of the blob.
+ */
+#define wAtlas_Magic (0x6c744177)
+#define wAtlas_Version (1)
+
+struct wAtlasRegion
+{
+	u64 hash;
+	i32 x, y, w, h;
+};
+
+struct wAtlasHeader
+{
+	u32 magic;
+	u32 version;
+	i32 w, h;
+	u64 regionCount;
+	u64 regionLocation;
+	u64 pixelLocation;
+};
+
+struct wAtlasImage
+{
+	string name;
+	u8* pixels;
+	i32 w, h;
+};
+
+struct wAtlas
+{
+	wTexture texture;
+	wAtlasRegion* regions;
+	isize regionCount, regionCapacity;
+	i32 border;
+
+	// stbrp_context and nodes; NULL for atlases from wLoadAtlas
+	void* packer;
+};
+
+/* Async texture loading
+ * Workers claim requests in order, load and decode them into their own
+ * arenas, and push the request index onto the completion queue. The main
+ * thread drains the queue in wUpdateTextureLoader, uploading until it runs
+ * out of budget for the frame.
+ */
+#define TextureLoader_MaxWorkers 16
+
+struct wTextureRequest
+{
+	wTexture* texture;
+	string name;
+	// NULL to load name as a loose file
+	wSarArchive* archive;
+	i32 failed;
+};
+
+struct wTextureWorker
+{
+	wTextureLoader* loader;
+	wMemoryArena* arena;
+	void* thread;
+};
+
+struct wTextureLoader
+{
+	wWindow* window;
+	wMemoryArena* arena;
+
+	wTextureRequest* requests;
+	isize count, capacity;
+
+	// Next request to claim; completion slots are reserved by bumping
+	// completedCount and hold -1 until the worker publishes into them.
+	volatile i32 nextRequest;
+	volatile i32 completedCount;
+	volatile i32* completed;
+	isize completedRead;
+
+	// Posted once per completion
+	void* ready;
+
+	wTextureWorker workers[TextureLoader_MaxWorkers];
+	i32 workerCount, threadCount;
+	i32 running;
+
+	// Stats, in seconds
+	isize uploaded, failed;
+	f64 startTime, totalTime;
+	f64 worstFrame, uploadTime;
+};
+
 struct wRenderBatch
 {
 	wTexture* texture;
@@ -462,6 +1148,68 @@ struct wRenderBatch
 	i32 blend;
 
 	i32 primitiveMode;
+
+	// Streaming uploads (see wEnableBatchStreaming)
+	// The ring is RenderBatch_StreamRegions regions of streamCapacity
+	// elements each; a fence is dropped as we leave a region, and waited
+	// on before we write into it again.
+	i32 uploadMode;
+	i32 streamRegion;
+	isize streamCapacity;
+	isize streamHead;
+	void* streamMap;
+	void* streamFences[RenderBatch_StreamRegions];
+
+	// Static layers (see wEnableBatchStatic)
+	// The vbo mirrors staticCapacity elements of data. Ranges are
+	// [start, end) in elements, kept sorted and non-overlapping.
+	isize staticCapacity;
+	isize dirtyCount;
+	isize dirtyRanges[RenderBatch_MaxDirtyRanges][2];
+};
+
+/* Sort keys, most significant first:
+ * 	layer (8) | program (10) | blend (2) | texture (14) | depth (24) 
+ * Depth only orders draws that share all their state, so anything that
+ * has to draw in a particular order should go on its own layer.
+ */
+#define RenderKey_LayerShift 56
+#define RenderKey_ProgramShift 46
+#define RenderKey_BlendShift 44
+#define RenderKey_TextureShift 30
+#define RenderKey_DepthShift 6
+
+struct wRenderCommand
+{
+	u64 key;
+	wRenderBatch* batch;
+	void* data;
+	isize elementCount;
+	isize startOffset;
+	void* uniformData;
+};
+
+struct wRenderQueue
+{
+	wRenderCommand* commands;
+	wRenderCommand* sortBuffer;
+	isize count, capacity;
+
+	// Merged instanced draws are concatenated in here
+	u8* staging;
+	isize stagingSize;
+
+	isize queuedDraws, issuedDraws;
+};
+
+struct wRenderStats
+{
+	isize draws;
+	isize programBinds, programBindsSkipped;
+	isize blendChanges, blendChangesSkipped;
+	isize textureBinds, textureBindsSkipped;
+	isize uniformsUploaded, uniformsSkipped;
+	isize bytesUploaded;
 };
 
 enum ButtonState
@@ -558,13 +1306,71 @@ void wInitBatch(wRenderBatch* batch,
 		isize elementSize, isize instanceSize,
 		void* data, u32* indices);
 void wConstructBatchGraphicsState(wRenderBatch* batch);
+i32 wEnableBatchStreaming(wRenderBatch* batch, isize capacity);
+i32 wEnableBatchStatic(wRenderBatch* batch, isize capacity);
+void wMarkBatchDirty(wRenderBatch* batch, isize start, isize count);
 void wDrawBatch(wState* state, wRenderBatch* batch, void* uniformData);
 
+void wInitRenderQueue(wRenderQueue* queue, 
+		isize capacity, isize stagingSize, 
+		wMemoryArena* arena);
+u64 wMakeSortKey(wRenderBatch* batch, u32 layer, u32 depth);
+void wQueueBatch(wState* state, wRenderQueue* queue, 
+		wRenderBatch* batch, void* uniformData, u64 key);
+void wFlushRenderQueue(wState* state, wRenderQueue* queue);
+
+void wInvalidateRenderState();
+void wGetRenderStats(wRenderStats* stats, i32 reset);
+
+
+/* Sprite expansion */
+i32 wSupportsInstancing();
+i32 wSetSpriteExpandMode(i32 mode);
+isize wExpandSpritesScalar(wVertex* verts, wSprite* sprites, isize count,
+		f32 offsetX, f32 offsetY, f32 scale, f32 viewportW, f32 viewportH);
+isize wExpandSprites(wVertex* verts, wSprite* sprites, isize count,
+		f32 offsetX, f32 offsetY, f32 scale, f32 viewportW, f32 viewportH);
+void wPackSprites(wPackedSprite* out, wSprite* sprites, isize count);
+
+/* Sprite culling */
+void wInitSpriteGrid(wSpriteGrid* grid, 
+		f32 x, f32 y, i32 w, i32 h, f32 cellSize, 
+		isize capacity, wMemoryArena* arena);
+void wBuildSpriteGrid(wSpriteGrid* grid, wSprite* sprites, isize count);
+void wSpriteGridInsert(wSpriteGrid* grid, wSprite* sprite, isize index);
+void wSpriteGridRemove(wSpriteGrid* grid, isize index);
+isize wCullSprites(wSpriteGrid* grid, wSprite* sprites, 
+		f32 minX, f32 minY, f32 maxX, f32 maxY, 
+		wSprite* out);
+isize wCullSpriteRuns(wSpriteGrid* grid, wSprite* sprites, 
+		f32 minX, f32 minY, f32 maxX, f32 maxY, 
+		isize* runs, isize maxRuns);
 
 //wTexture* wLoadTexture(wWindow* window, string filename, wMemoryArena* arena);
 i32 wInitTexture(wTexture* texture, void* data, isize size);
 void wUploadTexture(wTexture* texture);
 
+/* Async texture loading */
+void wInitTextureLoader(wTextureLoader* loader, wWindow* window,
+		isize capacity, i32 workerCount, wMemoryArena* arena);
+wTexture* wQueueTexture(wTextureLoader* loader, string filename);
+wTexture* wQueueSarTexture(wTextureLoader* loader, 
+		wSarArchive* archive, string name);
+void wStartTextureLoader(wTextureLoader* loader);
+isize wUpdateTextureLoader(wTextureLoader* loader, f64 budget);
+void wFinishTextureLoader(wTextureLoader* loader);
+i32 wTextureLoaderDone(wTextureLoader* loader);
+
+/* Texture atlases */
+void wInitAtlas(wAtlas* atlas, i32 w, i32 h, i32 border, 
+		isize capacity, wMemoryArena* arena);
+isize wAtlasAddImages(wAtlas* atlas, wAtlasImage* images, isize count,
+		wMemoryArena* tempArena);
+wAtlasRegion* wAtlasGetRegion(wAtlas* atlas, string name);
+isize wAtlasSerializedSize(wAtlas* atlas);
+isize wSerializeAtlas(wAtlas* atlas, void* out);
+i32 wLoadAtlas(wAtlas* atlas, void* data, isize size);
+
 /* Utility */
 void* wCopyMemory(void *dest, const void *source, i64 size);
 void wCopyMemoryBlock(void* dest, const void* source, 
@@ -581,6 +1387,30 @@ u8* wLoadLocalFile(wWindow* window, string filename, isize* sizeOut, wMemoryAren
 isize wLoadLocalSizedFile(
 		wWindow* window, string filename,
 		u8* buffer, isize bufferSize);
+i32 wWriteFile(string filename, void* data, isize size);
+void* wMapFile(string filename, isize* sizeOut);
+void wUnmapFile(void* data, isize size);
+
+/* Threads */
+
+// Handles are opaque; wCreateThread returns NULL if threads are
+// unavailable (eg, emscripten without pthreads), so callers should be
+// ready to do the work inline.
+void* wCreateThread(wThreadProc proc, void* data);
+void wWaitThread(void* thread);
+void* wCreateSemaphore(i32 initialCount);
+void wDestroySemaphore(void* semaphore);
+void wSemaphoreWait(void* semaphore);
+void wSemaphorePost(void* semaphore);
+i32 wGetProcessorCount();
+
+// Full barriers. wAtomicAdd returns the value from before the add.
+i32 wAtomicAdd(volatile i32* value, i32 amount);
+i32 wAtomicLoad(volatile i32* value);
+void wAtomicStore(volatile i32* value, i32 x);
+
+// High resolution timer in seconds, from an arbitrary start.
+f64 wGetTime();
 
 // TODO(will) simple screenshot function
 void wWriteImage(string filename, i64 w, i64 h, void* data);
@@ -630,22 +1460,92 @@ wTaggedHeap* wTaggedFixedSizeBootstrap(isize arenaSize,
 void* wTaggedAlloc(wTaggedHeap* heap, isize tag, usize size);
 void wTaggedFree(wTaggedHeap* heap, isize tag);
 
+/* Audio */
+
+// Opens the default device for float stereo at (about) frequency, with
+// the mixer pulled bufferFrames at a time from the device's thread.
+// Check audio->frequency and bufferFrames for what you got.
+// SDL backend only for now. SDL_AUDIODRIVER=dummy or disk runs without a
+// sound card.
+i32 wInitAudio(wAudioState* audio, i32 frequency, i32 bufferFrames,
+		isize voiceCount, wMemoryArena* arena);
+void wPauseAudio(wAudioState* audio, i32 paused);
+void wQuitAudio(wAudioState* audio);
+
 /* wplMixer interface */
 
-void wMixerInit(wMixer* mixer, unsigned int frequency, int audio_format);
+// wMixerMixAudio belongs to the audio thread; everything else is for one
+// other thread (the game), and only queues up changes for the next mix.
+void wMixerInit(wMixer* mixer, isize voiceCount, wMemoryArena* arena);
 int wMixerGetActiveVoices(wMixer* mixer);
 int wMixerPlaySample(wMixer* mixer, wMixerSample* sample, float gain, float pitch, float pan);
+int wMixerPlaySampleEx(wMixer* mixer, wMixerSample* sample, 
+		f32 gain, f32 pitch, f32 pan, i32 priority);
 int wMixerPlayStream(wMixer* mixer, wMixerStream* stream, float gain);
 void wMixerStopVoice(wMixer* mixer, int voice);
+void wMixerSetVoiceInterpolation(wMixer* mixer, int voice, i32 mode);
+void wMixerSetVoiceGain(wMixer* mixer, int voice, f32 gain);
+void wMixerSetVoicePitch(wMixer* mixer, int voice, f32 pitch);
+void wMixerSetVoicePan(wMixer* mixer, int voice, f32 pan);
 void wMixerStopSample(wMixer* mixer, wMixerSample* sample);
 void wMixerStopStream(wMixer* mixer, wMixerStream* stream);
+i32 wMixerAddBus(wMixer* mixer, string name, i32 parent);
+i32 wMixerGetBus(wMixer* mixer, string name);
+i32 wMixerAddEffect(wMixer* mixer, i32 bus, i32 type, 
+		f32 a, f32 b, f32 c, wMemoryArena* arena);
+void wMixerSetEffect(wMixer* mixer, i32 bus, i32 effect, f32 a, f32 b, f32 c);
+void wMixerSetBusGain(wMixer* mixer, i32 bus, f32 gain);
+void wMixerSetVoiceBus(wMixer* mixer, int voice, i32 bus);
+int wMixerPlaySampleAt(wMixer* mixer, wMixerSample* sample, 
+		f32 x, f32 y, f32 gain, f32 pitch, i32 priority);
+void wMixerSetVoicePosition(wMixer* mixer, int voice, f32 x, f32 y);
+void wMixerSetVoiceRolloff(wMixer* mixer, int voice, 
+		i32 rolloff, f32 minDistance, f32 maxDistance);
+void wMixerSetListener(wMixer* mixer, f32 x, f32 y);
 void wMixerMixAudio(wMixer* mixer, void* output, unsigned int samples);
 
+/* wplSampleCache interface */
+
+// budget is in bytes; capacity is the most different samples it'll see
+void wInitSampleCache(wSampleCache* cache, wMixer* mixer, wWindow* window,
+		isize budget, isize capacity, i32 flags, wMemoryArena* arena);
+wMixerSample* wLoadCachedSample(wSampleCache* cache, string filename);
+wMixerSample* wLoadCachedSarSample(wSampleCache* cache, 
+		wSarArchive* archive, string name);
+void wReleaseCachedSample(wSampleCache* cache, wMixerSample* sample);
+
+/* wplVorbis interface */
+
+// data is an .ogg file in memory, and has to outlive the stream
+i32 wInitVorbisStream(wVorbisStream* vs, void* data, isize size,
+		i32 bufferFrames, wMemoryArena* arena);
+void wSetVorbisLoop(wVorbisStream* vs, i32 loop, i32 loopStart, i32 loopEnd);
+void wSeekVorbisStream(wVorbisStream* vs, i32 frame);
+void wDestroyVorbisStream(wVorbisStream* vs);
+
+/* wplAudioRender interface */
+
+void wInitAudioRender(wAudioRender* render, wMixer* mixer,
+		wRenderEvent* events, isize eventCount,
+		i64 frames, u32 blockFrames, wMemoryArena* arena);
+void wRunAudioRender(wAudioRender* render);
+u64 wAudioChecksum(f32* samples, isize count);
+f32 wCompareAudioRender(wAudioRender* render, void* wav, isize size);
+isize wEncodeWav(void* out, f32* samples, isize frames, 
+		i32 channels, u32 frequency);
+
 /* s-archive interface */
 u64 wHashBuffer(const char* buf, isize length);
 u64 wHashString(string s);
 wSarArchive* wSarLoad(void* file, wMemoryArena* alloc);
+wSarArchive* wSarOpen(string filename, wMemoryArena* arena);
+void wSarClose(wSarArchive* archive);
 isize wSarGetFileIndexByHash(wSarArchive* archive, u64 key);
 wSarFile* wSarGetFile(wSarArchive* archive, string name);
 void* wSarGetFileData(wSarArchive* archive, string name, 
 		isize* sizeOut, wMemoryArena* arena);
+void* wSarGetFileDataParallel(wSarArchive* archive, string name, 
+		isize* sizeOut, i32 threadCount, wMemoryArena* arena);
+isize wSarGetChunkCount(wSarFile* file);
+isize wSarInflateChunk(wSarArchive* archive, wSarFile* file, 
+		isize chunk, void* output);
@@ -1,6 +1,8 @@
 
 #define TINFL_IMPLEMENTATION
 #include "thirdparty/tinfl.h"
+#define WB_LZ4_IMPLEMENTATION
+#include "thirdparty/wb_lz4.h"
 
 wSarArchive* wSarLoad(void* file, wMemoryArena* alloc)
 {
@@ -46,23 +48,258 @@ wSarFile* wSarGetFile(wSarArchive* archive, string name)
 {
 	u64 hash = wHashString(name);
 	isize index = wSarGetFileIndexByHash(archive, hash);
-	if(hash == -1) return NULL;
+	if(index == -1) return NULL;
 	return archive->files + index;
 }
 
+/* Maps the archive where the platform can, and reads it all in where it
+ * can't. Mapped, nothing is read until it's used, and stored files are
+ * never copied at all. Returns NULL if it isn't an archive this reads.
+ */
+wSarArchive* wSarOpen(string filename, wMemoryArena* arena)
+{
+	isize size = 0;
+	i32 mapped = 1;
+	void* data = wMapFile(filename, &size);
+	if(!data) {
+		mapped = 0;
+		data = wLoadFile(filename, &size, arena);
+		if(!data) return NULL;
+	}
+
+	wSarHeader* header = data;
+	if(size < (isize)sizeof(wSarHeader) || header->magic != wSar_Magic || 
+			header->version > wSar_Version ||
+			header->fileTableLocation > (u64)size || 
+			header->fileCount > 
+			((u64)size - header->fileTableLocation) / sizeof(wSarFile)) {
+		wLogError(0, "Error: %s isn't an s-archive this can read\n", filename);
+		if(mapped) {
+			wUnmapFile(data, size);
+		}
+		return NULL;
+	}
+
+	wSarArchive* archive = wSarLoad(data, arena);
+	archive->size = size;
+	archive->mapped = mapped;
+	return archive;
+}
+
+// Only unmaps; anything from wSarGetFileData that was stored goes with it
+void wSarClose(wSarArchive* archive)
+{
+	if(archive->mapped) {
+		wUnmapFile(archive->base, archive->size);
+		archive->mapped = 0;
+	}
+	archive->base = NULL;
+	archive->header = NULL;
+	archive->files = NULL;
+}
+
+/* NULL, and complains, if the file runs off the end of the archive.
+ * Stored files are handed out fullSize bytes at a time, so those sizes
+ * have to agree as well.
+ */
+static
+u8* sarFileInput(wSarArchive* archive, wSarFile* file)
+{
+	if(wSarKindLayout(file->kind) == wSar_KindStored && 
+			file->fullSize != file->compressedSize) {
+		wLogError(0, "Error: %s is stored, but its sizes differ\n", 
+				file->id.name);
+		return NULL;
+	}
+	if(archive->size > 0 && (file->location > (u64)archive->size ||
+			file->compressedSize > (u64)archive->size - file->location)) {
+		wLogError(0, "Error: %s runs off the end of the archive\n", 
+				file->id.name);
+		return NULL;
+	}
+	return (u8*)archive->base + file->location;
+}
+
+/* One stream in codec into exactly outputSize bytes; a new codec goes
+ * here. Returns 0 if it didn't come out the right size.
+ */
+static
+i32 sarDecode(u32 codec, void* output, usize outputSize, 
+		void* input, usize inputSize)
+{
+	switch(codec) {
+		case wSar_KindDeflate:
+			return wDecompressMemToMem(output, outputSize, 
+					input, inputSize, 0) == outputSize;
+		case wSar_KindLz4:
+			return wbLz4Decode(input, inputSize, 
+					output, outputSize) == (isize)outputSize;
+	}
+	return 0;
+}
+
+// Anything that isn't chunked is one chunk of fullSize
+isize wSarGetChunkCount(wSarFile* file)
+{
+	if(wSarKindLayout(file->kind) != wSar_KindChunked) return 1;
+	return (isize)((file->fullSize + wSar_ChunkSize - 1) / wSar_ChunkSize);
+}
+
+/* Inflates one chunk into output, which needs wSar_ChunkSize bytes (or
+ * fullSize, for files that aren't chunked). Chunks don't depend on each
+ * other, so they can be read in any order, from any thread. Returns how
+ * many bytes it wrote, or -1.
+ */
+isize wSarInflateChunk(wSarArchive* archive, wSarFile* file, 
+		isize chunk, void* output)
+{
+	u8* input = sarFileInput(archive, file);
+	if(!input || chunk < 0 || chunk >= wSarGetChunkCount(file)) return -1;
+	u32 layout = wSarKindLayout(file->kind);
+	u32 codec = layout == wSar_KindChunked ? 
+		wSarKindChunkCodec(file->kind) : layout;
+	if(codec != wSar_KindDeflate && codec != wSar_KindLz4 && 
+			codec != wSar_KindStored) {
+		wLogError(0, "Error: %s is stored in a way this can't read (%u)\n", 
+				file->id.name, file->kind);
+		return -1;
+	}
+	if(layout == wSar_KindStored) {
+		memcpy(output, input, file->fullSize);
+		return (isize)file->fullSize;
+	} else if(layout != wSar_KindChunked) {
+		if(!sarDecode(codec, output, file->fullSize, 
+					input, file->compressedSize)) {
+			wLogError(0, "Error: %s didn't inflate to its size\n", file->id.name);
+			return -1;
+		}
+		return (isize)file->fullSize;
+	}
+
+	// The table's wherever the entry starts, so it's copied out
+	u64 tableSize = sizeof(u64) * (wSarGetChunkCount(file) + 1);
+	u64 start = 0, end = 0;
+	if(tableSize <= file->compressedSize) {
+		memcpy(&start, input + sizeof(u64) * chunk, sizeof(u64));
+		memcpy(&end, input + sizeof(u64) * (chunk + 1), sizeof(u64));
+	}
+	if(start < tableSize || start > end || end > file->compressedSize) {
+		wLogError(0, "Error: %s has a broken chunk table\n", file->id.name);
+		return -1;
+	}
+	u64 size = file->fullSize - (u64)chunk * wSar_ChunkSize;
+	if(size > wSar_ChunkSize) {
+		size = wSar_ChunkSize;
+	}
+	if(end - start == size) {
+		memcpy(output, input + start, size);
+		return (isize)size;
+	}
+	if(!sarDecode(codec, output, size, input + start, end - start)) {
+		wLogError(0, "Error: chunk %d of %s didn't inflate to its size\n", 
+				(i32)chunk, file->id.name);
+		return -1;
+	}
+	return (isize)size;
+}
+
+/* Stored files come back as a pointer into the archive itself, so treat
+ * what this returns as read-only, and not NUL terminated. Deflated ones
+ * are inflated into the arena.
+ */
 void* wSarGetFileData(wSarArchive* archive, string name, 
 		isize* sizeOut, wMemoryArena* arena)
 {
 	wSarFile* file = wSarGetFile(archive, name);
-	void* input = archive->base + file->location;
-	void* output = wArenaPush(arena, file->fullSize + 8);
-	wDecompressMemToMem(
-			output, file->fullSize + 8, 
-			input, file->compressedSize, 
-			0);
+	if(!file) return NULL;
+	u8* input = sarFileInput(archive, file);
+	if(!input) return NULL;
+	u8* output = NULL;
+	if(wSarKindLayout(file->kind) == wSar_KindStored) {
+		output = input;
+	} else {
+		output = wArenaPush(arena, file->fullSize + 8);
+		isize count = wSarGetChunkCount(file);
+		for(isize i = 0; i < count; ++i) {
+			if(wSarInflateChunk(archive, file, i, 
+						output + i * wSar_ChunkSize) < 0) {
+				return NULL;
+			}
+		}
+	}
 	if(sizeOut) {
 		*sizeOut = file->fullSize;
 	}
 	return output;
 }
 
+typedef struct
+{
+	wSarArchive* archive;
+	wSarFile* file;
+	u8* output;
+	i32 count;
+	volatile i32 next;
+	volatile i32 failed;
+} SarInflateJob;
+
+static
+i32 sarInflateWorker(void* data)
+{
+	SarInflateJob* job = data;
+	while(1) {
+		i32 chunk = wAtomicAdd(&job->next, 1);
+		if(chunk >= job->count) break;
+		if(wSarInflateChunk(job->archive, job->file, chunk, 
+					job->output + (isize)chunk * wSar_ChunkSize) < 0) {
+			wAtomicStore(&job->failed, 1);
+		}
+	}
+	return 0;
+}
+
+/* wSarGetFileData, with the chunks of a chunked file shared between
+ * threadCount threads (0 for one per core), this one included. Anything
+ * else is read on this thread.
+ */
+void* wSarGetFileDataParallel(wSarArchive* archive, string name, 
+		isize* sizeOut, i32 threadCount, wMemoryArena* arena)
+{
+	wSarFile* file = wSarGetFile(archive, name);
+	if(!file) return NULL;
+	isize count = wSarGetChunkCount(file);
+	if(threadCount <= 0) {
+		threadCount = wGetProcessorCount();
+	}
+	if(threadCount > count) {
+		threadCount = (i32)count;
+	}
+	if(threadCount > wSar_MaxThreads) {
+		threadCount = wSar_MaxThreads;
+	}
+	if(wSarKindLayout(file->kind) != wSar_KindChunked || threadCount <= 1) {
+		return wSarGetFileData(archive, name, sizeOut, arena);
+	}
+	if(!sarFileInput(archive, file)) return NULL;
+
+	SarInflateJob job = {0};
+	job.archive = archive;
+	job.file = file;
+	job.output = wArenaPush(arena, file->fullSize + 8);
+	job.count = (i32)count;
+	void* threads[wSar_MaxThreads];
+	for(i32 i = 0; i < threadCount - 1; ++i) {
+		threads[i] = wCreateThread(sarInflateWorker, &job);
+	}
+	sarInflateWorker(&job);
+	for(i32 i = 0; i < threadCount - 1; ++i) {
+		if(threads[i]) {
+			wWaitThread(threads[i]);
+		}
+	}
+	if(job.failed) return NULL;
+	if(sizeOut) {
+		*sizeOut = file->fullSize;
+	}
+	return job.output;
+}
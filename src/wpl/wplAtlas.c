@@ -0,0 +1,226 @@
+/* wplAtlas.c
+ *
+ * Texture atlases: lots of images packed into one texture (skyline
+ * packing, via stb_rect_pack), with a region table sorted by name hash.
+ * Everything drawn from an atlas shares one texture bind.
+ *
+ * Build one with wInitAtlas/wAtlasAddImages, either at runtime or offline
+ * with the sar tool, and wSerializeAtlas it into a blob to store in a
+ * .sar. wLoadAtlas points straight into a blob without copying.
+ */
+
+/* stb_rect_pack wants qsort, which we don't have without the CRT.
+ * Heapsort, since it doesn't need scratch memory. */
+static
+void atlasSiftDown(u8* base, isize root, isize count, usize size,
+		i32 (*compare)(const void*, const void*))
+{
+	while(root * 2 + 1 < count) {
+		isize child = root * 2 + 1;
+		if(child + 1 < count &&
+				compare(base + child * size, base + (child + 1) * size) < 0) {
+			child++;
+		}
+		if(compare(base + root * size, base + child * size) >= 0) {
+			return;
+		}
+
+		u8* a = base + root * size;
+		u8* b = base + child * size;
+		for(usize i = 0; i < size; ++i) {
+			u8 t = a[i];
+			a[i] = b[i];
+			b[i] = t;
+		}
+		root = child;
+	}
+}
+
+static
+void atlasSort(void* array, usize count, usize size,
+		i32 (*compare)(const void*, const void*))
+{
+	u8* base = array;
+	isize n = count;
+	for(isize i = n / 2 - 1; i >= 0; --i) {
+		atlasSiftDown(base, i, n, size, compare);
+	}
+	for(isize end = n - 1; end > 0; --end) {
+		u8* last = base + end * size;
+		for(usize i = 0; i < size; ++i) {
+			u8 t = base[i];
+			base[i] = last[i];
+			last[i] = t;
+		}
+		atlasSiftDown(base, 0, end, size, compare);
+	}
+}
+
+#define STB_RECT_PACK_IMPLEMENTATION
+#define STBRP_STATIC
+#define STBRP_SORT atlasSort
+#define STBRP_ASSERT(x)
+#include "thirdparty/stb_rect_pack.h"
+
+static
+i32 compareRegions(const void* a, const void* b)
+{
+	u64 x = ((const wAtlasRegion*)a)->hash;
+	u64 y = ((const wAtlasRegion*)b)->hash;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void wInitAtlas(wAtlas* atlas, i32 w, i32 h, i32 border,
+		isize capacity, wMemoryArena* arena)
+{
+	memset(atlas, 0, sizeof(wAtlas));
+	atlas->texture.w = w;
+	atlas->texture.h = h;
+	atlas->texture.pixels = wArenaPush(arena, w * h * 4);
+	atlas->texture.glIndex = -1;
+	memset(atlas->texture.pixels, 0, w * h * 4);
+
+	atlas->regions = wArenaPush(arena, sizeof(wAtlasRegion) * capacity);
+	atlas->regionCapacity = capacity;
+	atlas->border = border ? 1 : 0;
+
+	stbrp_context* packer = wArenaPush(arena, sizeof(stbrp_context));
+	stbrp_node* nodes = wArenaPush(arena, sizeof(stbrp_node) * w);
+	stbrp_init_target(packer, w, h, nodes, w);
+	atlas->packer = packer;
+}
+
+/* Packs and copies in a set of RGBA images. Packing more at once packs
+ * better, since they're sorted by height first. With a border, each image
+ * gets its edge pixels repeated around it so filtering doesn't bleed in
+ * from its neighbours. Returns the number of images added; anything that
+ * didn't fit is logged and skipped.
+ */
+isize wAtlasAddImages(wAtlas* atlas, wAtlasImage* images, isize count,
+		wMemoryArena* tempArena)
+{
+	if(!atlas->packer) {
+		wLogError(0, "Error: can't add images to a loaded atlas\n");
+		return 0;
+	}
+
+	i32 border = atlas->border;
+	stbrp_rect* rects = wArenaPush(tempArena, sizeof(stbrp_rect) * count);
+	for(isize i = 0; i < count; ++i) {
+		rects[i].id = (i32)i;
+		rects[i].w = images[i].w + border * 2;
+		rects[i].h = images[i].h + border * 2;
+	}
+	stbrp_pack_rects(atlas->packer, rects, (i32)count);
+
+	isize added = 0;
+	for(isize i = 0; i < count; ++i) {
+		wAtlasImage* image = images + rects[i].id;
+		if(!rects[i].was_packed) {
+			wLogError(0, "Error: no room in atlas for %s\n", image->name);
+			continue;
+		}
+		if(atlas->regionCount >= atlas->regionCapacity) {
+			wLogError(0, "Error: atlas region table is full\n");
+			break;
+		}
+
+		wAtlasRegion* region = atlas->regions + atlas->regionCount++;
+		region->hash = wHashString(image->name);
+		region->x = rects[i].x + border;
+		region->y = rects[i].y + border;
+		region->w = image->w;
+		region->h = image->h;
+		wCopyMemoryBlock(atlas->texture.pixels, image->pixels,
+				0, 0, image->w, image->h,
+				region->x, region->y,
+				(i32)atlas->texture.w, (i32)atlas->texture.h,
+				4, border);
+		added++;
+	}
+
+	atlasSort(atlas->regions, atlas->regionCount,
+			sizeof(wAtlasRegion), compareRegions);
+	return added;
+}
+
+wAtlasRegion* wAtlasGetRegion(wAtlas* atlas, string name)
+{
+	u64 key = wHashString(name);
+	isize min = 0, max = atlas->regionCount - 1, mid = 0;
+	while(min <= max) {
+		mid = (min + max) / 2;
+		u64 localKey = atlas->regions[mid].hash;
+		if(localKey == key) {
+			return atlas->regions + mid;
+		} else if(localKey < key) {
+			min = mid + 1;
+		} else {
+			max = mid - 1;
+		}
+	}
+	return NULL;
+}
+
+isize wAtlasSerializedSize(wAtlas* atlas)
+{
+	return sizeof(wAtlasHeader) +
+		sizeof(wAtlasRegion) * atlas->regionCount +
+		atlas->texture.w * atlas->texture.h * 4;
+}
+
+/* out needs wAtlasSerializedSize bytes. Returns the number written. */
+isize wSerializeAtlas(wAtlas* atlas, void* out)
+{
+	wAtlasHeader* header = out;
+	header->magic = wAtlas_Magic;
+	header->version = wAtlas_Version;
+	header->w = (i32)atlas->texture.w;
+	header->h = (i32)atlas->texture.h;
+	header->regionCount = atlas->regionCount;
+	header->regionLocation = sizeof(wAtlasHeader);
+	header->pixelLocation = header->regionLocation +
+		sizeof(wAtlasRegion) * atlas->regionCount;
+
+	u8* base = out;
+	memcpy(base + header->regionLocation, atlas->regions,
+			sizeof(wAtlasRegion) * atlas->regionCount);
+	memcpy(base + header->pixelLocation, atlas->texture.pixels,
+			atlas->texture.w * atlas->texture.h * 4);
+	return wAtlasSerializedSize(atlas);
+}
+
+/* The atlas keeps pointers into data, so it has to outlive it. */
+i32 wLoadAtlas(wAtlas* atlas, void* data, isize size)
+{
+	wAtlasHeader* header = data;
+	memset(atlas, 0, sizeof(wAtlas));
+	if(size < (isize)sizeof(wAtlasHeader) || header->magic != wAtlas_Magic) {
+		wLogError(0, "Error: not an atlas\n");
+		return 0;
+	}
+	if(header->version > wAtlas_Version) {
+		wLogError(0, "Error: atlas version %u is newer than %u\n",
+				header->version, wAtlas_Version);
+		return 0;
+	}
+
+	u64 regionEnd = header->regionLocation +
+		sizeof(wAtlasRegion) * header->regionCount;
+	u64 pixelEnd = header->pixelLocation +
+		(u64)header->w * (u64)header->h * 4;
+	if(regionEnd > (u64)size || pixelEnd > (u64)size) {
+		wLogError(0, "Error: atlas is truncated\n");
+		return 0;
+	}
+
+	u8* base = data;
+	atlas->texture.w = header->w;
+	atlas->texture.h = header->h;
+	atlas->texture.pixels = base + header->pixelLocation;
+	atlas->texture.glIndex = -1;
+	atlas->regions = (wAtlasRegion*)(base + header->regionLocation);
+	atlas->regionCount = header->regionCount;
+	atlas->regionCapacity = header->regionCount;
+	return 1;
+}
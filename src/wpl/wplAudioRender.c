@@ -0,0 +1,242 @@
+/* wplAudioRender.c
+ *
+ * Runs a mixer with no audio device, from a timeline of events, so mixer
+ * changes can be timed and checked on machines without sound.
+ *
+ *   wRenderEvent events[] = {
+ *       {0, wRender_Play, 0, &kick, NULL, 1.0f, 1.0f, 0.0f},
+ *       {22050, wRender_Stop, 0},
+ *   };
+ *   wInitAudioRender(&render, mixer, events, 2, 44100, 512, arena);
+ *   wRunAudioRender(&render);
+ *   if(render.checksum != golden) ...
+ *
+ * Events take effect on their exact frame: blocks get split around them,
+ * so where they land doesn't depend on blockFrames. With the same events,
+ * samples and build, every render comes out the same, as long as any
+ * streams are refilled on the audio thread (see wplVorbis.c).
+ */
+
+void wInitAudioRender(wAudioRender* render, wMixer* mixer,
+		wRenderEvent* events, isize eventCount,
+		i64 frames, u32 blockFrames, wMemoryArena* arena)
+{
+	memset(render, 0, sizeof(wAudioRender));
+	if(blockFrames == 0) {
+		blockFrames = Mixer_BlockSize;
+	}
+	render->mixer = mixer;
+	render->events = events;
+	render->eventCount = eventCount;
+	render->frames = frames;
+	render->blockFrames = blockFrames;
+	for(i32 i = 0; i < Render_MaxVoices; ++i) {
+		render->voices[i] = -1;
+	}
+	render->output = wArenaPush(arena, sizeof(f32) * 2 * frames);
+	isize blocks = (isize)((frames + blockFrames - 1) / blockFrames);
+	render->blockTimes = wArenaPush(arena, sizeof(f64) * blocks);
+}
+
+static
+i32 renderVoice(wAudioRender* render, wRenderEvent* event)
+{
+	if(event->voice < 0 || event->voice >= Render_MaxVoices) {
+		return -1;
+	}
+	return render->voices[event->voice];
+}
+
+static
+void applyRenderEvent(wAudioRender* render, wRenderEvent* event)
+{
+	wMixer* mixer = render->mixer;
+	i32 handle = -1;
+	switch(event->type) {
+		case wRender_Play:
+			handle = wMixerPlaySampleEx(mixer, event->sample,
+					event->gain, event->pitch, event->pan, event->priority);
+			break;
+		case wRender_PlayStream:
+			handle = wMixerPlayStream(mixer, event->stream, event->gain);
+			break;
+		case wRender_Stop:
+			wMixerStopVoice(mixer, renderVoice(render, event));
+			break;
+		case wRender_SetGain:
+			wMixerSetVoiceGain(mixer, renderVoice(render, event), event->gain);
+			break;
+		case wRender_SetPitch:
+			wMixerSetVoicePitch(mixer, renderVoice(render, event), event->pitch);
+			break;
+		case wRender_SetPan:
+			wMixerSetVoicePan(mixer, renderVoice(render, event), event->pan);
+			break;
+		case wRender_SetBus:
+			wMixerSetVoiceBus(mixer, renderVoice(render, event), event->bus);
+			break;
+		case wRender_SetBusGain:
+			wMixerSetBusGain(mixer, event->bus, event->gain);
+			break;
+	}
+	if(event->type == wRender_Play || event->type == wRender_PlayStream) {
+		if(event->voice >= 0 && event->voice < Render_MaxVoices) {
+			render->voices[event->voice] = handle;
+		}
+	}
+}
+
+static
+i32 compareBlockTimes(const void* a, const void* b)
+{
+	f64 x = *(const f64*)a;
+	f64 y = *(const f64*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Nearest rank, on sorted times
+static
+f64 renderPercentile(f64* sorted, isize count, i32 percent)
+{
+	if(count <= 0) return 0;
+	isize rank = (count * percent + 99) / 100;
+	if(rank < 1) rank = 1;
+	return sorted[rank - 1];
+}
+
+/* Events have to be in frame order; one that's behind goes in as soon as
+ * it's seen. Block times include running that block's events.
+ */
+void wRunAudioRender(wAudioRender* render)
+{
+	f32* out = render->output;
+	isize next = 0;
+	i64 frame = 0;
+	render->blockCount = 0;
+	f64 start = wGetTime();
+	while(frame < render->frames) {
+		i64 end = frame + render->blockFrames;
+		if(end > render->frames) {
+			end = render->frames;
+		}
+
+		f64 blockStart = wGetTime();
+		while(frame < end) {
+			while(next < render->eventCount &&
+					render->events[next].frame <= frame) {
+				applyRenderEvent(render, render->events + next++);
+			}
+			i64 until = end;
+			if(next < render->eventCount && render->events[next].frame < until) {
+				until = render->events[next].frame;
+			}
+			wMixerMixAudio(render->mixer, out + frame * 2, (u32)(until - frame));
+			frame = until;
+		}
+		render->blockTimes[render->blockCount++] = wGetTime() - blockStart;
+	}
+	render->totalTime = wGetTime() - start;
+
+	// Sorted in place; blockTimes is only there for the stats
+	atlasSort(render->blockTimes, render->blockCount, sizeof(f64),
+			compareBlockTimes);
+	render->median = renderPercentile(render->blockTimes, render->blockCount, 50);
+	render->p90 = renderPercentile(render->blockTimes, render->blockCount, 90);
+	render->p99 = renderPercentile(render->blockTimes, render->blockCount, 99);
+	render->worst = renderPercentile(render->blockTimes, render->blockCount, 100);
+	render->checksum = wAudioChecksum(out, render->frames * 2);
+}
+
+/* FNV-1a of the samples rounded to 16 bits, which is what a 16-bit device
+ * would play. Changes well under a 16-bit step almost never show up; for
+ * an exact bound, compare against a golden WAV with wCompareAudioRender.
+ */
+u64 wAudioChecksum(f32* samples, isize count)
+{
+	u64 hash = 14695981039346656037ULL;
+	for(isize i = 0; i < count; ++i) {
+		f32 x = samples[i] * 32767.0f;
+		x += x < 0.0f ? -0.5f : 0.5f;
+		if(x > 32767.0f) x = 32767.0f;
+		if(x < -32768.0f) x = -32768.0f;
+		u16 s = (u16)(i16)x;
+		hash = (hash ^ (s & 0xFF)) * 1099511628211ULL;
+		hash = (hash ^ (s >> 8)) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/* The largest difference between the render and a stereo WAV of the same
+ * length, in any format dr_wav reads. Returns -1 if they don't line up.
+ */
+f32 wCompareAudioRender(wAudioRender* render, void* wav, isize size)
+{
+	drwav golden;
+	if(!drwav_init_memory(&golden, wav, size)) {
+		wLogError(0, "Error: golden render isn't a WAV file dr_wav can read\n");
+		return -1.0f;
+	}
+	if(golden.channels != 2 ||
+			golden.totalSampleCount != (u64)render->frames * 2) {
+		wLogError(0, "Error: golden render is %d channels, %d frames; "
+				"expected 2 channels, %d frames\n",
+				(i32)golden.channels, (i32)(golden.totalSampleCount / 2),
+				(i32)render->frames);
+		drwav_uninit(&golden);
+		return -1.0f;
+	}
+
+	f32 worst = 0.0f;
+	f32 chunk[1024];
+	isize at = 0;
+	while(at < render->frames * 2) {
+		isize read = (isize)drwav_read_f32(&golden, 1024, chunk);
+		if(read <= 0) {
+			worst = -1.0f;
+			break;
+		}
+		for(isize i = 0; i < read; ++i) {
+			f32 d = chunk[i] - render->output[at + i];
+			if(d < 0.0f) d = -d;
+			if(d > worst) worst = d;
+		}
+		at += read;
+	}
+	drwav_uninit(&golden);
+	return worst;
+}
+
+static
+void putWavU32(u8* p, u32 x)
+{
+	p[0] = (u8)x;
+	p[1] = (u8)(x >> 8);
+	p[2] = (u8)(x >> 16);
+	p[3] = (u8)(x >> 24);
+}
+
+/* dr_wav here only reads, so this writes its own header. out needs
+ * Wav_HeaderSize + frames * channels * 4 bytes; returns the size.
+ */
+isize wEncodeWav(void* out, f32* samples, isize frames,
+		i32 channels, u32 frequency)
+{
+	u8* p = out;
+	u32 dataSize = (u32)(frames * channels * sizeof(f32));
+	memcpy(p, "RIFF", 4);
+	putWavU32(p + 4, 36 + dataSize);
+	memcpy(p + 8, "WAVEfmt ", 8);
+	putWavU32(p + 16, 16);
+	// IEEE float, then channels
+	putWavU32(p + 20, 3 | ((u32)channels << 16));
+	putWavU32(p + 24, frequency);
+	putWavU32(p + 28, frequency * channels * sizeof(f32));
+	// block align, then bits per sample
+	putWavU32(p + 32, (u32)(channels * sizeof(f32)) | (32 << 16));
+	memcpy(p + 36, "data", 4);
+	putWavU32(p + 40, dataSize);
+
+	// Little endian already on everything this builds for
+	memcpy(p + Wav_HeaderSize, samples, dataSize);
+	return Wav_HeaderSize + dataSize;
+}
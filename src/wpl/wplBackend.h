@@ -11,6 +11,9 @@ u8* wLoadLocalFile(wWindow* window, string filename, isize* sizeOut, wMemoryAren
 isize wLoadLocalSizedFile(
 		wWindow* window, string filename,
 		u8* buffer, isize bufferSize);
+i32 wWriteFile(string filename, void* data, isize size);
+void* wMapFile(string filename, isize* sizeOut);
+void wUnmapFile(void* data, isize size);
 
 typedef void* wFileHandle;
 wFileHandle wGetFileHandle(string filename);
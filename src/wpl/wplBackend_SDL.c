@@ -6,6 +6,8 @@
 #ifdef WPL_LINUX
 #include <sys/mman.h>
 #include <sys/sysinfo.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 #endif
@@ -308,6 +310,58 @@ isize wLoadLocalSizedFile(
 	return wLoadSizedFile(buf, buffer, bufferSize);
 }
 
+// Replaces whatever's there. Returns 0 if it couldn't all be written.
+i32 wWriteFile(string filename, void* data, isize size)
+{
+	FILE* fp = fopen(filename, "wb");
+	if(!fp) {
+		wLogError(0, "wWriteFile: could not open %s\n", filename);
+		return 0;
+	}
+	isize written = fwrite(data, 1, size, fp);
+	fclose(fp);
+	return written == size;
+}
+
+/* Maps a whole file read-only, so pages only get read in as they're
+ * touched. Only Linux so far; elsewhere this returns NULL, and callers
+ * should fall back to wLoadFile.
+ */
+void* wMapFile(string filename, isize* sizeOut)
+{
+#ifdef WPL_LINUX
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		wLogError(0, "wMapFile: could not open %s\n", filename);
+		return NULL;
+	}
+	struct stat info;
+	void* data = NULL;
+	if(fstat(fd, &info) == 0 && info.st_size > 0) {
+		data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED) {
+			wLogError(0, "wMapFile: could not map %s\n", filename);
+			data = NULL;
+		}
+	}
+	// The mapping keeps the file around
+	close(fd);
+	if(data && sizeOut) {
+		*sizeOut = info.st_size;
+	}
+	return data;
+#else
+	return NULL;
+#endif
+}
+
+void wUnmapFile(void* data, isize size)
+{
+#ifdef WPL_LINUX
+	if(data) munmap(data, size);
+#endif
+}
+
 wFileHandle wGetFileHandle(string filename)
 {
 	wLogError(0, "wGetFileHandle not implemented for this backend (SDL)");
@@ -326,3 +380,133 @@ isize wGetFileModifiedTime(wFileHandle file)
 	return -1;
 }
 
+void* wCreateThread(wThreadProc proc, void* data)
+{
+	return SDL_CreateThread(proc, "wplThread", data);
+}
+
+void wWaitThread(void* thread)
+{
+	SDL_WaitThread(thread, NULL);
+}
+
+void* wCreateSemaphore(i32 initialCount)
+{
+	return SDL_CreateSemaphore(initialCount);
+}
+
+void wDestroySemaphore(void* semaphore)
+{
+	SDL_DestroySemaphore(semaphore);
+}
+
+void wSemaphoreWait(void* semaphore)
+{
+	SDL_SemWait(semaphore);
+}
+
+void wSemaphorePost(void* semaphore)
+{
+	SDL_SemPost(semaphore);
+}
+
+i32 wGetProcessorCount()
+{
+	return SDL_GetCPUCount();
+}
+
+i32 wAtomicAdd(volatile i32* value, i32 amount)
+{
+	return SDL_AtomicAdd((SDL_atomic_t*)value, amount);
+}
+
+i32 wAtomicLoad(volatile i32* value)
+{
+	return SDL_AtomicGet((SDL_atomic_t*)value);
+}
+
+void wAtomicStore(volatile i32* value, i32 x)
+{
+	SDL_AtomicSet((SDL_atomic_t*)value, x);
+}
+
+f64 wGetTime()
+{
+	return (f64)SDL_GetPerformanceCounter() / 
+		(f64)SDL_GetPerformanceFrequency();
+}
+
+static
+void wAudioCallback(void* userdata, u8* stream, i32 len)
+{
+	wAudioState* audio = userdata;
+	f64 start = wGetTime();
+	u32 frames = len / (sizeof(f32) * 2);
+	wMixerMixAudio(&audio->mixer, stream, frames);
+	f64 end = wGetTime();
+
+	f64 period = (f64)frames / (f64)audio->frequency;
+	i32 late = audio->lastCallbackStart > 0.0 &&
+		start - audio->lastCallbackStart > period * 2.0;
+	if(end - start > period || late) {
+		wAtomicAdd(&audio->underruns, 1);
+	}
+	audio->lastCallbackStart = start;
+
+	i32 micros = (i32)((end - start) * 1000000.0);
+	wAtomicStore(&audio->lastCallbackMicros, micros);
+	if(micros > wAtomicLoad(&audio->worstCallbackMicros)) {
+		wAtomicStore(&audio->worstCallbackMicros, micros);
+	}
+	wAtomicAdd(&audio->callbacks, 1);
+}
+
+i32 wInitAudio(wAudioState* audio, i32 frequency, i32 bufferFrames,
+		isize voiceCount, wMemoryArena* arena)
+{
+	memset(audio, 0, sizeof(wAudioState));
+	if(!SDL_WasInit(SDL_INIT_AUDIO) && SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+		wLogError(0, "Error: unable to init audio: %s\n", SDL_GetError());
+		return 0;
+	}
+
+	SDL_AudioSpec want, have;
+	memset(&want, 0, sizeof(SDL_AudioSpec));
+	want.freq = frequency;
+	want.format = AUDIO_F32SYS;
+	want.channels = 2;
+	want.samples = bufferFrames;
+	want.callback = wAudioCallback;
+	want.userdata = audio;
+	audio->device = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+			SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+	if(!audio->device) {
+		wLogError(0, "Error: unable to open audio device: %s\n", SDL_GetError());
+		return 0;
+	}
+
+	audio->frequency = have.freq;
+	audio->bufferFrames = have.samples;
+	wMixerInit(&audio->mixer, voiceCount, arena);
+	audio->mixer.frequency = have.freq;
+	wLogError(0, "Audio: %s, %d Hz, %d frame buffer\n",
+			SDL_GetCurrentAudioDriver(), have.freq, have.samples);
+
+	SDL_PauseAudioDevice(audio->device, 0);
+	return 1;
+}
+
+void wPauseAudio(wAudioState* audio, i32 paused)
+{
+	if(audio->device) {
+		SDL_PauseAudioDevice(audio->device, paused);
+	}
+}
+
+void wQuitAudio(wAudioState* audio)
+{
+	if(audio->device) {
+		SDL_CloseAudioDevice(audio->device);
+		audio->device = 0;
+	}
+}
@@ -304,6 +304,68 @@ isize wLoadLocalSizedFile(
 	return wLoadSizedFile(buf, buffer, bufferSize);
 }
 
+// Replaces whatever's there. Returns 0 if it couldn't all be written.
+i32 wWriteFile(string filename, void* data, isize size)
+{
+	HANDLE file = CreateFile(filename, 
+			GENERIC_WRITE, 0, NULL,
+			CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) {
+		wLogError(0, "wWriteFile: could not open %s\n", filename);
+		return 0;
+	}
+	u8* bytes = data;
+	while(size > 0) {
+		DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		DWORD written = 0;
+		if(!WriteFile(file, bytes, chunk, &written, NULL) || written == 0) {
+			break;
+		}
+		bytes += written;
+		size -= written;
+	}
+	CloseHandle(file);
+	return size == 0;
+}
+
+// Maps a whole file read-only; pages are read in as they're touched
+void* wMapFile(string filename, isize* sizeOut)
+{
+	HANDLE file = CreateFile(filename, 
+			GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) {
+		wLogError(0, "wMapFile: could not open %s\n", filename);
+		return NULL;
+	}
+	LARGE_INTEGER largeSize;
+	if(!GetFileSizeEx(file, &largeSize) || largeSize.QuadPart == 0) {
+		CloseHandle(file);
+		return NULL;
+	}
+	void* data = NULL;
+	HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(mapping) {
+		data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		// The view keeps both of these alive
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	if(!data) {
+		wLogError(0, "wMapFile: could not map %s\n", filename);
+		return NULL;
+	}
+	if(sizeOut) {
+		*sizeOut = (isize)largeSize.QuadPart;
+	}
+	return data;
+}
+
+void wUnmapFile(void* data, isize size)
+{
+	if(data) UnmapViewOfFile(data);
+}
+
 wFileHandle wGetFileHandle(string filename)
 {
 	u32 access = GENERIC_READ;
@@ -347,4 +409,86 @@ isize wGetFileModifiedTime(wFileHandle file)
 	return i.QuadPart;
 }
 
+typedef struct
+{
+	wThreadProc proc;
+	void* data;
+} wThreadStart;
+
+// wThreadProcs are cdecl, CreateThread wants stdcall
+static
+DWORD WINAPI wThreadTrampoline(LPVOID parameter)
+{
+	wThreadStart start = *(wThreadStart*)parameter;
+	HeapFree(GetProcessHeap(), 0, parameter);
+	return (DWORD)start.proc(start.data);
+}
+
+void* wCreateThread(wThreadProc proc, void* data)
+{
+	wThreadStart* start = HeapAlloc(GetProcessHeap(), 0, sizeof(wThreadStart));
+	if(!start) return NULL;
+	start->proc = proc;
+	start->data = data;
+	HANDLE thread = CreateThread(0, 0, wThreadTrampoline, start, 0, 0);
+	if(!thread) {
+		HeapFree(GetProcessHeap(), 0, start);
+	}
+	return thread;
+}
+
+void wWaitThread(void* thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+void* wCreateSemaphore(i32 initialCount)
+{
+	return CreateSemaphoreA(NULL, initialCount, 0x7FFFFFFF, NULL);
+}
+
+void wDestroySemaphore(void* semaphore)
+{
+	CloseHandle(semaphore);
+}
+
+void wSemaphoreWait(void* semaphore)
+{
+	WaitForSingleObject(semaphore, INFINITE);
+}
+
+void wSemaphorePost(void* semaphore)
+{
+	ReleaseSemaphore(semaphore, 1, NULL);
+}
+
+i32 wGetProcessorCount()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+}
+
+i32 wAtomicAdd(volatile i32* value, i32 amount)
+{
+	return InterlockedExchangeAdd((volatile LONG*)value, amount);
+}
+
+i32 wAtomicLoad(volatile i32* value)
+{
+	return InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+}
 
+void wAtomicStore(volatile i32* value, i32 x)
+{
+	InterlockedExchange((volatile LONG*)value, x);
+}
+
+f64 wGetTime()
+{
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (f64)counter.QuadPart / (f64)frequency.QuadPart;
+}
@@ -8,8 +8,15 @@
 // Changelog:
 // 	- Reformatted code
 // 	- Floating point only; removed other input/output modes
-// To do:
-//  - SIMD-ize
+// 	- Mixes in blocks: each voice renders Mixer_BlockSize frames at a time,
+// 	  which get summed with SSE, and the sum is clamped once at the end
+// 	- 32.32 fixed point positions, and per-voice interpolation: nearest,
+// 	  linear, cubic (Catmull-Rom), or an 8 tap windowed sinc
+// 	- Samples can be int16, converted a window at a time as they're mixed
+// 	- Voices go to buses, each with a gain and a chain of effects, and the
+// 	  final mix is soft limited instead of clamped
+// 	- Positional voices, panned and faded by where the listener is, and
+// 	  voices too quiet to hear are skipped instead of mixed
 
 
 enum {
@@ -18,6 +25,48 @@ enum {
 	wMixer_VoiceStreaming
 };
 
+#define Mixer_FixedOne ((u64)1 << 32)
+#define Mixer_SincTaps (8)
+#define Mixer_SincPhaseBits (9)
+#define Mixer_SincPhases (1 << Mixer_SincPhaseBits)
+
+/* Blackman windowed sinc, one row of taps per fractional position. Taps
+ * cover frames -3..4 around the one we're on. Rows are normalized so
+ * they don't change the level, and phase 0 is exactly the sample, so an
+ * unpitched voice comes out the same in every mode.
+ */
+static f32 mixerSincTable[Mixer_SincPhases][Mixer_SincTaps];
+static i32 mixerSincReady;
+
+static
+void stmBuildSincTable()
+{
+	if(mixerSincReady) return;
+	for(i32 phase = 0; phase < Mixer_SincPhases; ++phase) {
+		f32* row = mixerSincTable[phase];
+		f32 frac = (f32)phase / (f32)Mixer_SincPhases;
+		f32 sum = 0.0f;
+		for(i32 k = 0; k < Mixer_SincTaps; ++k) {
+			f32 x = (f32)(k - (Mixer_SincTaps / 2 - 1)) - frac;
+			f32 sinc = 1.0f;
+			if(x != 0.0f) {
+				f32 px = Math_Tau * 0.5f * x;
+				sinc = wb_sinf(px) / px;
+			}
+			f32 n = (x + Mixer_SincTaps / 2) / Mixer_SincTaps;
+			f32 window = 0.42f - 0.5f * wb_cosf(Math_Tau * n) + 
+				0.08f * wb_cosf(2.0f * Math_Tau * n);
+			row[k] = sinc * window;
+			sum += row[k];
+		}
+		for(i32 k = 0; k < Mixer_SincTaps; ++k) {
+			row[k] = phase == 0 ? 0.0f : row[k] / sum;
+		}
+	}
+	mixerSincTable[0][Mixer_SincTaps / 2 - 1] = 1.0f;
+	mixerSincReady = 1;
+}
+
 
 static 
 float stmClamp(const float value, const float min, const float max)
@@ -27,22 +76,52 @@ float stmClamp(const float value, const float min, const float max)
 	else return value;
 }
 
-static 
-float stmClamp1(const float sample) 
+
+/* Gain for a positional voice at distance from the listener; see the
+ * wMixer_Rolloff modes.
+ */
+static
+f32 stmAttenuation(i32 rolloff, f32 minDistance, f32 maxDistance, f32 distance)
 {
-	if (sample < -1.0f) return -1.0f;
-	else if (sample > 1.0f) return 1.0f;
-	else return sample;
+	if(rolloff == wMixer_RolloffNone || distance <= minDistance) return 1.0f;
+	if(distance >= maxDistance) return 0.0f;
+	f32 t = (distance - minDistance) / (maxDistance - minDistance);
+	switch(rolloff) {
+		case wMixer_RolloffLinear:
+			return 1.0f - t;
+		case wMixer_RolloffInverse: {
+			f32 edge = minDistance / maxDistance;
+			return (minDistance / distance - edge) / (1.0f - edge);
+		}
+		case wMixer_RolloffQuadratic:
+			return (1.0f - t) * (1.0f - t);
+	}
+	return 1.0f;
 }
 
-
-static 
-float stmGetSample(wMixerSample* sample, size_t position)
+// Silence either side of the sample, for the interpolators' outer taps
+static
+f32 stmSampleAt(wMixerSample* sample, i64 position)
 {
-	return ((float*)sample->data)[position];
+	if(position < 0 || position >= (i64)sample->length) return 0.0f;
+	return ((f32*)sample->data)[position];
 }
 
 
+/* Freeverb's tunings, in frames at 44.1k; the right side's lines are
+ * 23 frames longer so the two sides don't correlate.
+ */
+static const i32 mixerReverbCombs[Mixer_ReverbCombs] = {1116, 1188, 1277, 1356};
+static const i32 mixerReverbAllpasses[Mixer_ReverbAllpasses] = {556, 441};
+
+static
+i32 stmReverbLength(i32 frames, u32 frequency)
+{
+	if(frequency > Mixer_ReverbMaxRate) frequency = Mixer_ReverbMaxRate;
+	i32 length = (i32)((i64)frames * frequency / 44100);
+	return length > 0 ? length : 1;
+}
+
 static
 void stmResetVoice(wMixer* mixer, const int i) 
 {
@@ -50,43 +129,470 @@ void stmResetVoice(wMixer* mixer, const int i)
 	voice->state = wMixer_VoiceStopped;
 	voice->sample = 0;
 	voice->stream = 0;
-	voice->position = voice->gain = voice->pitch = voice->pan = 0.0f;
+	voice->position = 0;
+	voice->gain = voice->pitch = voice->pan = 0.0f;
+	voice->rolloff = wMixer_RolloffNone;
 }
 
-
-static 
-int stmFindFreeVoice(wMixer* mixer) 
+static
+i32 stmRoundUpPow2(isize x)
 {
-	for(isize i = 0; i < mixer->voiceCount; ++i) {
-		if(mixer->voices[i].state == wMixer_VoiceStopped) {
-			return i;
-		}
-	}
-	return -1;
+	i32 n = 1;
+	while(n < x) n <<= 1;
+	return n;
 }
 
-
-void wMixerInit(wMixer* mixer, isize voiceCount, wMixerVoice* voices)
+void wMixerInit(wMixer* mixer, isize voiceCount, wMemoryArena* arena)
 {
+	memset(mixer, 0, sizeof(wMixer));
 	mixer->frequency = 44100;
 	mixer->gain = 1.0f;
+	mixer->interpolation = wMixer_InterpLinear;
+	// In whatever units the game uses; these suit pixels
+	mixer->rolloff = wMixer_RolloffInverse;
+	mixer->minDistance = 64.0f;
+	mixer->maxDistance = 1024.0f;
+	mixer->virtualGain = Mixer_VirtualGain;
+	stmBuildSincTable();
 
+	if(voiceCount > Mixer_MaxVoices) {
+		wLogError(0, "Error: mixer can't have more than %d voices\n", 
+				Mixer_MaxVoices);
+		voiceCount = Mixer_MaxVoices;
+	}
 	mixer->voiceCount = voiceCount;
-	mixer->voices = voices;
-	for (isize i = 0; i < voiceCount; ++i) {
+	mixer->voices = wArenaPush(arena, sizeof(wMixerVoice) * voiceCount);
+	mixer->slots = wArenaPush(arena, sizeof(wMixerSlot) * voiceCount);
+	mixer->heap = wArenaPush(arena, sizeof(i32) * voiceCount);
+	for(isize i = 0; i < voiceCount; ++i) {
 		stmResetVoice(mixer, i);
+		mixer->voices[i].generation = 0;
+		mixer->voices[i].prevPlaying = mixer->voices[i].nextPlaying = -1;
+
+		wMixerSlot* slot = mixer->slots + i;
+		memset(slot, 0, sizeof(wMixerSlot));
+		slot->next = i + 1 < voiceCount ? (i32)i + 1 : -1;
+		slot->heapIndex = -1;
 	}
+	mixer->freeSlot = voiceCount > 0 ? 0 : -1;
+	mixer->firstPlaying = mixer->lastPlaying = -1;
+	mixer->stealPolicy = wMixer_StealQuietest;
+
+	mixer->commandCapacity = Mixer_CommandCapacity;
+	mixer->commands = wArenaPush(arena, 
+			sizeof(wMixerCommand) * mixer->commandCapacity);
+	// A voice only finishes once per play; the game thread only reuses
+	// one after hearing about it, or after queueing a stop when stealing.
+	// So this can't fill up.
+	mixer->finishedCapacity = stmRoundUpPow2(
+			voiceCount + mixer->commandCapacity);
+	mixer->finished = wArenaPush(arena, sizeof(i32) * mixer->finishedCapacity);
+
+	mixer->buses = wArenaPush(arena, sizeof(wMixerBus) * Mixer_MaxBuses);
+	mixer->busCount = 0;
+	wMixerAddBus(mixer, "master", -1);
 }
 
-int wMixerGetActiveVoices(wMixer* mixer) 
+/* Audio thread side */
+
+static
+wMixerVoice* stmGetVoice(wMixer* mixer, i32 handle)
 {
-	isize i, active;
-	for (i = 0, active = 0; i < mixer->voiceCount; ++i) {
-		if (mixer->voices[i].state != wMixer_VoiceStopped) {
-			++active;
+	i32 index = handle & 0xFFFF;
+	if(handle < 0 || index >= mixer->voiceCount) return NULL;
+	wMixerVoice* voice = mixer->voices + index;
+	if(voice->state == wMixer_VoiceStopped || 
+			voice->generation != (u32)(handle >> 16)) {
+		return NULL;
+	}
+	return voice;
+}
+
+static
+void stmFinishVoice(wMixer* mixer, i32 index)
+{
+	wMixerVoice* voice = mixer->voices + index;
+	i32 head = mixer->finishedHead;
+	mixer->finished[(u32)head & (mixer->finishedCapacity - 1)] = 
+		(i32)(voice->generation << 16) | index;
+	wAtomicStore(&mixer->finishedHead, (i32)((u32)head + 1));
+
+	// Unlinked rather than swapped with the last, so voices are always
+	// summed in the order they started. Otherwise the sum's rounding
+	// would depend on how the output was split into calls.
+	if(voice->prevPlaying >= 0) {
+		mixer->voices[voice->prevPlaying].nextPlaying = voice->nextPlaying;
+	} else {
+		mixer->firstPlaying = voice->nextPlaying;
+	}
+	if(voice->nextPlaying >= 0) {
+		mixer->voices[voice->nextPlaying].prevPlaying = voice->prevPlaying;
+	} else {
+		mixer->lastPlaying = voice->prevPlaying;
+	}
+	voice->prevPlaying = voice->nextPlaying = -1;
+	stmResetVoice(mixer, index);
+}
+
+static
+void stmRunCommand(wMixer* mixer, wMixerCommand* cmd)
+{
+	wMixerVoice* voice = NULL;
+	switch(cmd->type) {
+		case wMixer_CmdPlay:
+		case wMixer_CmdPlayStream:
+			voice = mixer->voices + (cmd->handle & 0xFFFF);
+			if(voice->state != wMixer_VoiceStopped) {
+				stmFinishVoice(mixer, cmd->handle & 0xFFFF);
+			}
+			voice->prevPlaying = mixer->lastPlaying;
+			voice->nextPlaying = -1;
+			if(mixer->lastPlaying >= 0) {
+				mixer->voices[mixer->lastPlaying].nextPlaying = 
+					cmd->handle & 0xFFFF;
+			} else {
+				mixer->firstPlaying = cmd->handle & 0xFFFF;
+			}
+			mixer->lastPlaying = cmd->handle & 0xFFFF;
+			voice->generation = (u32)cmd->handle >> 16;
+			voice->gain = cmd->gain;
+			voice->pitch = cmd->pitch;
+			voice->pan = cmd->pan;
+			voice->position = 0;
+			voice->interpolation = cmd->interpolation;
+			voice->bus = cmd->bus;
+			voice->rolloff = cmd->rolloff;
+			voice->x = cmd->x;
+			voice->y = cmd->y;
+			voice->minDistance = cmd->minDistance;
+			voice->maxDistance = cmd->maxDistance;
+			voice->lastLeft = voice->lastRight = -1.0f;
+			if(cmd->type == wMixer_CmdPlay) {
+				voice->sample = cmd->source;
+				voice->stream = 0;
+				voice->state = wMixer_VoicePlaying;
+			} else {
+				voice->sample = 0;
+				voice->stream = cmd->source;
+				voice->state = wMixer_VoiceStreaming;
+			}
+			break;
+
+		case wMixer_CmdStop:
+			if(stmGetVoice(mixer, cmd->handle)) {
+				stmFinishVoice(mixer, cmd->handle & 0xFFFF);
+			}
+			break;
+
+		case wMixer_CmdStopSample:
+		case wMixer_CmdStopStream:
+			for(i32 index = mixer->firstPlaying; index >= 0; ) {
+				voice = mixer->voices + index;
+				i32 next = voice->nextPlaying;
+				if(voice->sample == cmd->source || voice->stream == cmd->source) {
+					stmFinishVoice(mixer, index);
+				}
+				index = next;
+			}
+			break;
+
+		case wMixer_CmdSetGain:
+			voice = stmGetVoice(mixer, cmd->handle);
+			if(voice) voice->gain = cmd->gain;
+			break;
+
+		case wMixer_CmdSetPitch:
+			voice = stmGetVoice(mixer, cmd->handle);
+			if(voice) voice->pitch = cmd->pitch;
+			break;
+
+		case wMixer_CmdSetPan:
+			voice = stmGetVoice(mixer, cmd->handle);
+			if(voice) voice->pan = cmd->pan;
+			break;
+
+		case wMixer_CmdSetInterpolation:
+			voice = stmGetVoice(mixer, cmd->handle);
+			if(voice) voice->interpolation = cmd->interpolation;
+			break;
+
+		case wMixer_CmdSetBus:
+			voice = stmGetVoice(mixer, cmd->handle);
+			if(voice) voice->bus = cmd->bus;
+			break;
+
+		case wMixer_CmdSetBusGain:
+			mixer->buses[cmd->bus].gain = cmd->gain;
+			break;
+
+		case wMixer_CmdSetEffect: {
+			wMixerEffect* effect = mixer->buses[cmd->bus].effects + cmd->effect;
+			memcpy(effect->params, cmd->params, sizeof(effect->params));
+			effect->dirty = 1;
+		} break;
+
+		case wMixer_CmdSetPosition:
+			voice = stmGetVoice(mixer, cmd->handle);
+			if(voice) {
+				voice->x = cmd->x;
+				voice->y = cmd->y;
+			}
+			break;
+
+		case wMixer_CmdSetRolloff:
+			voice = stmGetVoice(mixer, cmd->handle);
+			if(voice) {
+				if(voice->rolloff == wMixer_RolloffNone) {
+					voice->lastLeft = voice->lastRight = -1.0f;
+				}
+				voice->rolloff = cmd->rolloff;
+				voice->minDistance = cmd->minDistance;
+				voice->maxDistance = cmd->maxDistance;
+			}
+			break;
+
+		case wMixer_CmdSetListener:
+			mixer->earX = cmd->x;
+			mixer->earY = cmd->y;
+			break;
+	}
+}
+
+static
+void stmRunCommands(wMixer* mixer)
+{
+	i32 tail = mixer->commandTail;
+	i32 head = wAtomicLoad(&mixer->commandHead);
+	while(tail != head) {
+		stmRunCommand(mixer, 
+				mixer->commands + ((u32)tail & (mixer->commandCapacity - 1)));
+		tail = (i32)((u32)tail + 1);
+	}
+	wAtomicStore(&mixer->commandTail, tail);
+}
+
+/* Game thread side */
+
+static
+i32 stmCommandSpace(wMixer* mixer)
+{
+	i32 tail = wAtomicLoad(&mixer->commandTail);
+	return mixer->commandCapacity - 
+		(i32)((u32)mixer->commandHead - (u32)tail);
+}
+
+static
+i32 stmPushCommand(wMixer* mixer, wMixerCommand* cmd)
+{
+	i32 head = mixer->commandHead;
+	if(stmCommandSpace(mixer) <= 0) {
+		wLogError(0, "Error: mixer command queue is full\n");
+		return 0;
+	}
+	mixer->commands[(u32)head & (mixer->commandCapacity - 1)] = *cmd;
+	wAtomicStore(&mixer->commandHead, (i32)((u32)head + 1));
+	return 1;
+}
+
+// Whether slot a should be stolen before slot b
+static
+i32 stmStealsBefore(wMixer* mixer, i32 a, i32 b)
+{
+	wMixerSlot* x = mixer->slots + a;
+	wMixerSlot* y = mixer->slots + b;
+	if(x->priority != y->priority) {
+		return x->priority < y->priority;
+	}
+	if(mixer->stealPolicy == wMixer_StealQuietest && x->loudness != y->loudness) {
+		return x->loudness < y->loudness;
+	}
+	return (i32)(x->serial - y->serial) < 0;
+}
+
+static
+void stmHeapSwap(wMixer* mixer, isize i, isize j)
+{
+	i32 a = mixer->heap[i];
+	i32 b = mixer->heap[j];
+	mixer->heap[i] = b;
+	mixer->heap[j] = a;
+	mixer->slots[b].heapIndex = (i32)i;
+	mixer->slots[a].heapIndex = (i32)j;
+}
+
+static
+void stmHeapDown(wMixer* mixer, isize i)
+{
+	while(1) {
+		isize child = i * 2 + 1;
+		if(child >= mixer->activeCount) break;
+		if(child + 1 < mixer->activeCount && 
+				stmStealsBefore(mixer, mixer->heap[child + 1], mixer->heap[child])) {
+			child++;
+		}
+		if(!stmStealsBefore(mixer, mixer->heap[child], mixer->heap[i])) break;
+		stmHeapSwap(mixer, i, child);
+		i = child;
+	}
+}
+
+static
+void stmHeapFix(wMixer* mixer, isize i)
+{
+	while(i > 0) {
+		isize parent = (i - 1) / 2;
+		if(!stmStealsBefore(mixer, mixer->heap[i], mixer->heap[parent])) break;
+		stmHeapSwap(mixer, i, parent);
+		i = parent;
+	}
+	stmHeapDown(mixer, i);
+}
+
+static
+void stmSlotLoudness(wMixer* mixer, wMixerSlot* slot)
+{
+	slot->loudness = slot->gain;
+	if(slot->rolloff != wMixer_RolloffNone) {
+		f32 dx = slot->x - mixer->listenerX;
+		f32 dy = slot->y - mixer->listenerY;
+		slot->loudness *= stmAttenuation(slot->rolloff, 
+				slot->minDistance, slot->maxDistance, wb_sqrtf(dx * dx + dy * dy));
+	}
+}
+
+static
+void stmReleaseSlot(wMixer* mixer, i32 index)
+{
+	wMixerSlot* slot = mixer->slots + index;
+	isize i = slot->heapIndex;
+	isize last = --mixer->activeCount;
+	if(i != last) {
+		stmHeapSwap(mixer, i, last);
+		stmHeapFix(mixer, i);
+	}
+	if(slot->sample) {
+		slot->sample->instances--;
+		slot->sample->lastCommand = mixer->commandHead;
+		slot->sample = NULL;
+	}
+	slot->active = 0;
+	slot->heapIndex = -1;
+	slot->next = mixer->freeSlot;
+	mixer->freeSlot = index;
+}
+
+// Frees the slots of voices the audio thread has finished with. Stolen
+// voices have already moved on to a new generation, so they're skipped.
+static
+void stmReapVoices(wMixer* mixer)
+{
+	i32 tail = mixer->finishedTail;
+	i32 head = wAtomicLoad(&mixer->finishedHead);
+	while(tail != head) {
+		i32 handle = mixer->finished[(u32)tail & (mixer->finishedCapacity - 1)];
+		wMixerSlot* slot = mixer->slots + (handle & 0xFFFF);
+		if(slot->active && slot->generation == (u32)handle >> 16) {
+			stmReleaseSlot(mixer, handle & 0xFFFF);
 		}
+		tail = (i32)((u32)tail + 1);
+	}
+	wAtomicStore(&mixer->finishedTail, tail);
+}
+
+// Frees up the top of the heap if it's no more important than priority.
+// Its slot can be reused right away: the stop is queued ahead of the play.
+static
+i32 stmStealVoice(wMixer* mixer, i32 priority)
+{
+	if(mixer->stealPolicy == wMixer_StealNone || mixer->activeCount == 0) {
+		return 0;
+	}
+	i32 victim = mixer->heap[0];
+	wMixerSlot* slot = mixer->slots + victim;
+	if(slot->priority > priority) {
+		return 0;
+	}
+
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdStop;
+	cmd.handle = (i32)(slot->generation << 16) | victim;
+	stmPushCommand(mixer, &cmd);
+	stmReleaseSlot(mixer, victim);
+	return 1;
+}
+
+static
+i32 stmStartVoice(wMixer* mixer, wMixerCommand* cmd, 
+		wMixerSample* sample, i32 priority)
+{
+	stmReapVoices(mixer);
+	if(sample && sample->maxInstances > 0 && 
+			sample->instances >= sample->maxInstances) {
+		return -1;
+	}
+	// Room for a stop and a play
+	if(stmCommandSpace(mixer) < 2) {
+		wLogError(0, "Error: mixer command queue is full\n");
+		return -1;
+	}
+	if(mixer->freeSlot < 0 && !stmStealVoice(mixer, priority)) {
+		return -1;
+	}
+
+	i32 i = mixer->freeSlot;
+	wMixerSlot* slot = mixer->slots + i;
+	mixer->freeSlot = slot->next;
+
+	slot->generation = (slot->generation + 1) & 0x7FFF;
+	slot->active = 1;
+	slot->next = -1;
+	slot->priority = priority;
+	slot->gain = cmd->gain;
+	slot->serial = mixer->serial++;
+	slot->sample = sample;
+	slot->rolloff = cmd->rolloff;
+	slot->x = cmd->x;
+	slot->y = cmd->y;
+	slot->minDistance = cmd->minDistance;
+	slot->maxDistance = cmd->maxDistance;
+	stmSlotLoudness(mixer, slot);
+	if(sample) {
+		sample->instances++;
 	}
-	return active;
+	slot->heapIndex = (i32)mixer->activeCount;
+	mixer->heap[mixer->activeCount++] = i;
+	stmHeapFix(mixer, slot->heapIndex);
+
+	cmd->handle = (i32)(slot->generation << 16) | i;
+	stmPushCommand(mixer, cmd);
+	return cmd->handle;
+}
+
+static
+void stmSetVoice(wMixer* mixer, i32 type, i32 handle, 
+		f32 gain, f32 pitch, f32 pan, i32 interpolation)
+{
+	if(handle < 0) return;
+	wMixerCommand cmd = {0};
+	cmd.type = type;
+	cmd.handle = handle;
+	cmd.gain = gain;
+	cmd.pitch = pitch;
+	cmd.pan = pan;
+	cmd.interpolation = interpolation;
+	stmPushCommand(mixer, &cmd);
+}
+
+static
+i32 stmCheckBus(wMixer* mixer, i32 bus)
+{
+	return bus >= 0 && bus < mixer->busCount;
+}
+
+int wMixerGetActiveVoices(wMixer* mixer) 
+{
+	stmReapVoices(mixer);
+	return (int)mixer->activeCount;
 }
 
 
@@ -94,116 +600,967 @@ int wMixerPlaySample(wMixer* mixer,
 		wMixerSample* sample,
 		f32 gain, f32 pitch, f32 pan)
 {
-	int                 i;
-	wMixerVoice*  voice;
+	return wMixerPlaySampleEx(mixer, sample, gain, pitch, pan, 0);
+}
+
+
+int wMixerPlaySampleEx(wMixer* mixer, wMixerSample* sample, 
+		f32 gain, f32 pitch, f32 pan, i32 priority)
+{
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdPlay;
+	cmd.source = sample;
+	cmd.gain = gain;
+	cmd.pitch = stmClamp(pitch, 0.1f, 10.0f);
+	cmd.pan = stmClamp(pan * 0.5f, -0.5f, 0.5f);
+	cmd.interpolation = mixer->interpolation;
+	cmd.bus = stmCheckBus(mixer, sample->bus) ? sample->bus : 0;
+	return stmStartVoice(mixer, &cmd, sample, priority);
+}
+
+
+int wMixerPlayStream(wMixer* mixer, wMixerStream* stream, float gain) 
+{
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdPlayStream;
+	cmd.source = stream;
+	cmd.gain = gain;
+	cmd.interpolation = wMixer_InterpNearest;
+	cmd.bus = stmCheckBus(mixer, stream->sample.bus) ? stream->sample.bus : 0;
+	return stmStartVoice(mixer, &cmd, NULL, Mixer_StreamPriority);
+}
+
+
+void wMixerStopVoice(wMixer* mixer, int voice) 
+{
+	stmSetVoice(mixer, wMixer_CmdStop, voice, 0, 0, 0, 0);
+}
+
+
+// Cheap SFX can stay on nearest/linear; save sinc for music and the like
+void wMixerSetVoiceInterpolation(wMixer* mixer, int voice, i32 mode)
+{
+	if(mode >= wMixer_InterpNearest && mode <= wMixer_InterpSinc) {
+		stmSetVoice(mixer, wMixer_CmdSetInterpolation, voice, 0, 0, 0, mode);
+	}
+}
+
+void wMixerSetVoiceGain(wMixer* mixer, int voice, f32 gain)
+{
+	i32 index = voice & 0xFFFF;
+	if(voice < 0 || index >= mixer->voiceCount) return;
+	wMixerSlot* slot = mixer->slots + index;
+	if(slot->active && slot->generation == (u32)voice >> 16) {
+		slot->gain = gain;
+		stmSlotLoudness(mixer, slot);
+		stmHeapFix(mixer, slot->heapIndex);
+	}
+	stmSetVoice(mixer, wMixer_CmdSetGain, voice, gain, 0, 0, 0);
+}
+
+void wMixerSetVoicePitch(wMixer* mixer, int voice, f32 pitch)
+{
+	stmSetVoice(mixer, wMixer_CmdSetPitch, voice, 
+			0, stmClamp(pitch, 0.1f, 10.0f), 0, 0);
+}
+
+void wMixerSetVoicePan(wMixer* mixer, int voice, f32 pan)
+{
+	stmSetVoice(mixer, wMixer_CmdSetPan, voice, 
+			0, 0, stmClamp(pan * 0.5f, -0.5f, 0.5f), 0);
+}
+
+
+void wMixerStopSample(wMixer* mixer, wMixerSample* sample) 
+{
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdStopSample;
+	cmd.handle = -1;
+	cmd.source = sample;
+	stmPushCommand(mixer, &cmd);
+}
+
+
+void wMixerStopStream(wMixer* mixer, wMixerStream* stream) 
+{
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdStopStream;
+	cmd.handle = -1;
+	cmd.source = stream;
+	stmPushCommand(mixer, &cmd);
+}
+
+/* Buses and effects are set up on the game thread and only published
+ * once they're filled in, so they can be added while audio is running.
+ * Returns the new bus, or -1 if there are already Mixer_MaxBuses.
+ */
+i32 wMixerAddBus(wMixer* mixer, string name, i32 parent)
+{
+	i32 index = mixer->busCount;
+	if(index >= Mixer_MaxBuses) {
+		wLogError(0, "Error: mixer can't have more than %d buses\n", 
+				Mixer_MaxBuses);
+		return -1;
+	}
+	if(index > 0 && !stmCheckBus(mixer, parent)) {
+		parent = 0;
+	}
+	wMixerBus* bus = mixer->buses + index;
+	memset(bus, 0, sizeof(wMixerBus));
+	bus->hash = wHashString(name);
+	bus->parent = index > 0 ? parent : -1;
+	bus->gain = 1.0f;
+	wAtomicStore(&mixer->busCount, index + 1);
+	return index;
+}
+
+i32 wMixerGetBus(wMixer* mixer, string name)
+{
+	u64 hash = wHashString(name);
+	for(i32 i = 0; i < mixer->busCount; ++i) {
+		if(mixer->buses[i].hash == hash) {
+			return i;
+		}
+	}
+	return -1;
+}
 
-	i = stmFindFreeVoice(mixer);
-	if (i >= 0) {
-		voice = &mixer->voices[i];
-		voice->gain = gain;
-		voice->pitch = stmClamp(pitch, 0.1f, 10.0f);
-		voice->pan = stmClamp(pan * 0.5f, -0.5f, 0.5f);
-		voice->position = 0.0f;
-		voice->sample = sample;
-		voice->stream = 0;
-		voice->state = wMixer_VoicePlaying;
+/* Effects run in the order they're added. Reverbs get their delay lines
+ * from the arena. Returns the effect's index on the bus, or -1.
+ */
+i32 wMixerAddEffect(wMixer* mixer, i32 bus, i32 type, 
+		f32 a, f32 b, f32 c, wMemoryArena* arena)
+{
+	if(!stmCheckBus(mixer, bus)) return -1;
+	if(type < wMixer_EffectLowPass || type > wMixer_EffectLimiter) return -1;
+	wMixerBus* owner = mixer->buses + bus;
+	i32 index = owner->effectCount;
+	if(index >= Mixer_MaxEffects) {
+		wLogError(0, "Error: bus can't have more than %d effects\n", 
+				Mixer_MaxEffects);
+		return -1;
 	}
+
+	wMixerEffect* effect = owner->effects + index;
+	memset(effect, 0, sizeof(wMixerEffect));
+	effect->type = type;
+	effect->params[0] = a;
+	effect->params[1] = b;
+	effect->params[2] = c;
+	effect->dirty = 1;
+	if(type == wMixer_EffectReverb) {
+		wMixerReverb* reverb = wArenaPush(arena, sizeof(wMixerReverb));
+		memset(reverb, 0, sizeof(wMixerReverb));
+		for(i32 s = 0; s < 2; ++s) {
+			for(i32 k = 0; k < Mixer_ReverbCombs; ++k) {
+				i32 length = stmReverbLength(mixerReverbCombs[k] + s * 23, 
+						Mixer_ReverbMaxRate);
+				reverb->combs[s][k] = wArenaPush(arena, sizeof(f32) * length);
+			}
+			for(i32 k = 0; k < Mixer_ReverbAllpasses; ++k) {
+				i32 length = stmReverbLength(mixerReverbAllpasses[k] + s * 23,
+						Mixer_ReverbMaxRate);
+				reverb->allpasses[s][k] = wArenaPush(arena, sizeof(f32) * length);
+			}
+		}
+		effect->reverb = reverb;
+	}
+	wAtomicStore(&owner->effectCount, index + 1);
+	return index;
+}
+
+void wMixerSetEffect(wMixer* mixer, i32 bus, i32 effect, f32 a, f32 b, f32 c)
+{
+	if(!stmCheckBus(mixer, bus)) return;
+	if(effect < 0 || effect >= mixer->buses[bus].effectCount) return;
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdSetEffect;
+	cmd.handle = -1;
+	cmd.bus = bus;
+	cmd.effect = effect;
+	cmd.params[0] = a;
+	cmd.params[1] = b;
+	cmd.params[2] = c;
+	stmPushCommand(mixer, &cmd);
+}
+
+// The master bus's gain goes on top of mixer->gain
+void wMixerSetBusGain(wMixer* mixer, i32 bus, f32 gain)
+{
+	if(!stmCheckBus(mixer, bus)) return;
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdSetBusGain;
+	cmd.handle = -1;
+	cmd.bus = bus;
+	cmd.gain = gain;
+	stmPushCommand(mixer, &cmd);
+}
+
+void wMixerSetVoiceBus(wMixer* mixer, int voice, i32 bus)
+{
+	if(voice < 0 || !stmCheckBus(mixer, bus)) return;
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdSetBus;
+	cmd.handle = voice;
+	cmd.bus = bus;
+	stmPushCommand(mixer, &cmd);
+}
+
+static
+wMixerSlot* stmGetSlot(wMixer* mixer, i32 handle)
+{
+	i32 index = handle & 0xFFFF;
+	if(handle < 0 || index >= mixer->voiceCount) return NULL;
+	wMixerSlot* slot = mixer->slots + index;
+	if(!slot->active || slot->generation != (u32)handle >> 16) return NULL;
+	return slot;
+}
+
+/* Plays a sample at a point in the world, with the mixer's rolloff. The
+ * pan comes from where it is, so it changes as it or the listener moves.
+ */
+int wMixerPlaySampleAt(wMixer* mixer, wMixerSample* sample, 
+		f32 x, f32 y, f32 gain, f32 pitch, i32 priority)
+{
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdPlay;
+	cmd.source = sample;
+	cmd.gain = gain;
+	cmd.pitch = stmClamp(pitch, 0.1f, 10.0f);
+	cmd.interpolation = mixer->interpolation;
+	cmd.bus = stmCheckBus(mixer, sample->bus) ? sample->bus : 0;
+	cmd.rolloff = mixer->rolloff;
+	cmd.x = x;
+	cmd.y = y;
+	cmd.minDistance = mixer->minDistance;
+	cmd.maxDistance = mixer->maxDistance;
+	return stmStartVoice(mixer, &cmd, sample, priority);
+}
+
+void wMixerSetVoicePosition(wMixer* mixer, int voice, f32 x, f32 y)
+{
+	if(voice < 0) return;
+	wMixerSlot* slot = stmGetSlot(mixer, voice);
+	if(slot) {
+		slot->x = x;
+		slot->y = y;
+		stmSlotLoudness(mixer, slot);
+		stmHeapFix(mixer, slot->heapIndex);
+	}
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdSetPosition;
+	cmd.handle = voice;
+	cmd.x = x;
+	cmd.y = y;
+	stmPushCommand(mixer, &cmd);
+}
+
+// For sample voices; wMixer_RolloffNone makes it an ordinary voice again
+void wMixerSetVoiceRolloff(wMixer* mixer, int voice, 
+		i32 rolloff, f32 minDistance, f32 maxDistance)
+{
+	if(voice < 0) return;
+	if(rolloff < wMixer_RolloffNone || rolloff > wMixer_RolloffQuadratic) return;
+	if(maxDistance <= minDistance) {
+		maxDistance = minDistance + 1.0f;
+	}
+	wMixerSlot* slot = stmGetSlot(mixer, voice);
+	if(slot) {
+		slot->rolloff = rolloff;
+		slot->minDistance = minDistance;
+		slot->maxDistance = maxDistance;
+		stmSlotLoudness(mixer, slot);
+		stmHeapFix(mixer, slot->heapIndex);
+	}
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdSetRolloff;
+	cmd.handle = voice;
+	cmd.rolloff = rolloff;
+	cmd.minDistance = minDistance;
+	cmd.maxDistance = maxDistance;
+	stmPushCommand(mixer, &cmd);
+}
+
+/* Moving the listener changes how loud every positional voice is, so
+ * the steal heap gets rebuilt; that's linear in the playing voices.
+ */
+void wMixerSetListener(wMixer* mixer, f32 x, f32 y)
+{
+	mixer->listenerX = x;
+	mixer->listenerY = y;
+	for(isize i = 0; i < mixer->activeCount; ++i) {
+		stmSlotLoudness(mixer, mixer->slots + mixer->heap[i]);
+	}
+	for(isize i = mixer->activeCount / 2 - 1; i >= 0; --i) {
+		stmHeapDown(mixer, i);
+	}
+	wMixerCommand cmd = {0};
+	cmd.type = wMixer_CmdSetListener;
+	cmd.handle = -1;
+	cmd.x = x;
+	cmd.y = y;
+	stmPushCommand(mixer, &cmd);
+}
+
+/* Resamples up to count frames of a float sample into out. Returns how
+ * many it got before running off the end of the sample.
+ */
+static
+u32 stmResample(wMixerSample* sample, i32 interpolation, 
+		u64* positionInOut, u64 step, f32* out, u32 count)
+{
+	f32* data = sample->data;
+	u64 position = *positionInOut;
+	u64 end = (u64)sample->length << 32;
+	f32 fracScale = 1.0f / 4294967296.0f;
+	u32 i = 0;
+
+	// Whole frames at the output rate are a straight copy in any mode
+	if(step == Mixer_FixedOne && (u32)position == 0) {
+		u64 start = position >> 32;
+		if(start < sample->length) {
+			i = sample->length - (u32)start;
+			if(i > count) i = count;
+			memcpy(out, data + start, i * sizeof(f32));
+			position += (u64)i << 32;
+		}
+		*positionInOut = position;
+		return i;
+	}
+
+	switch(interpolation) {
+		case wMixer_InterpNearest:
+			for(; i < count && position < end; ++i) {
+				out[i] = data[position >> 32];
+				position += step;
+			}
+			break;
+
+		case wMixer_InterpLinear:
+			for(; i < count && position < end; ++i) {
+				i64 p = position >> 32;
+				f32 t = (f32)(u32)position * fracScale;
+				f32 a = data[p];
+				f32 b = stmSampleAt(sample, p + 1);
+				out[i] = a + (b - a) * t;
+				position += step;
+			}
+			break;
+
+		case wMixer_InterpCubic:
+			for(; i < count && position < end; ++i) {
+				i64 p = position >> 32;
+				f32 t = (f32)(u32)position * fracScale;
+				f32 y0, y1 = data[p], y2, y3;
+				if(p >= 1 && p + 2 < (i64)sample->length) {
+					y0 = data[p - 1];
+					y2 = data[p + 1];
+					y3 = data[p + 2];
+				} else {
+					y0 = stmSampleAt(sample, p - 1);
+					y2 = stmSampleAt(sample, p + 1);
+					y3 = stmSampleAt(sample, p + 2);
+				}
+				f32 c1 = 0.5f * (y2 - y0);
+				f32 c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+				f32 c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+				out[i] = ((c3 * t + c2) * t + c1) * t + y1;
+				position += step;
+			}
+			break;
+
+		case wMixer_InterpSinc:
+			for(; i < count && position < end; ++i) {
+				i64 p = (i64)(position >> 32) - (Mixer_SincTaps / 2 - 1);
+				u32 phase = (u32)position >> (32 - Mixer_SincPhaseBits);
+				f32* taps = mixerSincTable[phase];
+				vf128 a, b;
+				if(p >= 0 && p + Mixer_SincTaps <= (i64)sample->length) {
+					a = _mm_loadu_ps(data + p);
+					b = _mm_loadu_ps(data + p + 4);
+				} else {
+					f32 edge[Mixer_SincTaps];
+					for(i32 k = 0; k < Mixer_SincTaps; ++k) {
+						edge[k] = stmSampleAt(sample, p + k);
+					}
+					a = _mm_loadu_ps(edge);
+					b = _mm_loadu_ps(edge + 4);
+				}
+				vf128 sum = _mm_add_ps(
+						_mm_mul_ps(a, _mm_loadu_ps(taps)),
+						_mm_mul_ps(b, _mm_loadu_ps(taps + 4)));
+				sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+				sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+				out[i] = _mm_cvtss_f32(sum);
+				position += step;
+			}
+			break;
+	}
+
+	*positionInOut = position;
 	return i;
 }
 
+// Frames [first, first + count) of an int16 sample, silent outside it
+static
+void stmConvertS16(wMixerSample* sample, i64 first, i64 count, f32* out)
+{
+	i16* data = sample->data;
+	vf128 scale = _mm_set1_ps(1.0f / 32768.0f);
+	i64 k = 0;
+	for(; k < count && first + k < 0; ++k) {
+		out[k] = 0.0f;
+	}
+	i64 stop = (i64)sample->length - first;
+	if(stop > count) stop = count;
+	for(; k + 8 <= stop; k += 8) {
+		__m128i x = _mm_loadu_si128((__m128i*)(data + first + k));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(out + k, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(out + k + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	for(; k < stop; ++k) {
+		out[k] = (f32)data[first + k] * (1.0f / 32768.0f);
+	}
+	for(; k < count; ++k) {
+		out[k] = 0.0f;
+	}
+}
 
-int wMixerPlayStream(wMixer* mixer, wMixerStream* stream, float gain) 
+/* Converts just the frames the interpolator will touch into
+ * mixer->convert, and resamples from there, a window at a time. The
+ * window starts far enough back for the sinc's taps, and the silence
+ * past either end matches what stmSampleAt gives float samples.
+ */
+static
+u32 mixS16Voice(wMixer* mixer, wMixerVoice* voice, u32 count, u64 step)
 {
-	i32 i = stmFindFreeVoice(mixer);
-	if (i >= 0) {
-		wMixerVoice* voice = mixer->voices + i;
-		voice->gain = gain;
-		voice->position = 0.0f;
-		voice->sample = 0;
-		voice->stream = stream;
-		voice->state = wMixer_VoiceStreaming;
+	wMixerSample* sample = voice->sample;
+	u64 position = voice->position;
+	u64 end = (u64)sample->length << 32;
+	u64 maxOffset = (u64)(Mixer_ConvertFrames - Mixer_SincTaps) << 32;
+	u32 i = 0;
+	while(i < count && position < end) {
+		i64 first = (i64)(position >> 32) - Mixer_SincTaps / 2;
+		u64 offset = position - ((u64)first << 32);
+
+		u32 n = count - i;
+		if(step > 0) {
+			u64 fits = (maxOffset - offset) / step + 1;
+			u64 left = (end - position + step - 1) / step;
+			if(n > fits) n = (u32)fits;
+			if(n > left) n = (u32)left;
+		}
+		u64 last = offset + step * (n - 1);
+		i64 span = (i64)(last >> 32) + Mixer_SincTaps / 2 + 1;
+		stmConvertS16(sample, first, span, mixer->convert);
+
+		wMixerSample window = {0};
+		window.length = (u32)span;
+		window.frequency = sample->frequency;
+		window.data = mixer->convert;
+		u64 windowPosition = offset;
+		i += stmResample(&window, voice->interpolation, 
+				&windowPosition, step, mixer->voiceLeft + i, n);
+		position += windowPosition - offset;
 	}
+	voice->position = position;
 	return i;
 }
 
+/* Gathers up to count frames of a sample voice into voiceLeft. Returns
+ * how many it got before running off the end of the sample.
+ */
+static
+u32 mixSampleVoice(wMixer* mixer, wMixerVoice* voice, u32 count, u64 step)
+{
+	if(voice->sample->format == wMixer_FormatS16) {
+		return mixS16Voice(mixer, voice, count, step);
+	}
+	return stmResample(voice->sample, voice->interpolation, 
+			&voice->position, step, mixer->voiceLeft, count);
+}
 
-void wMixerStopVoice(wMixer* mixer, int voice) 
+/* Moves a voice along as if count frames had been mixed, without mixing
+ * them. Returns how many frames that would have been.
+ */
+static
+u32 skipSampleVoice(wMixerVoice* voice, u32 count, u64 step)
 {
-	if (voice >= 0 && voice < mixer->voiceCount) {
-		stmResetVoice(mixer, voice);
+	u64 end = (u64)voice->sample->length << 32;
+	u32 n = count;
+	if(voice->position >= end) {
+		n = 0;
+	} else if(step > 0) {
+		u64 left = (end - voice->position + step - 1) / step;
+		if(n > left) n = (u32)left;
 	}
+	voice->position += step * n;
+	return n;
 }
 
+/* Streams are interleaved stereo, and refill themselves when they run
+ * out. A refill that leaves the length at 0 ends the stream; returns the
+ * number of frames mixed.
+ */
+static
+u32 mixStreamVoice(wMixer* mixer, wMixerVoice* voice, u32 count)
+{
+	wMixerStream* stream = voice->stream;
+	wMixerSample* sample = &stream->sample;
+	u64 position = voice->position;
+	u64 step = ((u64)sample->frequency << 32) / mixer->frequency;
+	u32 i = 0;
+	for(; i < count; ++i) {
+		u64 p = (position >> 32) * 2;
+		if(p >= sample->length) {
+			stream->callback(sample, stream->userdata);
+			if(sample->length == 0) {
+				break;
+			}
+			step = ((u64)sample->frequency << 32) / mixer->frequency;
+			position = 0;
+			p = 0;
+		}
+		f32* data = sample->data;
+		mixer->voiceLeft[i] = data[p];
+		mixer->voiceRight[i] = data[p + 1];
+		position += step;
+	}
+	voice->position = position;
+	return i;
+}
 
-void wMixerStopSample(wMixer* mixer, wMixerSample* sample) 
+// acc += in * gain * scale, rounded the same way the per-sample loop was
+static
+void accumulateVoice(f32* acc, f32* in, u32 count, f32 gain, f32 scale)
+{
+	vf128 gains = _mm_set1_ps(gain);
+	vf128 scales = _mm_set1_ps(scale);
+	u32 i = 0;
+	for(; i + 4 <= count; i += 4) {
+		vf128 x = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(in + i), gains), scales);
+		_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), x));
+	}
+	for(; i < count; ++i) {
+		acc[i] += in[i] * gain * scale;
+	}
+}
+
+// acc += in * gain, with gain moving by delta every frame from from
+static
+void accumulateRamp(f32* acc, f32* in, u32 count, f32 from, f32 delta)
+{
+	vf128 gains = _mm_add_ps(_mm_set1_ps(from), 
+			_mm_mul_ps(_mm_set1_ps(delta), _mm_set_ps(4.0f, 3.0f, 2.0f, 1.0f)));
+	vf128 step = _mm_set1_ps(delta * 4.0f);
+	u32 i = 0;
+	for(; i + 4 <= count; i += 4) {
+		vf128 x = _mm_mul_ps(_mm_loadu_ps(in + i), gains);
+		_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), x));
+		gains = _mm_add_ps(gains, step);
+	}
+	for(; i < count; ++i) {
+		acc[i] += in[i] * (from + delta * (f32)(i + 1));
+	}
+}
+
+/* A positional voice's gains for this block. Inside minDistance it's
+ * centered; further out, it pans by how far off to the side it is.
+ */
+static
+void stmPlaceVoice(wMixer* mixer, wMixerVoice* voice, f32* left, f32* right)
+{
+	f32 dx = voice->x - mixer->earX;
+	f32 dy = voice->y - mixer->earY;
+	f32 distance = wb_sqrtf(dx * dx + dy * dy);
+	f32 gain = voice->gain * stmAttenuation(voice->rolloff, 
+			voice->minDistance, voice->maxDistance, distance);
+	f32 reach = distance > voice->minDistance ? distance : voice->minDistance;
+	f32 pan = reach > 0.0f ? 0.5f * dx / reach : 0.0f;
+	*left = gain * (0.5f - pan);
+	*right = gain * (0.5f + pan);
+}
+
+/* Effects */
+
+// Works out whatever depends on the params or the output rate
+static
+void stmSetupEffect(wMixer* mixer, wMixerEffect* effect)
+{
+	f32 rate = (f32)mixer->frequency;
+	f32* params = effect->params;
+	effect->dirty = 0;
+	switch(effect->type) {
+		case wMixer_EffectLowPass:
+		case wMixer_EffectHighPass: {
+			// RBJ cookbook
+			f32 cutoff = stmClamp(params[0], 10.0f, rate * 0.45f);
+			f32 q = params[1] > 0.0f ? params[1] : 0.70710678f;
+			f32 w0 = Math_Tau * cutoff / rate;
+			f32 cs = wb_cosf(w0);
+			f32 alpha = wb_sinf(w0) / (2.0f * q);
+			f32 a0 = 1.0f + alpha;
+			if(effect->type == wMixer_EffectLowPass) {
+				effect->b0 = (1.0f - cs) * 0.5f / a0;
+				effect->b1 = (1.0f - cs) / a0;
+			} else {
+				effect->b0 = (1.0f + cs) * 0.5f / a0;
+				effect->b1 = -(1.0f + cs) / a0;
+			}
+			effect->b2 = effect->b0;
+			effect->a1 = -2.0f * cs / a0;
+			effect->a2 = (1.0f - alpha) / a0;
+		} break;
+
+		case wMixer_EffectReverb: {
+			wMixerReverb* reverb = effect->reverb;
+			reverb->feedback = 0.7f + 0.28f * stmClamp(params[0], 0.0f, 1.0f);
+			reverb->damping = 0.4f * stmClamp(params[1], 0.0f, 1.0f);
+			reverb->wet = 3.0f * params[2];
+			if(reverb->frequency == mixer->frequency) {
+				break;
+			}
+			reverb->frequency = mixer->frequency;
+			for(i32 s = 0; s < 2; ++s) {
+				for(i32 k = 0; k < Mixer_ReverbCombs; ++k) {
+					i32 length = stmReverbLength(mixerReverbCombs[k] + s * 23,
+							mixer->frequency);
+					memset(reverb->combs[s][k], 0, sizeof(f32) * length);
+					reverb->combLength[s][k] = length;
+					reverb->combIndex[s][k] = 0;
+					reverb->combFilter[s][k] = 0.0f;
+				}
+				for(i32 k = 0; k < Mixer_ReverbAllpasses; ++k) {
+					i32 length = stmReverbLength(mixerReverbAllpasses[k] + s * 23,
+							mixer->frequency);
+					memset(reverb->allpasses[s][k], 0, sizeof(f32) * length);
+					reverb->allpassLength[s][k] = length;
+					reverb->allpassIndex[s][k] = 0;
+				}
+			}
+		} break;
+
+		case wMixer_EffectLimiter: {
+			f32 release = params[1] > 0.0f ? params[1] : 0.1f;
+			effect->threshold = params[0] > 0.0f ? params[0] : 0.9f;
+			effect->release = wb_expf(-1.0f / (release * rate));
+		} break;
+	}
+}
+
+/* Transposed direct form II, with left and right in the bottom two lanes.
+ * Each frame depends on the last, so that's as wide as it goes.
+ */
+static
+void stmRunBiquad(wMixerEffect* effect, f32* left, f32* right, u32 count)
+{
+	vf128 b0 = _mm_set1_ps(effect->b0);
+	vf128 b1 = _mm_set1_ps(effect->b1);
+	vf128 b2 = _mm_set1_ps(effect->b2);
+	vf128 a1 = _mm_set1_ps(effect->a1);
+	vf128 a2 = _mm_set1_ps(effect->a2);
+	vf128 z1 = _mm_loadu_ps(effect->z1);
+	vf128 z2 = _mm_loadu_ps(effect->z2);
+	for(u32 i = 0; i < count; ++i) {
+		vf128 x = _mm_unpacklo_ps(_mm_load_ss(left + i), _mm_load_ss(right + i));
+		vf128 y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+		z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+		z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+		_mm_store_ss(left + i, y);
+		_mm_store_ss(right + i, _mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 1, 1, 1)));
+	}
+	_mm_storeu_ps(effect->z1, z1);
+	_mm_storeu_ps(effect->z2, z2);
+}
+
+#define Mixer_ReverbInputGain (0.015f)
+
+/* Each side's four combs run side by side in one vector: read, damp,
+ * feed back, write. The allpasses are in series, so they stay scalar.
+ * Both sides get the same mono input, and the wet signal goes on top of
+ * the dry one.
+ */
+static
+void stmRunReverb(wMixerEffect* effect, f32* left, f32* right, u32 count)
 {
-	for(isize i = 0; i < mixer->voiceCount; ++i) {
-		if(mixer->voices[i].sample == sample) {
-			stmResetVoice(mixer, i);
+	wMixerReverb* reverb = effect->reverb;
+	vf128 damping = _mm_set1_ps(reverb->damping);
+	vf128 undamped = _mm_set1_ps(1.0f - reverb->damping);
+	vf128 feedback = _mm_set1_ps(reverb->feedback);
+	vf128 filters[2];
+	for(i32 s = 0; s < 2; ++s) {
+		filters[s] = _mm_loadu_ps(reverb->combFilter[s]);
+	}
+
+	for(u32 i = 0; i < count; ++i) {
+		f32 wet[2];
+		vf128 input = _mm_set1_ps((left[i] + right[i]) * Mixer_ReverbInputGain);
+		for(i32 s = 0; s < 2; ++s) {
+			f32** combs = reverb->combs[s];
+			i32* index = reverb->combIndex[s];
+			vf128 out = _mm_set_ps(combs[3][index[3]], combs[2][index[2]],
+					combs[1][index[1]], combs[0][index[0]]);
+			filters[s] = _mm_add_ps(_mm_mul_ps(out, undamped),
+					_mm_mul_ps(filters[s], damping));
+			f32 written[4];
+			_mm_storeu_ps(written,
+					_mm_add_ps(input, _mm_mul_ps(filters[s], feedback)));
+			for(i32 k = 0; k < Mixer_ReverbCombs; ++k) {
+				combs[k][index[k]] = written[k];
+				if(++index[k] >= reverb->combLength[s][k]) {
+					index[k] = 0;
+				}
+			}
+
+			out = _mm_add_ps(out, _mm_movehl_ps(out, out));
+			out = _mm_add_ss(out, _mm_shuffle_ps(out, out, _MM_SHUFFLE(1, 1, 1, 1)));
+			f32 x = _mm_cvtss_f32(out);
+			for(i32 k = 0; k < Mixer_ReverbAllpasses; ++k) {
+				f32* line = reverb->allpasses[s][k];
+				i32* at = reverb->allpassIndex[s] + k;
+				f32 delayed = line[*at];
+				line[*at] = x + delayed * 0.5f;
+				x = delayed - x;
+				if(++*at >= reverb->allpassLength[s][k]) {
+					*at = 0;
+				}
+			}
+			wet[s] = x * reverb->wet;
 		}
+		left[i] += wet[0];
+		right[i] += wet[1];
+	}
+
+	for(i32 s = 0; s < 2; ++s) {
+		_mm_storeu_ps(reverb->combFilter[s], filters[s]);
 	}
 }
 
+/* Peak limiter: the envelope jumps straight to any peak over it and falls
+ * off at the release rate, and the gain holds the envelope to the
+ * threshold. Peaks and gains go four frames at a time.
+ */
+static
+void stmRunLimiter(wMixerEffect* effect, f32* left, f32* right, u32 count)
+{
+	f32 envelope = effect->envelope;
+	f32 threshold = effect->threshold;
+	f32 release = effect->release;
+	for(u32 i = 0; i < count; i += 4) {
+		u32 n = count - i < 4 ? count - i : 4;
+		f32 peaks[4] = {0};
+		f32 gains[4];
+		if(n == 4) {
+			vf128 l = wb_abs_ps(_mm_loadu_ps(left + i));
+			vf128 r = wb_abs_ps(_mm_loadu_ps(right + i));
+			_mm_storeu_ps(peaks, wb_max_ps(l, r));
+		} else {
+			for(u32 k = 0; k < n; ++k) {
+				f32 l = left[i + k] < 0.0f ? -left[i + k] : left[i + k];
+				f32 r = right[i + k] < 0.0f ? -right[i + k] : right[i + k];
+				peaks[k] = l > r ? l : r;
+			}
+		}
 
-void wMixerStopStream(wMixer* mixer, wMixerStream* stream) 
+		for(u32 k = 0; k < n; ++k) {
+			envelope *= release;
+			if(peaks[k] > envelope) {
+				envelope = peaks[k];
+			}
+			gains[k] = envelope > threshold ? threshold / envelope : 1.0f;
+		}
+
+		if(n == 4) {
+			vf128 gain = _mm_loadu_ps(gains);
+			_mm_storeu_ps(left + i, _mm_mul_ps(_mm_loadu_ps(left + i), gain));
+			_mm_storeu_ps(right + i, _mm_mul_ps(_mm_loadu_ps(right + i), gain));
+		} else {
+			for(u32 k = 0; k < n; ++k) {
+				left[i + k] *= gains[k];
+				right[i + k] *= gains[k];
+			}
+		}
+	}
+	effect->envelope = envelope;
+}
+
+static
+void stmRunEffects(wMixer* mixer, wMixerBus* bus, u32 count)
 {
-	for(isize i = 0; i < mixer->voiceCount; ++i) {
-		if (mixer->voices[i].stream == stream) {
-			stmResetVoice(mixer, i);
+	i32 effectCount = wAtomicLoad(&bus->effectCount);
+	for(i32 i = 0; i < effectCount; ++i) {
+		wMixerEffect* effect = bus->effects + i;
+		if(effect->dirty) {
+			stmSetupEffect(mixer, effect);
 		}
+		switch(effect->type) {
+			case wMixer_EffectLowPass:
+			case wMixer_EffectHighPass:
+				stmRunBiquad(effect, bus->left, bus->right, count);
+				break;
+			case wMixer_EffectReverb:
+				stmRunReverb(effect, bus->left, bus->right, count);
+				break;
+			case wMixer_EffectLimiter:
+				stmRunLimiter(effect, bus->left, bus->right, count);
+				break;
+		}
+	}
+}
+
+/* Exactly linear up to Mixer_SoftLimitKnee, then eases into full scale
+ * along a tanh curve (a Pade approximation, which reaches 1 at 3). Under
+ * the knee it's the same as the old clamp.
+ */
+static
+vf128 stmSoftLimit(vf128 x)
+{
+	vf128 knee = _mm_set1_ps(Mixer_SoftLimitKnee);
+	vf128 a = wb_abs_ps(x);
+	vf128 sign = _mm_xor_ps(x, a);
+	vf128 t = _mm_mul_ps(_mm_sub_ps(a, knee),
+			_mm_set1_ps(1.0f / (1.0f - Mixer_SoftLimitKnee)));
+	t = wb_clamp_ps(_mm_setzero_ps(), _mm_set1_ps(3.0f), t);
+	vf128 t2 = _mm_mul_ps(t, t);
+	vf128 curve = _mm_div_ps(_mm_mul_ps(t, _mm_add_ps(_mm_set1_ps(27.0f), t2)),
+			_mm_add_ps(_mm_set1_ps(27.0f), _mm_mul_ps(_mm_set1_ps(9.0f), t2)));
+	vf128 limited = _mm_add_ps(knee,
+			_mm_mul_ps(_mm_set1_ps(1.0f - Mixer_SoftLimitKnee), curve));
+	vf128 over = _mm_cmpgt_ps(a, knee);
+	a = _mm_or_ps(_mm_and_ps(over, limited), _mm_andnot_ps(over, a));
+	return _mm_or_ps(a, sign);
+}
+
+static
+void writeMixerBlock(wMixer* mixer, wMixerBus* master, f32* out, u32 count)
+{
+	f32 g = mixer->gain * master->gain;
+	vf128 gain = _mm_set1_ps(g);
+	u32 i = 0;
+	for(; i + 4 <= count; i += 4) {
+		vf128 l = stmSoftLimit(_mm_mul_ps(_mm_loadu_ps(master->left + i), gain));
+		vf128 r = stmSoftLimit(_mm_mul_ps(_mm_loadu_ps(master->right + i), gain));
+		_mm_storeu_ps(out + i * 2, _mm_unpacklo_ps(l, r));
+		_mm_storeu_ps(out + i * 2 + 4, _mm_unpackhi_ps(l, r));
+	}
+	for(; i < count; ++i) {
+		vf128 x = _mm_unpacklo_ps(_mm_set_ss(master->left[i] * g),
+				_mm_set_ss(master->right[i] * g));
+		x = stmSoftLimit(x);
+		_mm_store_ss(out + i * 2, x);
+		_mm_store_ss(out + i * 2 + 1, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 1, 1, 1)));
 	}
 }
 
+/* Voices no longer get clamped on their own, only the final mix. That
+ * only changes anything for voices with gain driving them past full scale.
+ * Denormals get flushed while mixing, since the filter and reverb tails
+ * decay into them; the caller's setting is put back after.
+ */
 void wMixerMixAudio(wMixer* mixer, void* output, u32 samples) 
 {
-	wMixerVoice*  voice;
-	u32 i, position;
-	f32 left, right, advance, sample;
-	f32* out_float = (f32*)output;
-
-	// mix all voices
-	advance = 1.0f / (float)mixer->frequency;
-	for (; samples > 0; --samples) {
-		left = 0.0f;
-		right = 0.0f;
-
-		for (i = 0; i < mixer->voiceCount; ++i) {
-			voice = mixer->voices + i;
-
-			if (voice->state == wMixer_VoicePlaying) {
-				wMixerSample* vsample = &voice->sample;
-				position = (int)voice->position;
-
-				if (position < vsample->length) {
-					sample = stmClamp1(stmGetSample(vsample, position) * voice->gain);
-					left += stmClamp1(sample * (0.5f - voice->pan));
-					right += stmClamp1(sample * (0.5f + voice->pan));
-					voice->position += (float)vsample->frequency * advance * voice->pitch;
-				} else {
-					stmResetVoice(mixer, i);
-				}
+	f64 start = wGetTime();
+	u32 csr = _mm_getcsr();
+	// Flush to zero, denormals are zero
+	_mm_setcsr(csr | 0x8040);
+	f32* out = output;
+	f64 advance = 4294967296.0 / (f64)mixer->frequency;
+	u32 remaining = samples;
+	f32 quiet = mixer->virtualGain;
 
-			} else if (voice->state == wMixer_VoiceStreaming) {
-				wMixerSample* vsample = &voice->stream->sample;
-				position = ((int)voice->position) * 2;
+	while(remaining > 0) {
+		u32 count = remaining < Mixer_BlockSize ? remaining : Mixer_BlockSize;
+		stmRunCommands(mixer);
+		// After the commands, which can name buses added since last block
+		i32 busCount = wAtomicLoad(&mixer->busCount);
+		for(i32 b = 0; b < busCount; ++b) {
+			memset(mixer->buses[b].left, 0, count * sizeof(f32));
+			memset(mixer->buses[b].right, 0, count * sizeof(f32));
+		}
 
-				if (position >= vsample->length) {
-					// buffer empty...refill
-					voice->stream->callback(vsample, voice->stream->userdata);
-					voice->position = 0.0f;
-					position = 0;
+		// Finishing a voice unlinks it, so the next is read first
+		i32 skipped = 0;
+		for(i32 i = mixer->firstPlaying; i >= 0; ) {
+			wMixerVoice* voice = mixer->voices + i;
+			i32 next = voice->nextPlaying;
+			wMixerBus* bus = mixer->buses + voice->bus;
+			if(voice->state == wMixer_VoicePlaying) {
+				u64 step = (u64)((f64)voice->sample->frequency * 
+						(f64)voice->pitch * advance);
+				// Positional voices ramp from last block's gains, so they
+				// only go quiet once both ends of the ramp are
+				f32 left = 0.0f, right = 0.0f;
+				f32 loudness = voice->gain;
+				if(voice->rolloff != wMixer_RolloffNone) {
+					stmPlaceVoice(mixer, voice, &left, &right);
+					if(voice->lastLeft < 0.0f) {
+						voice->lastLeft = left;
+						voice->lastRight = right;
+					}
+					loudness = left + right;
+					if(voice->lastLeft + voice->lastRight > loudness) {
+						loudness = voice->lastLeft + voice->lastRight;
+					}
 				}
 
-				left += stmClamp1(stmGetSample(vsample, position) * voice->gain);
-				right += stmClamp1(stmGetSample(vsample, position + 1) * voice->gain);
-				voice->position += (f32)vsample->frequency * advance;
+				u32 mixed = 0;
+				if(loudness < quiet) {
+					mixed = skipSampleVoice(voice, count, step);
+					skipped++;
+				} else if(voice->rolloff != wMixer_RolloffNone) {
+					mixed = mixSampleVoice(mixer, voice, count, step);
+					accumulateRamp(bus->left, mixer->voiceLeft, mixed, 
+							voice->lastLeft, (left - voice->lastLeft) / count);
+					accumulateRamp(bus->right, mixer->voiceLeft, mixed, 
+							voice->lastRight, (right - voice->lastRight) / count);
+				} else {
+					mixed = mixSampleVoice(mixer, voice, count, step);
+					accumulateVoice(bus->left, mixer->voiceLeft, mixed,
+							voice->gain, 0.5f - voice->pan);
+					accumulateVoice(bus->right, mixer->voiceLeft, mixed,
+							voice->gain, 0.5f + voice->pan);
+				}
+				if(voice->rolloff != wMixer_RolloffNone) {
+					voice->lastLeft = left;
+					voice->lastRight = right;
+				}
+				if(mixed < count) {
+					stmFinishVoice(mixer, i);
+				}
+			} else if(voice->state == wMixer_VoiceStreaming) {
+				u32 mixed = mixStreamVoice(mixer, voice, count);
+				accumulateVoice(bus->left, mixer->voiceLeft, mixed,
+						voice->gain, 1.0f);
+				accumulateVoice(bus->right, mixer->voiceRight, mixed,
+						voice->gain, 1.0f);
+				if(mixed < count) {
+					stmFinishVoice(mixer, i);
+				}
 			}
+			i = next;
+		}
+
+		// Children always come after their parents
+		for(i32 b = busCount - 1; b > 0; --b) {
+			wMixerBus* bus = mixer->buses + b;
+			wMixerBus* parent = mixer->buses + bus->parent;
+			stmRunEffects(mixer, bus, count);
+			accumulateVoice(parent->left, bus->left, count, bus->gain, 1.0f);
+			accumulateVoice(parent->right, bus->right, count, bus->gain, 1.0f);
 		}
+		stmRunEffects(mixer, mixer->buses, count);
+
+		writeMixerBlock(mixer, mixer->buses, out, count);
+		mixer->virtualVoices = skipped;
+		out += count * 2;
+		remaining -= count;
+	}
 
-		// write to buffer
-		left = stmClamp1(left);
-		right = stmClamp1(right);
-		*out_float++ = left;
-		*out_float++ = right;
+	if(samples > 0) {
+		f64 elapsed = wGetTime() - start;
+		mixer->cpuLoad = (f32)(elapsed * (f64)mixer->frequency / (f64)samples);
 	}
+	_mm_setcsr(csr);
 }
@@ -1,3 +1,75 @@
+/* GL state cache
+ * Everything in here that binds programs, blend modes, or textures goes
+ * through these so redundant calls can be skipped (and counted). If you
+ * touch that state with raw GL calls, call wInvalidateRenderState after.
+ */
+static u32 boundProgram = 0xFFFFFFFF;
+static i32 boundBlend = -1;
+static u32 boundTexture = 0xFFFFFFFF;
+static wRenderStats renderStats;
+
+void wInvalidateRenderState()
+{
+	boundProgram = 0xFFFFFFFF;
+	boundBlend = -1;
+	boundTexture = 0xFFFFFFFF;
+}
+
+void wGetRenderStats(wRenderStats* stats, i32 reset)
+{
+	if(stats) {
+		*stats = renderStats;
+	}
+	if(reset) {
+		memset(&renderStats, 0, sizeof(wRenderStats));
+	}
+}
+
+static
+void useProgram(u32 program)
+{
+	if(program == boundProgram) {
+		renderStats.programBindsSkipped++;
+		return;
+	}
+	glUseProgram(program);
+	boundProgram = program;
+	renderStats.programBinds++;
+}
+
+static
+void setBlend(i32 blend)
+{
+	if(blend == boundBlend) {
+		renderStats.blendChangesSkipped++;
+		return;
+	}
+
+	if(blend == wRenderBatch_BlendNormal) {
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	} else if(blend == wRenderBatch_BlendPremultiplied) {
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	} else if(blend == wRenderBatch_BlendNone) {
+		glDisable(GL_BLEND);
+	}
+	boundBlend = blend;
+	renderStats.blendChanges++;
+}
+
+static
+void bindTexture(u32 texture)
+{
+	if(texture == boundTexture) {
+		renderStats.textureBindsSkipped++;
+		return;
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	boundTexture = texture;
+	renderStats.textureBinds++;
+}
+
 void wInitShader(wShader* shader, i32 stride)
 {
 	shader->vert = 0;
@@ -8,6 +80,7 @@ void wInitShader(wShader* shader, i32 stride)
 	shader->stride = stride;
 	shader->attribCount = 0;
 	shader->uniformCount = 0;
+	shader->uniformShadowValid = 0;
 }
 
 i32 wAddAttribToShader(wShader* shader, wShaderComponent* attrib)
@@ -100,14 +173,15 @@ i32 wFinalizeShader(wShader* shader)
 		return 0;
 	}
 
-	glUseProgram(shader->program);
+	useProgram(shader->program);
 
+	shader->uniformShadowValid = 0;
 	for(isize i = 0; i < shader->uniformCount; ++i) {
 		shader->uniforms[i].loc = glGetUniformLocation(
 				shader->program, shader->uniforms[i].name);
 	}
 
-	glUseProgram(0);
+	useProgram(0);
 	return 1;
 }
 
@@ -203,18 +277,9 @@ u32 transformOpenGLTypes(u32 in)
 	}
 }
 
-void wConstructBatchGraphicsState(wRenderBatch* batch)
+static
+void setBatchAttribPointers(wShader* shader, usize offset)
 {
-	wShader* shader = batch->shader;
-	glUseProgram(shader->program);
-	if(shader->targetVersion > 21) {
-		glGenVertexArrays(1, &batch->vao);
-		glBindVertexArray(batch->vao);
-	}
-
-	glGenBuffers(1, &batch->vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
-
 	i32 attribTypes[] = {
 		GL_FLOAT, GL_DOUBLE, 
 		GL_INT, GL_SHORT, GL_UNSIGNED_BYTE,
@@ -225,15 +290,12 @@ void wConstructBatchGraphicsState(wRenderBatch* batch)
 
 	for(isize i = 0; i < shader->attribCount; ++i) {
 		wShaderComponent* c = shader->attribs + i;
-		printf("%s %d %d\n", c->name, c->loc, glGetAttribLocation(shader->program, c->name));
 		i32 isNormalized = 0;
 #if WPL_EMSCRIPTEN
 		u32 type = transformOpenGLTypes(c->type);
 #else
 		u32 type = attribTypes[c->type - wShader_Float];
 #endif
-		glEnableVertexAttribArray(c->loc);
-		if(glVertexAttribDivisor) glVertexAttribDivisor(c->loc, c->divisor);
 		switch(c->type) {
 			case wShader_NormalizedInt:
 			case wShader_NormalizedShort:
@@ -251,7 +313,7 @@ void wConstructBatchGraphicsState(wRenderBatch* batch)
 						type,
 						isNormalized,
 						shader->stride,
-						(void*)c->ptr);
+						(void*)(offset + c->ptr));
 				break;
 			case wShader_Int:
 			case wShader_Short:
@@ -261,20 +323,277 @@ void wConstructBatchGraphicsState(wRenderBatch* batch)
 						c->count,
 						type,
 						shader->stride,
-						(void*)c->ptr);
+						(void*)(offset + c->ptr));
 				break;
 			default:
 				break;
 		}
 	}
+}
+
+void wConstructBatchGraphicsState(wRenderBatch* batch)
+{
+	wShader* shader = batch->shader;
+	useProgram(shader->program);
+	if(shader->targetVersion > 21) {
+		glGenVertexArrays(1, &batch->vao);
+		glBindVertexArray(batch->vao);
+	}
+
+	glGenBuffers(1, &batch->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+
+	for(isize i = 0; i < shader->attribCount; ++i) {
+		wShaderComponent* c = shader->attribs + i;
+		printf("%s %d %d\n", c->name, c->loc, glGetAttribLocation(shader->program, c->name));
+		glEnableVertexAttribArray(c->loc);
+		if(glVertexAttribDivisor) glVertexAttribDivisor(c->loc, c->divisor);
+	}
+	setBatchAttribPointers(shader, 0);
 
 	if(batch->shader->targetVersion > 21) {
 		glBindVertexArray(0);
 	}
 }
 
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+/* Switches the batch from re-specifying its vbo with glBufferData every
+ * draw to appending into a ring of RenderBatch_StreamRegions regions,
+ * each holding capacity elements. Uses persistent mapping where
+ * glBufferStorage is available, unsynchronized glMapBufferRange otherwise,
+ * and stays on the orphaning path if neither (or fences) are present.
+ *
+ * Call after wConstructBatchGraphicsState. Returns the upload mode used.
+ */
+i32 wEnableBatchStreaming(wRenderBatch* batch, isize capacity)
+{
+	batch->uploadMode = wRenderBatch_UploadOrphan;
+	if(capacity <= 0 || !glMapBufferRange || !glUnmapBuffer ||
+			!glFenceSync || !glClientWaitSync || !glDeleteSync) {
+		return batch->uploadMode;
+	}
+
+	isize size = capacity * batch->elementSize * RenderBatch_StreamRegions;
+	batch->streamCapacity = capacity;
+	batch->streamRegion = 0;
+	batch->streamHead = 0;
+	batch->streamMap = NULL;
+	for(isize i = 0; i < RenderBatch_StreamRegions; ++i) {
+		batch->streamFences[i] = NULL;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+#ifdef WB_GL_USE_MODERN
+	if(glBufferStorage) {
+		u32 flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+		batch->streamMap = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+		if(batch->streamMap) {
+			batch->uploadMode = wRenderBatch_UploadPersistent;
+			return batch->uploadMode;
+		}
+
+		// Storage is immutable once specified; start over with a fresh buffer
+		glDeleteBuffers(1, &batch->vbo);
+		glGenBuffers(1, &batch->vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+	}
+#endif
+
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+	batch->uploadMode = wRenderBatch_UploadUnsynchronized;
+	return batch->uploadMode;
+}
+
+/* Copies count elements into the ring and returns their byte offset in
+ * the vbo. Expects the vbo to be bound and count <= streamCapacity.
+ */
+static
+usize streamBatchRange(wRenderBatch* batch, void* data, isize count)
+{
+	isize size = count * batch->elementSize;
+	isize regionSize = batch->streamCapacity * batch->elementSize;
+	isize regionEnd = (batch->streamRegion + 1) * regionSize;
 
+	if(batch->streamHead + size > regionEnd) {
+		batch->streamFences[batch->streamRegion] = glFenceSync(
+				GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		batch->streamRegion = (batch->streamRegion + 1) % RenderBatch_StreamRegions;
+		batch->streamHead = batch->streamRegion * regionSize;
 
+		void* fence = batch->streamFences[batch->streamRegion];
+		if(fence) {
+			u32 result;
+			do {
+				result = glClientWaitSync(fence, 
+						GL_SYNC_FLUSH_COMMANDS_BIT, 
+						1000000);
+			} while(result == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(fence);
+			batch->streamFences[batch->streamRegion] = NULL;
+		}
+	}
+
+	usize offset = batch->streamHead;
+	if(batch->uploadMode == wRenderBatch_UploadPersistent) {
+		memcpy((u8*)batch->streamMap + offset, data, size);
+	} else {
+		void* dest = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, 
+				GL_MAP_WRITE_BIT | 
+				GL_MAP_UNSYNCHRONIZED_BIT | 
+				GL_MAP_INVALIDATE_RANGE_BIT);
+		if(dest) {
+			memcpy(dest, data, size);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		}
+	}
+	batch->streamHead += size;
+	renderStats.bytesUploaded += size;
+	return offset;
+}
+
+/* Makes the batch a retained layer. data has to hold capacity elements;
+ * they're uploaded once into a GL_STATIC_DRAW vbo, and after that only
+ * ranges passed to wMarkBatchDirty are sent again. startOffset and
+ * elementCount pick the sub-range to draw (in instances, for
+ * ArraysInstanced batches).
+ *
+ * Use instead of wEnableBatchStreaming, after wConstructBatchGraphicsState.
+ */
+i32 wEnableBatchStatic(wRenderBatch* batch, isize capacity)
+{
+	if(capacity <= 0) return 0;
+	batch->uploadMode = wRenderBatch_UploadStatic;
+	batch->staticCapacity = capacity;
+	batch->dirtyCount = 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+	glBufferData(GL_ARRAY_BUFFER, 
+			capacity * batch->elementSize, 
+			NULL, 
+			GL_STATIC_DRAW);
+	wMarkBatchDirty(batch, 0, capacity);
+	return 1;
+}
+
+void wMarkBatchDirty(wRenderBatch* batch, isize start, isize count)
+{
+	isize end = start + count;
+	if(start < 0) start = 0;
+	if(end > batch->staticCapacity) end = batch->staticCapacity;
+	if(start >= end) return;
+
+	// Insert in order, swallowing anything the new range overlaps or touches
+	isize ranges[RenderBatch_MaxDirtyRanges + 1][2];
+	isize rangeCount = 0;
+	i32 inserted = 0;
+	for(isize i = 0; i < batch->dirtyCount; ++i) {
+		isize rs = batch->dirtyRanges[i][0];
+		isize re = batch->dirtyRanges[i][1];
+		if(re < start) {
+			ranges[rangeCount][0] = rs;
+			ranges[rangeCount++][1] = re;
+		} else if(rs > end) {
+			if(!inserted) {
+				ranges[rangeCount][0] = start;
+				ranges[rangeCount++][1] = end;
+				inserted = 1;
+			}
+			ranges[rangeCount][0] = rs;
+			ranges[rangeCount++][1] = re;
+		} else {
+			if(rs < start) start = rs;
+			if(re > end) end = re;
+		}
+	}
+	if(!inserted) {
+		ranges[rangeCount][0] = start;
+		ranges[rangeCount++][1] = end;
+	}
+
+	// Out of slots: close the smallest gap. Uploads a few clean elements,
+	// but saves a glBufferSubData call.
+	if(rangeCount > RenderBatch_MaxDirtyRanges) {
+		isize best = 0;
+		for(isize i = 1; i < rangeCount - 1; ++i) {
+			if(ranges[i + 1][0] - ranges[i][1] < 
+					ranges[best + 1][0] - ranges[best][1]) {
+				best = i;
+			}
+		}
+		ranges[best][1] = ranges[best + 1][1];
+		for(isize i = best + 1; i < rangeCount - 1; ++i) {
+			ranges[i][0] = ranges[i + 1][0];
+			ranges[i][1] = ranges[i + 1][1];
+		}
+		rangeCount--;
+	}
+
+	memcpy(batch->dirtyRanges, ranges, sizeof(isize) * 2 * rangeCount);
+	batch->dirtyCount = rangeCount;
+}
+
+/* Expects the vbo to be bound */
+static
+void uploadDirtyRanges(wRenderBatch* batch)
+{
+	for(isize i = 0; i < batch->dirtyCount; ++i) {
+		isize start = batch->dirtyRanges[i][0] * batch->elementSize;
+		isize size = batch->dirtyRanges[i][1] * batch->elementSize - start;
+		glBufferSubData(GL_ARRAY_BUFFER, start, size, (u8*)batch->data + start);
+		renderStats.bytesUploaded += size;
+	}
+	batch->dirtyCount = 0;
+}
+
+static
+void drawBatchRange(wRenderBatch* batch, u32 primitive, isize first, isize count)
+{
+	switch(batch->renderCall) {
+		case wRenderBatch_Arrays:
+			glDrawArrays(primitive, first, count);
+			break;
+		case wRenderBatch_Elements:
+			glDrawElements(primitive, count, GL_UNSIGNED_INT, 
+					(void*)(first * sizeof(u32)));
+			break;
+		case wRenderBatch_ArraysInstanced:
+			glDrawArraysInstanced(
+					primitive, 
+					first,
+					batch->instanceSize, 
+					count);
+			break;
+		case wRenderBatch_ElementsInstanced:
+			glDrawElementsInstanced(primitive,
+					count,
+					GL_UNSIGNED_INT,
+					(void*)(first * sizeof(u32)),
+					batch->instanceSize);
+			break;
+		default:
+			break;
+	}
+}
+
+// Indexed by type - wShader_Float; types with no entry aren't uploaded
+static
+i32 uniformType[] = {
+	wShader_Float, 0,
+	wShader_Int, 0, 0, 0, 0, 0, 0, 0, 0,
+	wShader_Mat22, wShader_Mat33, wShader_Mat44
+};
+
+static
+i32 uniformSize[] = {
+	4, 0,
+	4, 0, 0, 0, 0, 0, 0, 0, 0,
+	16, 36, 64
+};
 
 void wDrawBatch(wState* state, wRenderBatch* batch, void* uniformData)
 {
@@ -287,33 +606,33 @@ void wDrawBatch(wState* state, wRenderBatch* batch, void* uniformData)
 	// very simple blending at that.
 	
 	wShader* shader = batch->shader;
-	glUseProgram(shader->program);
-
-	if(batch->blend == wRenderBatch_BlendNormal) {
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	} else if(batch->blend == wRenderBatch_BlendPremultiplied) {
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-	} else if(batch->blend == wRenderBatch_BlendNone) {
-		glDisable(GL_BLEND);
-	}
+	useProgram(shader->program);
+	setBlend(batch->blend);
 
 	if(uniformData) {
-		i32 uniformType[] = {
-			wShader_Float, 0,
-			wShader_Int, 0, 0, 0, 0, 0, 0, 0, 0,
-			wShader_Mat22, wShader_Mat33, wShader_Mat44
-		};
-
 		for(isize i = 0; i < shader->uniformCount; ++i) {
 			wShaderComponent* c = shader->uniforms + i;
 			u32 type = uniformType[c->type - wShader_Float];
 			f32* uptrf = (f32*)((usize)uniformData + c->ptr);
 			i32* uptri = (i32*)((usize)uniformData + c->ptr);
+			if(type == 0) continue;
+
+			// Values live in the program object, so if this one hasn't
+			// changed since we last sent it there's nothing to do
+			isize size = uniformSize[c->type - wShader_Float] * c->count;
+			if(size <= Shader_UniformShadowSize) {
+				u8* shadow = shader->uniformShadow[i];
+				if((shader->uniformShadowValid & (1u << i)) && 
+						memcmp(shadow, uptrf, size) == 0) {
+					renderStats.uniformsSkipped++;
+					continue;
+				}
+				memcpy(shadow, uptrf, size);
+				shader->uniformShadowValid |= 1u << i;
+			}
+			renderStats.uniformsUploaded++;
+
 			switch(type) {
-				case 0:
-					break;
 				case wShader_Float:
 					switch(c->count) {
 						case 1:
@@ -380,10 +699,27 @@ void wDrawBatch(wState* state, wRenderBatch* batch, void* uniformData)
 	}
 
 	glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
-	glBufferData(GL_ARRAY_BUFFER, 
-			batch->elementSize * batch->elementCount,
-			batch->data,
-			hint);
+	if(batch->uploadMode == wRenderBatch_UploadOrphan) {
+		glBufferData(GL_ARRAY_BUFFER,
+				batch->elementSize * batch->elementCount,
+				batch->data,
+				hint);
+		renderStats.bytesUploaded += batch->elementSize * batch->elementCount;
+	}
+
+	// Without a VAO the attribute arrays are global state, so another
+	// batch may have pointed them somewhere else since construct
+	if(!batch->vao) {
+		for(isize i = 0; i < shader->attribCount; ++i) {
+			wShaderComponent* c = shader->attribs + i;
+			glEnableVertexAttribArray(c->loc);
+			if(glVertexAttribDivisor) glVertexAttribDivisor(c->loc, c->divisor);
+		}
+		if(batch->uploadMode == wRenderBatch_UploadOrphan ||
+				batch->uploadMode == wRenderBatch_UploadStatic) {
+			setBatchAttribPointers(shader, 0);
+		}
+	}
 
 	if( 	batch->renderCall == wRenderBatch_Elements || 
 			batch->renderCall == wRenderBatch_ElementsInstanced) {
@@ -392,7 +728,8 @@ void wDrawBatch(wState* state, wRenderBatch* batch, void* uniformData)
 				batch->indices,
 				hint);
 	}
-	glBindTexture(GL_TEXTURE_2D, batch->texture->glIndex);
+	bindTexture(batch->texture->glIndex);
+	renderStats.draws++;
 
 	u32 primitive;
 	switch(batch->primitiveMode) {
@@ -418,30 +755,51 @@ void wDrawBatch(wState* state, wRenderBatch* batch, void* uniformData)
 			primitive = GL_TRIANGLES;
 	}
 
-	switch(batch->renderCall) {
-		case wRenderBatch_Arrays:
-			glDrawArrays(primitive, batch->startOffset, batch->elementCount);
-			break;
-		case wRenderBatch_Elements:
-			glDrawElements(primitive, batch->elementCount, GL_UNSIGNED_INT, 
-					(void*)(batch->startOffset * sizeof(u32)));
-			break;
-		case wRenderBatch_ArraysInstanced:
-			glDrawArraysInstanced(
-					primitive, 
-					batch->startOffset,
-					batch->instanceSize, 
-					batch->elementCount);
-			break;
-		case wRenderBatch_ElementsInstanced:
-			glDrawElementsInstanced(primitive,
-					batch->elementCount,
-					GL_UNSIGNED_INT,
-					(void*)(batch->startOffset * sizeof(u32)),
-					batch->instanceSize);
-			break;
-		default:
-			break;
+	if(batch->uploadMode == wRenderBatch_UploadOrphan) {
+		drawBatchRange(batch, primitive, batch->startOffset, batch->elementCount);
+	} else if(batch->uploadMode == wRenderBatch_UploadStatic) {
+		uploadDirtyRanges(batch);
+		isize first = batch->startOffset;
+		isize count = batch->elementCount;
+		if(first < 0) first = 0;
+		if(first + count > batch->staticCapacity) {
+			count = batch->staticCapacity - first;
+		}
+
+		// No base instance before GL 4.2, so point the attributes at the
+		// first instance instead
+		if(batch->renderCall == wRenderBatch_ArraysInstanced) {
+			setBatchAttribPointers(shader, first * batch->elementSize);
+			first = 0;
+		}
+		if(count > 0) {
+			drawBatchRange(batch, primitive, first, count);
+		}
+	} else {
+		// Instances are independent, so big instanced batches can be
+		// split across several ring allocations. Anything else has to
+		// fit in one region.
+		i32 canSplit = 
+			batch->renderCall == wRenderBatch_ArraysInstanced ||
+			batch->renderCall == wRenderBatch_ElementsInstanced;
+		isize remaining = batch->elementCount;
+		u8* data = batch->data;
+		if(!canSplit && remaining > batch->streamCapacity) {
+			wLogError(0, "Error: streamed batch of %d elements "
+					"exceeds capacity %d\n", 
+					(i32)remaining, (i32)batch->streamCapacity);
+			remaining = batch->streamCapacity;
+		}
+
+		while(remaining > 0) {
+			isize count = remaining;
+			if(count > batch->streamCapacity) count = batch->streamCapacity;
+			usize offset = streamBatchRange(batch, data, count);
+			setBatchAttribPointers(shader, offset);
+			drawBatchRange(batch, primitive, batch->startOffset, count);
+			data += count * batch->elementSize;
+			remaining -= count;
+		}
 	}
 	
 	if(batch->clearOnDraw) {
@@ -452,10 +810,194 @@ void wDrawBatch(wState* state, wRenderBatch* batch, void* uniformData)
 	}
 }
 
+/* Render queue
+ * Batches are queued with a sort key instead of drawn immediately, then
+ * wFlushRenderQueue radix sorts them and draws in key order. Adjacent
+ * instanced draws with identical state are concatenated into the staging
+ * buffer and issued as one draw. Uniforms are compared by value, so
+ * commands merge whenever the values they'd upload match.
+ *
+ * A queued command keeps the batch's data pointer, element count and
+ * start offset from when it was queued, and uniformData is read at flush
+ * time, so the data and the uniforms need to stay alive (and unchanged)
+ * until then.
+ */
+void wInitRenderQueue(wRenderQueue* queue, 
+		isize capacity, isize stagingSize, 
+		wMemoryArena* arena)
+{
+	memset(queue, 0, sizeof(wRenderQueue));
+	queue->capacity = capacity;
+	queue->commands = wArenaPush(arena, sizeof(wRenderCommand) * capacity);
+	queue->sortBuffer = wArenaPush(arena, sizeof(wRenderCommand) * capacity);
+	queue->stagingSize = stagingSize;
+	if(stagingSize > 0) {
+		queue->staging = wArenaPush(arena, stagingSize);
+	}
+}
+
+u64 wMakeSortKey(wRenderBatch* batch, u32 layer, u32 depth)
+{
+	u64 key = 0;
+	key |= (u64)(layer & 0xFF) << RenderKey_LayerShift;
+	key |= (u64)(batch->shader->program & 0x3FF) << RenderKey_ProgramShift;
+	key |= (u64)(batch->blend & 0x3) << RenderKey_BlendShift;
+	key |= (u64)(batch->texture->glIndex & 0x3FFF) << RenderKey_TextureShift;
+	key |= (u64)(depth & 0xFFFFFF) << RenderKey_DepthShift;
+	return key;
+}
+
+void wQueueBatch(wState* state, wRenderQueue* queue, 
+		wRenderBatch* batch, void* uniformData, u64 key)
+{
+	if(batch->elementCount <= 0) return;
+	if(queue->count >= queue->capacity) {
+		wFlushRenderQueue(state, queue);
+	}
+
+	wRenderCommand* c = queue->commands + queue->count++;
+	c->key = key;
+	c->batch = batch;
+	c->data = batch->data;
+	c->elementCount = batch->elementCount;
+	c->startOffset = batch->startOffset;
+	c->uniformData = uniformData;
+	queue->queuedDraws++;
+
+	if(batch->clearOnDraw) {
+		batch->elementCount = 0;
+	}
+}
+
+/* LSD radix sort, a byte at a time. It's stable, so commands with equal
+ * keys keep the order they were queued in. Passes where every key has
+ * the same byte are skipped, which is most of them in practice.
+ */
+static
+void sortRenderCommands(wRenderCommand* commands, wRenderCommand* temp, isize count)
+{
+	wRenderCommand *src = commands, *dst = temp;
+	for(i32 shift = 0; shift < 64; shift += 8) {
+		isize offsets[256] = {0};
+		for(isize i = 0; i < count; ++i) {
+			offsets[(src[i].key >> shift) & 0xFF]++;
+		}
+		if(offsets[(src[0].key >> shift) & 0xFF] == count) continue;
+
+		isize total = 0;
+		for(isize i = 0; i < 256; ++i) {
+			isize c = offsets[i];
+			offsets[i] = total;
+			total += c;
+		}
+
+		for(isize i = 0; i < count; ++i) {
+			dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+		}
+
+		wRenderCommand* t = src;
+		src = dst;
+		dst = t;
+	}
+
+	if(src != commands) {
+		memcpy(commands, src, sizeof(wRenderCommand) * count);
+	}
+}
+
+/* Compares the values wDrawBatch would upload, not the pointers, so
+ * draws from different batches (or copies of the same uniforms) with the
+ * same view still merge */
+static
+i32 sameUniforms(wShader* shader, u8* a, u8* b)
+{
+	if(a == b) return 1;
+	if(!a || !b) return 0;
+	for(isize i = 0; i < shader->uniformCount; ++i) {
+		wShaderComponent* c = shader->uniforms + i;
+		if(uniformType[c->type - wShader_Float] == 0) continue;
+		isize size = uniformSize[c->type - wShader_Float] * c->count;
+		if(memcmp(a + c->ptr, b + c->ptr, size) != 0) return 0;
+	}
+	return 1;
+}
+
+static
+i32 canMergeCommands(wRenderCommand* a, wRenderCommand* b)
+{
+	wRenderBatch* x = a->batch;
+	wRenderBatch* y = b->batch;
+	return x->shader == y->shader &&
+		x->texture->glIndex == y->texture->glIndex &&
+		x->blend == y->blend &&
+		x->renderCall == y->renderCall &&
+		x->primitiveMode == y->primitiveMode &&
+		x->instanceSize == y->instanceSize &&
+		x->elementSize == y->elementSize &&
+		a->startOffset == b->startOffset &&
+		sameUniforms(x->shader, a->uniformData, b->uniformData);
+}
+
+void wFlushRenderQueue(wState* state, wRenderQueue* queue)
+{
+	if(queue->count == 0) return;
+	sortRenderCommands(queue->commands, queue->sortBuffer, queue->count);
+
+	for(isize i = 0; i < queue->count;) {
+		wRenderCommand* c = queue->commands + i;
+		wRenderBatch* batch = c->batch;
+		void* data = c->data;
+		isize count = c->elementCount;
+		isize next = i + 1;
+
+		// Static batches already have their data on the GPU
+		if(batch->renderCall == wRenderBatch_ArraysInstanced && 
+				batch->uploadMode != wRenderBatch_UploadStatic &&
+				queue->staging) {
+			isize size = count * batch->elementSize;
+			while(next < queue->count && 
+					canMergeCommands(c, queue->commands + next) && 
+					size + queue->commands[next].elementCount * 
+					batch->elementSize <= queue->stagingSize) {
+				size += queue->commands[next].elementCount * batch->elementSize;
+				next++;
+			}
+
+			if(next - i > 1) {
+				u8* head = queue->staging;
+				for(isize j = i; j < next; ++j) {
+					wRenderCommand* m = queue->commands + j;
+					isize msize = m->elementCount * batch->elementSize;
+					memcpy(head, m->data, msize);
+					head += msize;
+				}
+				data = queue->staging;
+				count = size / batch->elementSize;
+			}
+		}
+
+		void* oldData = batch->data;
+		isize oldCount = batch->elementCount;
+		isize oldOffset = batch->startOffset;
+		batch->data = data;
+		batch->elementCount = count;
+		batch->startOffset = c->startOffset;
+		wDrawBatch(state, batch, c->uniformData);
+		batch->data = oldData;
+		batch->elementCount = oldCount;
+		batch->startOffset = oldOffset;
+
+		queue->issuedDraws++;
+		i = next;
+	}
+
+	queue->count = 0;
+}
+
 void wUploadTexture(wTexture* texture)
 {
 	glGenTextures(1, &texture->glIndex);
-	glBindTexture(GL_TEXTURE_2D, texture->glIndex);
+	bindTexture(texture->glIndex);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -468,7 +1010,7 @@ void wUploadTexture(wTexture* texture)
 			GL_RGBA, GL_UNSIGNED_BYTE, 
 			texture->pixels);
 	glGenerateMipmap(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	bindTexture(0);
 }
 
 #ifndef WPL_EMSCRIPTEN
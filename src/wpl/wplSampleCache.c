@@ -0,0 +1,363 @@
+/* wplSampleCache.c
+ *
+ * Loads WAV sound effects once, by name, and keeps them within a memory
+ * budget. Whatever the file is, it comes out as one channel at the
+ * mixer's rate, so nothing gets converted while mixing except int16 to
+ * float, and that only with SampleCache_Int16, which halves the memory.
+ *
+ *   wInitSampleCache(&cache, mixer, window, 16 << 20, 256, 0, arena);
+ *   wMixerSample* jump = wLoadCachedSample(&cache, "jump.wav");
+ *   wMixerPlaySample(mixer, jump, 1.0f, 1.0f, 0.0f);
+ *   ...
+ *   wReleaseCachedSample(&cache, jump);
+ *
+ * A sample stays put while anyone holds it or it's playing. Released
+ * samples stay loaded too, until the budget is needed for something else.
+ * Loading it again gives back the same wMixerSample either way.
+ */
+
+#define DR_WAV_IMPLEMENTATION
+#define DR_WAV_NO_STDIO
+#define DRWAV_ASSERT(x)
+#include "thirdparty/dr_wav.h"
+
+void wInitSampleCache(wSampleCache* cache, wMixer* mixer, wWindow* window,
+		isize budget, isize capacity, i32 flags, wMemoryArena* arena)
+{
+	memset(cache, 0, sizeof(wSampleCache));
+	cache->mixer = mixer;
+	cache->window = window;
+	cache->flags = flags;
+	cache->tempArena = wArenaBootstrap(wGetMemoryInfo(),
+			Arena_NoRecommit | Arena_NoZeroMemory);
+
+	cache->entries = wArenaPush(arena, sizeof(wCachedSample) * capacity);
+	cache->capacity = capacity;
+	i32 tableSize = stmRoundUpPow2(capacity * 2);
+	cache->table = wArenaPush(arena, sizeof(i32) * tableSize);
+	cache->tableMask = tableSize - 1;
+	for(i32 i = 0; i < tableSize; ++i) {
+		cache->table[i] = -1;
+	}
+	cache->lruHead = -1;
+	cache->lruTail = -1;
+
+	// Blocks are 16 byte aligned, header included
+	budget &= ~(isize)15;
+	u8* memory = wArenaPush(arena, budget + 16);
+	cache->memory = (u8*)(((usize)memory + 15) & ~(usize)15);
+	cache->budget = budget;
+	cache->freeList = NULL;
+	if(budget >= (isize)sizeof(wSampleBlock)) {
+		cache->freeList = (wSampleBlock*)cache->memory;
+		cache->freeList->size = budget;
+		cache->freeList->next = NULL;
+	}
+}
+
+/* First fit, splitting off the end of the block so the list doesn't
+ * change unless it's used up.
+ */
+static
+void* sampleCacheAlloc(wSampleCache* cache, isize size)
+{
+	size = (size + sizeof(wSampleBlock) + 15) & ~(isize)15;
+	wSampleBlock** link = &cache->freeList;
+	while(*link) {
+		wSampleBlock* block = *link;
+		if(block->size >= size) {
+			if(block->size - size >= 64) {
+				block->size -= size;
+				block = (wSampleBlock*)((u8*)block + block->size);
+				block->size = size;
+			} else {
+				*link = block->next;
+			}
+			cache->used += block->size;
+			return block + 1;
+		}
+		link = &block->next;
+	}
+	return NULL;
+}
+
+// The free list is kept in address order so neighbours can merge
+static
+void sampleCacheFree(wSampleCache* cache, void* ptr)
+{
+	wSampleBlock* block = (wSampleBlock*)ptr - 1;
+	cache->used -= block->size;
+
+	wSampleBlock* prev = NULL;
+	wSampleBlock* next = cache->freeList;
+	while(next && next < block) {
+		prev = next;
+		next = next->next;
+	}
+
+	block->next = next;
+	if(next && (u8*)block + block->size == (u8*)next) {
+		block->size += next->size;
+		block->next = next->next;
+	}
+	if(prev) {
+		prev->next = block;
+		if((u8*)prev + prev->size == (u8*)block) {
+			prev->size += block->size;
+			prev->next = block->next;
+		}
+	} else {
+		cache->freeList = block;
+	}
+}
+
+static
+void unlinkCachedSample(wSampleCache* cache, i32 index)
+{
+	wCachedSample* entry = cache->entries + index;
+	if(entry->prev >= 0) {
+		cache->entries[entry->prev].next = entry->next;
+	} else {
+		cache->lruHead = entry->next;
+	}
+	if(entry->next >= 0) {
+		cache->entries[entry->next].prev = entry->prev;
+	} else {
+		cache->lruTail = entry->prev;
+	}
+	entry->prev = -1;
+	entry->next = -1;
+}
+
+static
+void touchCachedSample(wSampleCache* cache, i32 index)
+{
+	wCachedSample* entry = cache->entries + index;
+	if(cache->lruHead == index) return;
+	// Anything else on the list has something in front of it
+	if(entry->prev >= 0) {
+		unlinkCachedSample(cache, index);
+	}
+	entry->prev = -1;
+	entry->next = cache->lruHead;
+	if(cache->lruHead >= 0) {
+		cache->entries[cache->lruHead].prev = index;
+	} else {
+		cache->lruTail = index;
+	}
+	cache->lruHead = index;
+}
+
+/* A stolen voice is only stopped once the audio thread gets to the
+ * stop, so a sample nothing is playing can still be getting mixed.
+ */
+static
+i32 canEvictCachedSample(wSampleCache* cache, wCachedSample* entry)
+{
+	if(entry->refs > 0 || entry->sample.instances > 0) {
+		return 0;
+	}
+	i32 tail = wAtomicLoad(&cache->mixer->commandTail);
+	return (i32)((u32)tail - (u32)entry->sample.lastCommand) >= 0;
+}
+
+// Evicts the least recently used sample that can go
+static
+i32 evictCachedSample(wSampleCache* cache)
+{
+	stmReapVoices(cache->mixer);
+	for(i32 i = cache->lruTail; i >= 0; i = cache->entries[i].prev) {
+		wCachedSample* entry = cache->entries + i;
+		if(!canEvictCachedSample(cache, entry)) {
+			continue;
+		}
+		unlinkCachedSample(cache, i);
+		sampleCacheFree(cache, entry->block);
+		entry->block = NULL;
+		entry->size = 0;
+		entry->sample.data = NULL;
+		entry->sample.length = 0;
+		cache->evictions++;
+		return 1;
+	}
+	return 0;
+}
+
+/* Decodes a WAV, mixes it down to mono, and resamples it to the mixer's
+ * rate with the mixer's sinc filter. All the scratch is in the temp
+ * arena; only the result goes in the budget.
+ */
+static
+i32 decodeCachedSample(wSampleCache* cache, wCachedSample* entry,
+		void* data, isize size, string name)
+{
+	wMemoryArena* temp = cache->tempArena;
+	drwav wav;
+	if(!drwav_init_memory(&wav, data, size)) {
+		wLogError(0, "Error: %s isn't a WAV file dr_wav can read\n", name);
+		return 0;
+	}
+	i32 channels = wav.channels;
+	u32 rate = wav.sampleRate;
+	if(channels <= 0 || rate == 0) {
+		drwav_uninit(&wav);
+		wLogError(0, "Error: %s has no audio in it\n", name);
+		return 0;
+	}
+	u64 frames = wav.totalSampleCount / channels;
+	f32* samples = wArenaPush(temp, sizeof(f32) * frames * channels);
+	frames = drwav_read_f32(&wav, frames * channels, samples) / channels;
+	drwav_uninit(&wav);
+
+	if(channels > 1) {
+		f32 scale = 1.0f / (f32)channels;
+		for(u64 i = 0; i < frames; ++i) {
+			f32 sum = 0.0f;
+			for(i32 c = 0; c < channels; ++c) {
+				sum += samples[i * channels + c];
+			}
+			samples[i] = sum * scale;
+		}
+	}
+
+	u32 frequency = cache->mixer->frequency;
+	if(rate != frequency && frames > 0) {
+		u64 step = ((u64)rate << 32) / frequency;
+		u64 outFrames = (frames * frequency + rate - 1) / rate;
+		f32* resampled = wArenaPush(temp, sizeof(f32) * outFrames);
+		wMixerSample source = {0};
+		source.length = (u32)frames;
+		source.data = samples;
+		u64 position = 0;
+		frames = stmResample(&source, wMixer_InterpSinc, &position, step,
+				resampled, (u32)outFrames);
+		samples = resampled;
+	}
+
+	i32 useS16 = cache->flags & SampleCache_Int16;
+	isize bytes = (isize)frames * (useS16 ? sizeof(i16) : sizeof(f32));
+	void* block = sampleCacheAlloc(cache, bytes);
+	while(!block && evictCachedSample(cache)) {
+		block = sampleCacheAlloc(cache, bytes);
+	}
+	if(!block) {
+		wLogError(0, "Error: no room in the sample cache for %s "
+				"(%d bytes, %d of %d used)\n",
+				name, (i32)bytes, (i32)cache->used, (i32)cache->budget);
+		return 0;
+	}
+
+	if(useS16) {
+		i16* out = block;
+		for(u64 i = 0; i < frames; ++i) {
+			f32 x = samples[i] * 32768.0f;
+			x += x < 0.0f ? -0.5f : 0.5f;
+			if(x > 32767.0f) x = 32767.0f;
+			if(x < -32768.0f) x = -32768.0f;
+			out[i] = (i16)x;
+		}
+	} else {
+		memcpy(block, samples, bytes);
+	}
+
+	entry->block = block;
+	entry->size = bytes;
+	entry->sample.data = block;
+	entry->sample.length = (u32)frames;
+	entry->sample.frequency = frequency;
+	entry->sample.format = useS16 ? wMixer_FormatS16 : wMixer_FormatF32;
+	entry->sample.lastCommand = cache->mixer->commandHead;
+	return 1;
+}
+
+static
+i32 findCachedSample(wSampleCache* cache, u64 hash)
+{
+	u32 slot = (u32)hash & cache->tableMask;
+	while(1) {
+		i32 index = cache->table[slot];
+		if(index < 0) {
+			if(cache->count >= cache->capacity) {
+				return -1;
+			}
+			index = (i32)cache->count++;
+			cache->table[slot] = index;
+			wCachedSample* entry = cache->entries + index;
+			memset(entry, 0, sizeof(wCachedSample));
+			entry->hash = hash;
+			entry->prev = -1;
+			entry->next = -1;
+			return index;
+		}
+		if(cache->entries[index].hash == hash) {
+			return index;
+		}
+		slot = (slot + 1) & cache->tableMask;
+	}
+}
+
+static
+wMixerSample* loadCachedSample(wSampleCache* cache,
+		wSarArchive* archive, string name)
+{
+	i32 index = findCachedSample(cache, wHashString(name));
+	if(index < 0) {
+		wLogError(0, "Error: sample cache is full, can't add %s\n", name);
+		cache->failed++;
+		return NULL;
+	}
+
+	wCachedSample* entry = cache->entries + index;
+	if(entry->block) {
+		cache->hits++;
+	} else {
+		cache->misses++;
+		isize size = 0;
+		u8* data = NULL;
+		wArenaStartTemp(cache->tempArena);
+		if(archive) {
+			data = wSarGetFileData(archive, name, &size, cache->tempArena);
+		} else {
+			data = wLoadLocalFile(cache->window, name, &size, cache->tempArena);
+		}
+		i32 ok = 0;
+		if(!data) {
+			wLogError(0, "Error: couldn't load sample %s\n", name);
+		} else {
+			ok = decodeCachedSample(cache, entry, data, size, name);
+		}
+		wArenaEndTemp(cache->tempArena);
+		if(!ok) {
+			cache->failed++;
+			return NULL;
+		}
+	}
+
+	entry->refs++;
+	touchCachedSample(cache, index);
+	return &entry->sample;
+}
+
+wMixerSample* wLoadCachedSample(wSampleCache* cache, string filename)
+{
+	return loadCachedSample(cache, NULL, filename);
+}
+
+wMixerSample* wLoadCachedSarSample(wSampleCache* cache,
+		wSarArchive* archive, string name)
+{
+	return loadCachedSample(cache, archive, name);
+}
+
+// It stays loaded, but can be evicted once it stops playing
+void wReleaseCachedSample(wSampleCache* cache, wMixerSample* sample)
+{
+	wCachedSample* entry = (wCachedSample*)sample;
+	if(entry < cache->entries || entry >= cache->entries + cache->count) {
+		wLogError(0, "Error: releasing a sample that isn't from this cache\n");
+		return;
+	}
+	if(entry->refs > 0) {
+		entry->refs--;
+	}
+}
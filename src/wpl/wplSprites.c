@@ -0,0 +1,795 @@
+/* wplSprites.c
+ *
+ * CPU sprite expansion, for GL contexts that can't draw instanced
+ * (GLES2/WebGL1). Turns wSprites into two triangles each, doing the same
+ * math as the instanced EGL3 vertex shader so the fallback shader only
+ * has to pass things through.
+ *
+ * The scalar version is the reference; the SSE and AVX2 versions load
+ * 4/8 sprites at a time, transpose them to SoA, and transpose back out
+ * into wVertex when storing. The mode is picked from cpuid the first time
+ * through, or set with wSetSpriteExpandMode.
+ *
+ * The transposes are most of the work, more than the math, so AVX2 only
+ * pays off doing them eight wide (bench sprites times all three).
+ */
+
+static const f32 anchorOffsetX[] = {0.0f, 0.5f, 0.0f, -0.5f, -0.5f, -0.5f,  0.0f,  0.5f, 0.5f};
+static const f32 anchorOffsetY[] = {0.0f, 0.5f, 0.5f,  0.5f,  0.0f, -0.5f, -0.5f, -0.5f, 0.0f};
+
+// Quad corners in triangle strip order (ie, gl_VertexID in the shader)
+static const f32 cornerX[] = {-0.5f, -0.5f, 0.5f,  0.5f};
+static const f32 cornerY[] = { 0.5f, -0.5f, 0.5f, -0.5f};
+// The two triangles of the strip
+static const i32 quadCorners[] = {0, 1, 2, 1, 2, 3};
+
+static i32 spriteExpandMode = wSpriteExpand_Auto;
+
+i32 wSupportsInstancing()
+{
+	return glDrawArraysInstanced != NULL && glVertexAttribDivisor != NULL;
+}
+
+static
+i32 spriteAnchor(f32 flags)
+{
+	i32 anchor = (i32)(flags - (f32)((i32)(flags / 10.0f) * 10));
+	if(anchor < 0 || anchor > 8) anchor = 0;
+	return anchor;
+}
+
+isize wExpandSpritesScalar(wVertex* verts, wSprite* sprites, isize count,
+		f32 offsetX, f32 offsetY, f32 scale, f32 viewportW, f32 viewportH)
+{
+	f32 ivw = 2.0f / viewportW;
+	f32 ivh = -2.0f / viewportH;
+	for(isize i = 0; i < count; ++i) {
+		wSprite* s = sprites + i;
+		i32 anchor = spriteAnchor(s->flags);
+		f32 sn, cs;
+		wb_sincosf(s->angle, &sn, &cs);
+
+		wVertex corners[4];
+		for(isize j = 0; j < 4; ++j) {
+			wVertex* v = corners + j;
+			f32 px = (cornerX[j] + anchorOffsetX[anchor]) * s->w - s->cx;
+			f32 py = (cornerY[j] + anchorOffsetY[anchor]) * s->h - s->cy;
+			f32 rx = cs * px - sn * py + s->cx;
+			f32 ry = sn * px + cs * py + s->cy;
+			rx = (rx + s->x - offsetX) * scale;
+			ry = (ry + (s->y - s->z) - offsetY) * scale;
+
+			v->x = rx * ivw - 1.0f;
+			v->y = ry * ivh + 1.0f;
+			v->px = cornerX[j] + 0.5f;
+			v->py = cornerY[j] + 0.5f;
+			v->u = (f32)(j < 2 ? s->tx : s->tx + s->tw);
+			v->v = (f32)(j & 1 ? s->ty : s->ty + s->th);
+			v->sx = scale * s->w / (f32)s->tw;
+			v->sy = scale * s->h / (f32)s->th;
+			v->color = s->color;
+			v->flags = s->flags;
+		}
+
+		wVertex* out = verts + i * 6;
+		for(isize j = 0; j < 6; ++j) {
+			out[j] = corners[quadCorners[j]];
+		}
+	}
+	return count * 6;
+}
+
+/* Writes one corner of four sprites, given as SoA, into every slot that
+ * corner appears in. */
+static inline
+void storeCorners4(wVertex* verts, i32 corner,
+		vf128 xs, vf128 ys, vf128 pxs, vf128 pys,
+		vf128 us, vf128 vs, vf128 sxs, vf128 sys,
+		vf128 colors, vf128 flags)
+{
+	_MM_TRANSPOSE4_PS(xs, ys, pxs, pys);
+	_MM_TRANSPOSE4_PS(us, vs, sxs, sys);
+	vf128 a[4] = {xs, ys, pxs, pys};
+	vf128 b[4] = {us, vs, sxs, sys};
+	vf128 lo = _mm_unpacklo_ps(colors, flags);
+	vf128 hi = _mm_unpackhi_ps(colors, flags);
+	vi128 c[4] = {
+		_mm_castps_si128(lo),
+		_mm_castps_si128(_mm_movehl_ps(lo, lo)),
+		_mm_castps_si128(hi),
+		_mm_castps_si128(_mm_movehl_ps(hi, hi))
+	};
+
+	for(isize k = 0; k < 4; ++k) {
+		wVertex* out = verts + k * 6;
+		for(isize j = 0; j < 6; ++j) {
+			if(quadCorners[j] != corner) continue;
+			_mm_storeu_ps(&out[j].x, a[k]);
+			_mm_storeu_ps(&out[j].u, b[k]);
+			_mm_storel_epi64((vi128*)&out[j].color, c[k]);
+		}
+	}
+}
+
+/* Loads four sprites as SoA:
+ * 	flags, color, x, y, z, angle, w, h, cx, cy, tx, ty, tw, th */
+static inline
+void loadSprites4(wSprite* s, vf128* out)
+{
+	vf128 a0 = _mm_loadu_ps(&s[0].flags);
+	vf128 a1 = _mm_loadu_ps(&s[1].flags);
+	vf128 a2 = _mm_loadu_ps(&s[2].flags);
+	vf128 a3 = _mm_loadu_ps(&s[3].flags);
+	vf128 b0 = _mm_loadu_ps(&s[0].z);
+	vf128 b1 = _mm_loadu_ps(&s[1].z);
+	vf128 b2 = _mm_loadu_ps(&s[2].z);
+	vf128 b3 = _mm_loadu_ps(&s[3].z);
+	vf128 c0 = _mm_loadu_ps(&s[0].cx);
+	vf128 c1 = _mm_loadu_ps(&s[1].cx);
+	vf128 c2 = _mm_loadu_ps(&s[2].cx);
+	vf128 c3 = _mm_loadu_ps(&s[3].cx);
+	_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+	_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+	// the texture rect is packed i16 pairs
+	vi128 txty = _mm_castps_si128(c2);
+	vi128 twth = _mm_castps_si128(c3);
+
+	out[0] = a0;
+	out[1] = a1;
+	out[2] = a2;
+	out[3] = a3;
+	out[4] = b0;
+	out[5] = b1;
+	out[6] = b2;
+	out[7] = b3;
+	out[8] = c0;
+	out[9] = c1;
+	out[10] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(txty, 16), 16));
+	out[11] = _mm_cvtepi32_ps(_mm_srai_epi32(txty, 16));
+	out[12] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(twth, 16), 16));
+	out[13] = _mm_cvtepi32_ps(_mm_srai_epi32(twth, 16));
+}
+
+static
+isize expandSpritesSSE(wVertex* verts, wSprite* sprites, isize count,
+		f32 offsetX, f32 offsetY, f32 scale, f32 viewportW, f32 viewportH)
+{
+	vf128 offXs = _mm_set1_ps(offsetX);
+	vf128 offYs = _mm_set1_ps(offsetY);
+	vf128 scales = _mm_set1_ps(scale);
+	vf128 ivws = _mm_set1_ps(2.0f / viewportW);
+	vf128 ivhs = _mm_set1_ps(-2.0f / viewportH);
+	vf128 ones = _mm_set1_ps(1.0f);
+	vf128 tens = _mm_set1_ps(10.0f);
+
+	isize i = 0;
+	for(; i + 4 <= count; i += 4) {
+		vf128 s[14];
+		loadSprites4(sprites + i, s);
+		vf128 flags = s[0], colors = s[1];
+		vf128 x = s[2], y = s[3], z = s[4], angle = s[5];
+		vf128 w = s[6], h = s[7], cx = s[8], cy = s[9];
+		vf128 tx = s[10], ty = s[11], tw = s[12], th = s[13];
+
+		vf128 tensDigit = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_div_ps(flags, tens)));
+		vi128 anchors = _mm_cvttps_epi32(_mm_sub_ps(flags, _mm_mul_ps(tensDigit, tens)));
+		i32 anchor[4];
+		_mm_storeu_si128((vi128*)anchor, anchors);
+		for(isize k = 0; k < 4; ++k) {
+			if(anchor[k] < 0 || anchor[k] > 8) anchor[k] = 0;
+		}
+		vf128 ox = _mm_setr_ps(
+				anchorOffsetX[anchor[0]], anchorOffsetX[anchor[1]],
+				anchorOffsetX[anchor[2]], anchorOffsetX[anchor[3]]);
+		vf128 oy = _mm_setr_ps(
+				anchorOffsetY[anchor[0]], anchorOffsetY[anchor[1]],
+				anchorOffsetY[anchor[2]], anchorOffsetY[anchor[3]]);
+
+		vf128 sn, cs;
+		wb_sincos_ps(angle, &sn, &cs);
+
+		vf128 baseX = _mm_sub_ps(x, offXs);
+		vf128 baseY = _mm_sub_ps(_mm_sub_ps(y, z), offYs);
+		vf128 sxs = _mm_div_ps(_mm_mul_ps(scales, w), tw);
+		vf128 sys = _mm_div_ps(_mm_mul_ps(scales, h), th);
+		vf128 u0 = tx, u1 = _mm_add_ps(tx, tw);
+		vf128 v0 = _mm_add_ps(ty, th), v1 = ty;
+
+		for(i32 j = 0; j < 4; ++j) {
+			vf128 px = _mm_sub_ps(_mm_mul_ps(
+						_mm_add_ps(_mm_set1_ps(cornerX[j]), ox), w), cx);
+			vf128 py = _mm_sub_ps(_mm_mul_ps(
+						_mm_add_ps(_mm_set1_ps(cornerY[j]), oy), h), cy);
+			vf128 rx = _mm_add_ps(_mm_sub_ps(
+						_mm_mul_ps(cs, px), _mm_mul_ps(sn, py)), cx);
+			vf128 ry = _mm_add_ps(_mm_add_ps(
+						_mm_mul_ps(sn, px), _mm_mul_ps(cs, py)), cy);
+			rx = _mm_mul_ps(_mm_add_ps(rx, baseX), scales);
+			ry = _mm_mul_ps(_mm_add_ps(ry, baseY), scales);
+			rx = _mm_sub_ps(_mm_mul_ps(rx, ivws), ones);
+			ry = _mm_add_ps(_mm_mul_ps(ry, ivhs), ones);
+
+			storeCorners4(verts + i * 6, j,
+					rx, ry,
+					_mm_set1_ps(cornerX[j] + 0.5f),
+					_mm_set1_ps(cornerY[j] + 0.5f),
+					j < 2 ? u0 : u1, j & 1 ? v1 : v0,
+					sxs, sys,
+					colors, flags);
+		}
+	}
+
+	wExpandSpritesScalar(verts + i * 6, sprites + i, count - i,
+			offsetX, offsetY, scale, viewportW, viewportH);
+	return count * 6;
+}
+
+#ifndef WPL_EMSCRIPTEN
+#ifdef _MSC_VER
+#define TargetAVX2
+#else
+#define TargetAVX2 __attribute__((target("avx2")))
+#endif
+
+static
+i32 cpuHasAVX2()
+{
+#ifdef _MSC_VER
+	i32 info[4];
+	__cpuid(info, 1);
+	// needs OSXSAVE + AVX, and the OS saving ymm state
+	if((info[2] & (3 << 27)) != (3 << 27)) return 0;
+	if((_xgetbv(0) & 6) != 6) return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#define ps8(x) _mm256_set1_ps((f32)x)
+#define pi8(x) _mm256_set1_epi32((i32)x)
+#define pfi8(x) _mm256_castsi256_ps(pi8(x))
+
+/* wb_sincos_ps eight wide, step for step, so it rounds the same */
+TargetAVX2 static inline
+void sincos8(__m256 x, __m256* s, __m256* c)
+{
+	__m256 signSin = _mm256_and_ps(x, pfi8(0x80000000));
+	x = _mm256_and_ps(x, pfi8(~0x80000000));
+
+	__m256 y = _mm256_mul_ps(x, ps8(1.27323954473516));
+	__m256i j = _mm256_cvttps_epi32(y);
+	j = _mm256_and_si256(_mm256_add_epi32(j, pi8(1)), pi8(~1));
+	y = _mm256_cvtepi32_ps(j);
+
+	__m256 swapSin = _mm256_castsi256_ps(
+			_mm256_slli_epi32(_mm256_and_si256(j, pi8(4)), 29));
+	__m256 polyMask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+				_mm256_and_si256(j, pi8(2)), _mm256_setzero_si256()));
+
+	x = _mm256_add_ps(x, _mm256_mul_ps(y, ps8(-0.78515625)));
+	x = _mm256_add_ps(x, _mm256_mul_ps(y, ps8(-2.4187564849853515625e-4)));
+	x = _mm256_add_ps(x, _mm256_mul_ps(y, ps8(-3.77489497744594108e-8)));
+
+	__m256 signCos = _mm256_castsi256_ps(_mm256_slli_epi32(
+				_mm256_andnot_si256(_mm256_sub_epi32(j, pi8(2)), pi8(4)), 29));
+	signSin = _mm256_xor_ps(signSin, swapSin);
+
+	__m256 z = _mm256_mul_ps(x, x);
+	y = _mm256_mul_ps(ps8(2.443315711809948E-005), z);
+	y = _mm256_add_ps(y, ps8(1.388731625493765E-003));
+	y = _mm256_mul_ps(y, z);
+	y = _mm256_add_ps(y, ps8(4.166664568298827E-002));
+	y = _mm256_mul_ps(y, z);
+	y = _mm256_mul_ps(y, z);
+	y = _mm256_sub_ps(y, _mm256_mul_ps(z, ps8(0.5)));
+	y = _mm256_add_ps(y, ps8(1));
+
+	__m256 y2 = _mm256_mul_ps(ps8(-1.9515295891E-4), z);
+	y2 = _mm256_add_ps(y2, ps8(8.3321608736E-3));
+	y2 = _mm256_mul_ps(y2, z);
+	y2 = _mm256_add_ps(y2, ps8(-1.6666654611E-1));
+	y2 = _mm256_mul_ps(y2, z);
+	y2 = _mm256_mul_ps(y2, x);
+	y2 = _mm256_add_ps(y2, x);
+
+	__m256 sin2 = _mm256_and_ps(polyMask, y2);
+	__m256 sin1 = _mm256_andnot_ps(polyMask, y);
+	y2 = _mm256_sub_ps(y2, sin2);
+	y = _mm256_sub_ps(y, sin1);
+	*s = _mm256_xor_ps(_mm256_add_ps(sin1, sin2), signSin);
+	*c = _mm256_xor_ps(_mm256_add_ps(y, y2), signCos);
+}
+
+// Rows in, columns out
+TargetAVX2 static inline
+void transpose8(__m256* r)
+{
+	__m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+	__m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+	__m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+	__m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+	__m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+	__m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+	__m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+	__m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+	__m256 u0 = _mm256_shuffle_ps(t0, t2, 0x44);
+	__m256 u1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+	__m256 u2 = _mm256_shuffle_ps(t1, t3, 0x44);
+	__m256 u3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+	__m256 u4 = _mm256_shuffle_ps(t4, t6, 0x44);
+	__m256 u5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+	__m256 u6 = _mm256_shuffle_ps(t5, t7, 0x44);
+	__m256 u7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+	r[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+	r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+	r[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+	r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+	r[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+	r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+	r[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+	r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+/* Eight sprites at a time, SoA all the way: the first 32 bytes of each
+ * sprite are one 8x8 transpose, the last 16 are four 4x4s done two
+ * sprites to a register, and each corner goes back out as one 8x8
+ * transpose of the first 32 bytes of wVertex. Color and flags are the
+ * sprite's first 8 bytes swapped, so they skip the vector path.
+ */
+TargetAVX2 static
+isize expandSpritesAVX2(wVertex* verts, wSprite* sprites, isize count,
+		f32 offsetX, f32 offsetY, f32 scale, f32 viewportW, f32 viewportH)
+{
+	__m256 offXs = _mm256_set1_ps(offsetX);
+	__m256 offYs = _mm256_set1_ps(offsetY);
+	__m256 scales = _mm256_set1_ps(scale);
+	__m256 ivws = _mm256_set1_ps(2.0f / viewportW);
+	__m256 ivhs = _mm256_set1_ps(-2.0f / viewportH);
+	__m256 ones = _mm256_set1_ps(1.0f);
+	__m256 tens = _mm256_set1_ps(10.0f);
+
+	isize i = 0;
+	for(; i + 8 <= count; i += 8) {
+		wSprite* s = sprites + i;
+		__m256 a[8], b[4];
+		u64 colorFlags[8];
+		for(isize k = 0; k < 8; ++k) {
+			a[k] = _mm256_loadu_ps(&s[k].flags);
+			u64 pair;
+			memcpy(&pair, &s[k].flags, 8);
+			colorFlags[k] = (pair >> 32) | (pair << 32);
+		}
+		for(isize k = 0; k < 4; ++k) {
+			b[k] = _mm256_insertf128_ps(
+					_mm256_castps128_ps256(_mm_loadu_ps(&s[k].cx)),
+					_mm_loadu_ps(&s[k + 4].cx), 1);
+		}
+		transpose8(a);
+		__m256 t0 = _mm256_unpacklo_ps(b[0], b[1]);
+		__m256 t1 = _mm256_unpackhi_ps(b[0], b[1]);
+		__m256 t2 = _mm256_unpacklo_ps(b[2], b[3]);
+		__m256 t3 = _mm256_unpackhi_ps(b[2], b[3]);
+		__m256 cx = _mm256_shuffle_ps(t0, t2, 0x44);
+		__m256 cy = _mm256_shuffle_ps(t0, t2, 0xEE);
+		// The texture rect is packed i16 pairs
+		__m256i txty = _mm256_castps_si256(_mm256_shuffle_ps(t1, t3, 0x44));
+		__m256i twth = _mm256_castps_si256(_mm256_shuffle_ps(t1, t3, 0xEE));
+		__m256 tx = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(txty, 16), 16));
+		__m256 ty = _mm256_cvtepi32_ps(_mm256_srai_epi32(txty, 16));
+		__m256 tw = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(twth, 16), 16));
+		__m256 th = _mm256_cvtepi32_ps(_mm256_srai_epi32(twth, 16));
+
+		__m256 flags = a[0];
+		__m256 x = a[2], y = a[3], z = a[4];
+		__m256 w = a[6], h = a[7];
+
+		__m256 tensDigit = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_div_ps(flags, tens)));
+		__m256i anchors = _mm256_cvttps_epi32(_mm256_sub_ps(flags, _mm256_mul_ps(tensDigit, tens)));
+		__m256i outside = _mm256_or_si256(
+				_mm256_cmpgt_epi32(anchors, pi8(8)),
+				_mm256_cmpgt_epi32(_mm256_setzero_si256(), anchors));
+		anchors = _mm256_andnot_si256(outside, anchors);
+		__m256 ox = _mm256_i32gather_ps(anchorOffsetX, anchors, 4);
+		__m256 oy = _mm256_i32gather_ps(anchorOffsetY, anchors, 4);
+
+		__m256 sn, cs;
+		sincos8(a[5], &sn, &cs);
+
+		__m256 baseX = _mm256_sub_ps(x, offXs);
+		__m256 baseY = _mm256_sub_ps(_mm256_sub_ps(y, z), offYs);
+		__m256 sxs = _mm256_div_ps(_mm256_mul_ps(scales, w), tw);
+		__m256 sys = _mm256_div_ps(_mm256_mul_ps(scales, h), th);
+		__m256 u0 = tx, u1 = _mm256_add_ps(tx, tw);
+		__m256 v0 = _mm256_add_ps(ty, th), v1 = ty;
+
+		wVertex* out = verts + i * 6;
+		for(i32 j = 0; j < 4; ++j) {
+			__m256 px = _mm256_sub_ps(_mm256_mul_ps(
+						_mm256_add_ps(_mm256_set1_ps(cornerX[j]), ox), w), cx);
+			__m256 py = _mm256_sub_ps(_mm256_mul_ps(
+						_mm256_add_ps(_mm256_set1_ps(cornerY[j]), oy), h), cy);
+			__m256 rx = _mm256_add_ps(_mm256_sub_ps(
+						_mm256_mul_ps(cs, px), _mm256_mul_ps(sn, py)), cx);
+			__m256 ry = _mm256_add_ps(_mm256_add_ps(
+						_mm256_mul_ps(sn, px), _mm256_mul_ps(cs, py)), cy);
+			rx = _mm256_mul_ps(_mm256_add_ps(rx, baseX), scales);
+			ry = _mm256_mul_ps(_mm256_add_ps(ry, baseY), scales);
+
+			__m256 v[8];
+			v[0] = _mm256_sub_ps(_mm256_mul_ps(rx, ivws), ones);
+			v[1] = _mm256_add_ps(_mm256_mul_ps(ry, ivhs), ones);
+			v[2] = _mm256_set1_ps(cornerX[j] + 0.5f);
+			v[3] = _mm256_set1_ps(cornerY[j] + 0.5f);
+			v[4] = j < 2 ? u0 : u1;
+			v[5] = j & 1 ? v1 : v0;
+			v[6] = sxs;
+			v[7] = sys;
+			transpose8(v);
+
+			// Corners 1 and 2 are shared by both triangles (quadCorners)
+			isize first = j < 3 ? j : 5;
+			isize second = j == 1 || j == 2 ? j + 2 : -1;
+			for(isize k = 0; k < 8; ++k) {
+				_mm256_storeu_ps(&out[k * 6 + first].x, v[k]);
+				memcpy(&out[k * 6 + first].color, colorFlags + k, 8);
+				if(second >= 0) {
+					_mm256_storeu_ps(&out[k * 6 + second].x, v[k]);
+					memcpy(&out[k * 6 + second].color, colorFlags + k, 8);
+				}
+			}
+		}
+	}
+
+	expandSpritesSSE(verts + i * 6, sprites + i, count - i,
+			offsetX, offsetY, scale, viewportW, viewportH);
+	return count * 6;
+}
+#else
+static
+i32 cpuHasAVX2()
+{
+	return 0;
+}
+#endif
+
+i32 wSetSpriteExpandMode(i32 mode)
+{
+	if(mode == wSpriteExpand_Auto) {
+		mode = cpuHasAVX2() ? wSpriteExpand_AVX2 : wSpriteExpand_SSE;
+	} else if(mode == wSpriteExpand_AVX2 && !cpuHasAVX2()) {
+		mode = wSpriteExpand_SSE;
+	}
+	spriteExpandMode = mode;
+	return mode;
+}
+
+isize wExpandSprites(wVertex* verts, wSprite* sprites, isize count,
+		f32 offsetX, f32 offsetY, f32 scale, f32 viewportW, f32 viewportH)
+{
+	if(spriteExpandMode == wSpriteExpand_Auto) {
+		wSetSpriteExpandMode(wSpriteExpand_Auto);
+	}
+
+	switch(spriteExpandMode) {
+#ifndef WPL_EMSCRIPTEN
+		case wSpriteExpand_AVX2:
+			return expandSpritesAVX2(verts, sprites, count,
+					offsetX, offsetY, scale, viewportW, viewportH);
+#endif
+		case wSpriteExpand_SSE:
+			return expandSpritesSSE(verts, sprites, count,
+					offsetX, offsetY, scale, viewportW, viewportH);
+		default:
+			return wExpandSpritesScalar(verts, sprites, count,
+					offsetX, offsetY, scale, viewportW, viewportH);
+	}
+}
+
+static
+i16 packFixed(f32 v)
+{
+	v *= PackedSprite_Subpixel;
+	if(v > 32767.0f) return 32767;
+	if(v < -32768.0f) return -32768;
+	return (i16)(v < 0 ? v - 0.5f : v + 0.5f);
+}
+
+static
+u8 packByte(i32 v)
+{
+	return (u8)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// Texture sizes are stored minus one, so 1..256 fits
+static
+u8 packSize(i32 v)
+{
+	return packByte(v - 1);
+}
+
+#ifndef NDEBUG
+static
+i32 packWouldClamp(wSprite* s)
+{
+	const f32 limit = 32767.0f / PackedSprite_Subpixel;
+	f32 y = s->y - s->z;
+	return s->x > limit || s->x < -limit || y > limit || y < -limit ||
+		s->w > limit || s->w < -limit || s->h > limit || s->h < -limit ||
+		s->tw < 1 || s->tw > 256 || s->th < 1 || s->th > 256;
+}
+#endif
+
+/* Quantizes sprites down to wPackedSprite. Color and center are dropped,
+ * positions and sizes clamp at +-8191px, texture sizes at 1..256, and the
+ * angle is stored in 1/255ths of a turn. Debug builds log when anything
+ * clamped. */
+void wPackSprites(wPackedSprite* out, wSprite* sprites, isize count)
+{
+	const f32 invTau = 0.15915494f;
+#ifndef NDEBUG
+	isize clamped = 0;
+	isize firstClamped = -1;
+#endif
+	for(isize i = 0; i < count; ++i) {
+		wSprite* s = sprites + i;
+		wPackedSprite* p = out + i;
+#ifndef NDEBUG
+		if(packWouldClamp(s)) {
+			if(!clamped) firstClamped = i;
+			clamped++;
+		}
+#endif
+		p->x = packFixed(s->x);
+		p->y = packFixed(s->y - s->z);
+		p->w = packFixed(s->w);
+		p->h = packFixed(s->h);
+		p->tx = s->tx;
+		p->ty = s->ty;
+		p->tw = packSize(s->tw);
+		p->th = packSize(s->th);
+
+		f32 turns = s->angle * invTau;
+		turns -= (f32)(i32)turns;
+		if(turns < 0) turns += 1.0f;
+		p->angle = (u8)(i32)(turns * 255.0f + 0.5f);
+		p->flags = packByte((i32)s->flags);
+	}
+#ifndef NDEBUG
+	if(clamped) {
+		wSprite* s = sprites + firstClamped;
+		wLogError(0, "Error: %d sprites don't fit wPackedSprite and were clamped; "
+				"the first (%d) is at %.1f,%.1f size %.1fx%.1f texture %dx%d\n",
+				(i32)clamped, (i32)firstClamped, s->x, s->y - s->z,
+				s->w, s->h, s->tw, s->th);
+	}
+#endif
+}
+
+/* Sprite grid
+ *
+ * Sprites go in the cell their position (x, y - z) falls in, bounded by
+ * a circle that covers any rotation about their center: no corner can be
+ * further than |size| + 2|center| away. Queries grow the view by one cell
+ * to catch sprites hanging over from neighbouring cells, so anything with
+ * a bigger radius than that goes on the overflow list instead, which is
+ * tested every time. Positions outside the grid clamp to the edge cells.
+ *
+ * Visible sprites are flagged in a bitset and read back in index order,
+ * so culling doesn't change draw order. Build rebuilds everything (for
+ * sprites that move every frame); Insert/Remove keep the grid up to date
+ * one sprite at a time (for static layers).
+ */
+
+static
+f32 spriteRadius(wSprite* s)
+{
+	return wb_sqrtf(s->w * s->w + s->h * s->h) + 
+		2.0f * wb_sqrtf(s->cx * s->cx + s->cy * s->cy);
+}
+
+static
+i32 gridCoord(f32 v, i32 max)
+{
+	if(v < 0) return 0;
+	if(v > (f32)(max - 1)) return max - 1;
+	return (i32)v;
+}
+
+static
+i32 spriteGridCell(wSpriteGrid* grid, wSprite* s)
+{
+	if(spriteRadius(s) > grid->cellSize) {
+		return grid->w * grid->h;
+	}
+	i32 cx = gridCoord((s->x - grid->x) * grid->invCellSize, grid->w);
+	i32 cy = gridCoord((s->y - s->z - grid->y) * grid->invCellSize, grid->h);
+	return cy * grid->w + cx;
+}
+
+static
+i32 lowestBit(u64 x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (i32)index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+void wInitSpriteGrid(wSpriteGrid* grid, 
+		f32 x, f32 y, i32 w, i32 h, f32 cellSize, 
+		isize capacity, wMemoryArena* arena)
+{
+	grid->x = x;
+	grid->y = y;
+	grid->w = w < 1 ? 1 : w;
+	grid->h = h < 1 ? 1 : h;
+	grid->cellSize = cellSize;
+	grid->invCellSize = 1.0f / cellSize;
+	grid->count = 0;
+	grid->capacity = capacity;
+
+	grid->heads = wArenaPush(arena, sizeof(i32) * (grid->w * grid->h + 1));
+	grid->next = wArenaPush(arena, sizeof(i32) * capacity);
+	grid->prev = wArenaPush(arena, sizeof(i32) * capacity);
+	grid->cells = wArenaPush(arena, sizeof(i32) * capacity);
+	grid->visible = wArenaPush(arena, sizeof(u64) * ((capacity + 63) / 64));
+
+	for(isize i = 0; i < grid->w * grid->h + 1; ++i) {
+		grid->heads[i] = -1;
+	}
+	for(isize i = 0; i < capacity; ++i) {
+		grid->cells[i] = -1;
+	}
+	memset(grid->visible, 0, sizeof(u64) * ((capacity + 63) / 64));
+}
+
+static
+void linkSprite(wSpriteGrid* grid, i32 cell, i32 index)
+{
+	i32 head = grid->heads[cell];
+	grid->next[index] = head;
+	grid->prev[index] = -1;
+	if(head >= 0) grid->prev[head] = index;
+	grid->heads[cell] = index;
+	grid->cells[index] = cell;
+}
+
+void wBuildSpriteGrid(wSpriteGrid* grid, wSprite* sprites, isize count)
+{
+	if(count > grid->capacity) count = grid->capacity;
+	for(isize i = 0; i < grid->w * grid->h + 1; ++i) {
+		grid->heads[i] = -1;
+	}
+	for(isize i = count; i < grid->count; ++i) {
+		grid->cells[i] = -1;
+	}
+
+	for(isize i = 0; i < count; ++i) {
+		linkSprite(grid, spriteGridCell(grid, sprites + i), (i32)i);
+	}
+	grid->count = count;
+}
+
+void wSpriteGridRemove(wSpriteGrid* grid, isize index)
+{
+	if(index < 0 || index >= grid->capacity) return;
+	i32 cell = grid->cells[index];
+	if(cell < 0) return;
+
+	i32 next = grid->next[index];
+	i32 prev = grid->prev[index];
+	if(prev >= 0) {
+		grid->next[prev] = next;
+	} else {
+		grid->heads[cell] = next;
+	}
+	if(next >= 0) grid->prev[next] = prev;
+	grid->cells[index] = -1;
+}
+
+void wSpriteGridInsert(wSpriteGrid* grid, wSprite* sprite, isize index)
+{
+	if(index < 0 || index >= grid->capacity) return;
+	i32 cell = spriteGridCell(grid, sprite);
+	if(grid->cells[index] == cell) return;
+
+	wSpriteGridRemove(grid, index);
+	linkSprite(grid, cell, (i32)index);
+	if(index >= grid->count) grid->count = index + 1;
+}
+
+static
+void markVisibleList(wSpriteGrid* grid, wSprite* sprites, i32 head,
+		f32 minX, f32 minY, f32 maxX, f32 maxY)
+{
+	for(i32 i = head; i >= 0; i = grid->next[i]) {
+		wSprite* s = sprites + i;
+		f32 r = spriteRadius(s);
+		f32 x = s->x;
+		f32 y = s->y - s->z;
+		if(x + r < minX || x - r > maxX || y + r < minY || y - r > maxY) {
+			continue;
+		}
+		grid->visible[i >> 6] |= (u64)1 << (i & 63);
+	}
+}
+
+static
+void markVisible(wSpriteGrid* grid, wSprite* sprites,
+		f32 minX, f32 minY, f32 maxX, f32 maxY)
+{
+	f32 margin = grid->cellSize;
+	i32 x0 = gridCoord((minX - margin - grid->x) * grid->invCellSize, grid->w);
+	i32 y0 = gridCoord((minY - margin - grid->y) * grid->invCellSize, grid->h);
+	i32 x1 = gridCoord((maxX + margin - grid->x) * grid->invCellSize, grid->w);
+	i32 y1 = gridCoord((maxY + margin - grid->y) * grid->invCellSize, grid->h);
+
+	for(i32 y = y0; y <= y1; ++y) {
+		for(i32 x = x0; x <= x1; ++x) {
+			markVisibleList(grid, sprites, grid->heads[y * grid->w + x],
+					minX, minY, maxX, maxY);
+		}
+	}
+	markVisibleList(grid, sprites, grid->heads[grid->w * grid->h],
+			minX, minY, maxX, maxY);
+}
+
+/* Copies the sprites that could touch the world rect into out, in their
+ * original order. Returns how many were copied. */
+isize wCullSprites(wSpriteGrid* grid, wSprite* sprites, 
+		f32 minX, f32 minY, f32 maxX, f32 maxY, 
+		wSprite* out)
+{
+	markVisible(grid, sprites, minX, minY, maxX, maxY);
+
+	isize count = 0;
+	isize words = (grid->count + 63) / 64;
+	for(isize i = 0; i < words; ++i) {
+		u64 bits = grid->visible[i];
+		grid->visible[i] = 0;
+		while(bits) {
+			out[count++] = sprites[i * 64 + lowestBit(bits)];
+			bits &= bits - 1;
+		}
+	}
+	return count;
+}
+
+/* Like wCullSprites, but writes (start, count) pairs of consecutive
+ * visible indices to runs, for drawing sub-ranges of data that's already
+ * on the GPU. Once maxRuns is reached the last run is stretched to cover
+ * the rest. Returns the number of runs. */
+isize wCullSpriteRuns(wSpriteGrid* grid, wSprite* sprites, 
+		f32 minX, f32 minY, f32 maxX, f32 maxY, 
+		isize* runs, isize maxRuns)
+{
+	markVisible(grid, sprites, minX, minY, maxX, maxY);
+
+	isize runCount = 0;
+	isize words = (grid->count + 63) / 64;
+	for(isize i = 0; i < words; ++i) {
+		u64 bits = grid->visible[i];
+		grid->visible[i] = 0;
+		while(bits) {
+			isize index = i * 64 + lowestBit(bits);
+			bits &= bits - 1;
+
+			isize* last = runCount > 0 ? runs + (runCount - 1) * 2 : NULL;
+			if(last && (last[0] + last[1] == index || runCount == maxRuns)) {
+				last[1] = index - last[0] + 1;
+			} else if(runCount < maxRuns) {
+				runs[runCount * 2] = index;
+				runs[runCount * 2 + 1] = 1;
+				runCount++;
+			}
+		}
+	}
+	return runCount;
+}
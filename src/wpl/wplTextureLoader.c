@@ -0,0 +1,267 @@
+/* wplTextureLoader.c
+ *
+ * Loads and decodes textures on a pool of workers, so startup isn't one
+ * long stall on stbi_load_from_memory for every image. GL stays on the
+ * main thread: wUpdateTextureLoader uploads whatever has finished, up to
+ * a time budget, once per frame.
+ *
+ *   wInitTextureLoader(&loader, window, 256, 0, arena);
+ *   wTexture* t = wQueueTexture(&loader, "texture.png");
+ *   wStartTextureLoader(&loader);
+ *   ...
+ *   wUpdateTextureLoader(&loader, 0.002); // each frame
+ *
+ * A texture is ready once its glIndex isn't -1. Queue everything before
+ * starting; the request list is read by the workers without locks.
+ */
+
+void wInitTextureLoader(wTextureLoader* loader, wWindow* window,
+		isize capacity, i32 workerCount, wMemoryArena* arena)
+{
+	memset(loader, 0, sizeof(wTextureLoader));
+	loader->window = window;
+	loader->arena = arena;
+	loader->requests = wArenaPush(arena, sizeof(wTextureRequest) * capacity);
+	loader->completed = wArenaPush(arena, sizeof(i32) * capacity);
+	loader->capacity = capacity;
+
+	// Leave a core for the main thread
+	if(workerCount <= 0) {
+		workerCount = wGetProcessorCount() - 1;
+	}
+	if(workerCount < 1) {
+		workerCount = 1;
+	}
+	if(workerCount > TextureLoader_MaxWorkers) {
+		workerCount = TextureLoader_MaxWorkers;
+	}
+	loader->workerCount = workerCount;
+
+	wMemoryInfo info = wGetMemoryInfo();
+	for(i32 i = 0; i < workerCount; ++i) {
+		wTextureWorker* worker = loader->workers + i;
+		worker->loader = loader;
+		worker->arena = wArenaBootstrap(info,
+				Arena_NoRecommit | Arena_NoZeroMemory);
+	}
+}
+
+static
+wTexture* queueTextureRequest(wTextureLoader* loader,
+		wSarArchive* archive, string name)
+{
+	if(loader->running) {
+		wLogError(0, "Error: can't queue %s after the loader started\n", name);
+		return NULL;
+	}
+	if(loader->count >= loader->capacity) {
+		wLogError(0, "Error: texture loader is full, dropping %s\n", name);
+		return NULL;
+	}
+
+	wTextureRequest* request = loader->requests + loader->count++;
+	request->texture = wArenaPush(loader->arena, sizeof(wTexture));
+	request->texture->w = 0;
+	request->texture->h = 0;
+	request->texture->pixels = NULL;
+	request->texture->glIndex = -1;
+	request->name = name;
+	request->archive = archive;
+	request->failed = 0;
+	return request->texture;
+}
+
+wTexture* wQueueTexture(wTextureLoader* loader, string filename)
+{
+	return queueTextureRequest(loader, NULL, filename);
+}
+
+wTexture* wQueueSarTexture(wTextureLoader* loader,
+		wSarArchive* archive, string name)
+{
+	return queueTextureRequest(loader, archive, name);
+}
+
+/* The file only lives until it's decoded, so it goes in a temp block.
+ * stb_image hands back malloc'd pixels; those get copied out into the
+ * worker's arena so the texture outlives the temp block and everything
+ * from one loader can be dropped together.
+ */
+static
+i32 decodeTextureRequest(wTextureLoader* loader,
+		wTextureRequest* request, wMemoryArena* arena)
+{
+	isize size = 0;
+	u8* data = NULL;
+	wArenaStartTemp(arena);
+	if(request->archive) {
+		data = wSarGetFileData(request->archive, request->name, &size, arena);
+	} else {
+		data = wLoadLocalFile(loader->window, request->name, &size, arena);
+	}
+	if(!data) {
+		wArenaEndTemp(arena);
+		wLogError(0, "Error: couldn't load texture %s\n", request->name);
+		return 0;
+	}
+
+	wTexture decoded;
+	i32 ok = wInitTexture(&decoded, data, size);
+	wArenaEndTemp(arena);
+	if(!ok) {
+		return 0;
+	}
+
+	wTexture* texture = request->texture;
+	texture->w = decoded.w;
+	texture->h = decoded.h;
+#ifndef WPL_EMSCRIPTEN
+	isize pixelSize = decoded.w * decoded.h * 4;
+	texture->pixels = wArenaPush(arena, pixelSize);
+	memcpy(texture->pixels, decoded.pixels, pixelSize);
+	stbi_image_free(decoded.pixels);
+#else
+	texture->pixels = decoded.pixels;
+#endif
+	return 1;
+}
+
+static
+void loadTextureRequest(wTextureLoader* loader, i32 index, wMemoryArena* arena)
+{
+	wTextureRequest* request = loader->requests + index;
+	request->failed = !decodeTextureRequest(loader, request, arena);
+
+	i32 slot = wAtomicAdd(&loader->completedCount, 1);
+	wAtomicStore(loader->completed + slot, index);
+	if(loader->ready) {
+		wSemaphorePost(loader->ready);
+	}
+}
+
+static
+i32 textureWorkerProc(void* data)
+{
+	wTextureWorker* worker = data;
+	wTextureLoader* loader = worker->loader;
+	while(1) {
+		i32 index = wAtomicAdd(&loader->nextRequest, 1);
+		if(index >= loader->count) {
+			break;
+		}
+		loadTextureRequest(loader, index, worker->arena);
+	}
+	return 0;
+}
+
+void wStartTextureLoader(wTextureLoader* loader)
+{
+	if(loader->running) return;
+	loader->running = 1;
+	loader->startTime = wGetTime();
+	for(isize i = 0; i < loader->count; ++i) {
+		loader->completed[i] = -1;
+	}
+
+	loader->threadCount = 0;
+	loader->ready = wCreateSemaphore(0);
+	for(i32 i = 0; i < loader->workerCount && loader->ready; ++i) {
+		wTextureWorker* worker = loader->workers + i;
+		worker->thread = wCreateThread(textureWorkerProc, worker);
+		if(worker->thread) {
+			loader->threadCount++;
+		}
+	}
+}
+
+static
+void finishTextureLoader(wTextureLoader* loader)
+{
+	for(i32 i = 0; i < loader->workerCount; ++i) {
+		wTextureWorker* worker = loader->workers + i;
+		if(worker->thread) {
+			wWaitThread(worker->thread);
+			worker->thread = NULL;
+		}
+	}
+	if(loader->ready) {
+		wDestroySemaphore(loader->ready);
+		loader->ready = NULL;
+	}
+	loader->threadCount = 0;
+	loader->totalTime = wGetTime() - loader->startTime;
+	loader->running = 0;
+}
+
+/* Uploads until the budget runs out, but always does at least one, so a
+ * budget of 0 means one texture a frame. If no threads could be started,
+ * requests get decoded here instead, on the clock.
+ * With block set, waits for the workers instead of returning early.
+ */
+static
+isize drainTextureLoader(wTextureLoader* loader, f64 budget, i32 block)
+{
+	f64 start = wGetTime();
+	isize handled = 0, uploaded = 0;
+	while(loader->completedRead < loader->count) {
+		if(handled > 0 && !block && wGetTime() - start >= budget) {
+			break;
+		}
+
+		i32 index = wAtomicLoad(loader->completed + loader->completedRead);
+		if(index < 0) {
+			if(!loader->threadCount) {
+				i32 next = wAtomicAdd(&loader->nextRequest, 1);
+				loadTextureRequest(loader, next, loader->workers[0].arena);
+				continue;
+			}
+			if(!block) {
+				break;
+			}
+			wSemaphoreWait(loader->ready);
+			continue;
+		}
+		loader->completedRead++;
+		handled++;
+
+		wTextureRequest* request = loader->requests + index;
+		if(request->failed) {
+			loader->failed++;
+			continue;
+		}
+		wUploadTexture(request->texture);
+		loader->uploaded++;
+		uploaded++;
+	}
+
+	f64 elapsed = wGetTime() - start;
+	loader->uploadTime += elapsed;
+	if(elapsed > loader->worstFrame) {
+		loader->worstFrame = elapsed;
+	}
+
+	if(loader->completedRead >= loader->count) {
+		finishTextureLoader(loader);
+	}
+	return uploaded;
+}
+
+// Returns the number of textures uploaded this call.
+isize wUpdateTextureLoader(wTextureLoader* loader, f64 budget)
+{
+	if(!loader->running) return 0;
+	return drainTextureLoader(loader, budget, 0);
+}
+
+// Blocks until everything queued is uploaded.
+void wFinishTextureLoader(wTextureLoader* loader)
+{
+	if(!loader->running) return;
+	drainTextureLoader(loader, 0, 1);
+}
+
+i32 wTextureLoaderDone(wTextureLoader* loader)
+{
+	return !loader->running && loader->completedRead >= loader->count;
+}
+
@@ -38,12 +38,12 @@ void wCopyMemoryBlock(void* dest, const void* source,
 		for(isize i = 0; i < sh; ++i) {
 			memcpy(
 					dst + ((i+dy) * dw + (dx-1)) * size, 
-					dst + ((i+sy) * dw + sx) * size,
+					dst + ((i+dy) * dw + dx) * size,
 					1 * size);
 
 			memcpy(
 					dst + ((i+dy) * dw + (dx+sw)) * size, 
-					src + ((i+sy) * dw + (sx+sw-1)) * size,
+					dst + ((i+dy) * dw + (dx+sw-1)) * size,
 					1 * size);
 		}
 
@@ -0,0 +1,335 @@
+/* wplVorbis.c
+ *
+ * Streams Ogg Vorbis music through a wMixerStream. A five minute track is
+ * about 100MB as stereo floats; this keeps the compressed file, the
+ * decoder's working memory and two small buffers, and decodes on its own
+ * thread a buffer ahead of the mixer.
+ *
+ *   wInitVorbisStream(&music, data, size, 4096, arena);
+ *   wSetVorbisLoop(&music, 1, 0, 0);
+ *   wMixerPlayStream(mixer, &music.stream, 1.0f);
+ *
+ * data can be anything in memory: a loaded file, wSarGetFileData, or an
+ * entry in a mapped archive. To play it again after it ends, seek first.
+ * Stop the voice, and let the mixer run a block, before destroying it.
+ */
+
+#ifdef WPL_REPLACE_CRT
+// wb_ldexpf doesn't take negative exponents, and codebooks need them
+static
+f64 vorbisLdexp(f64 x, i32 e)
+{
+	if(e > 1023) e = 1023;
+	if(e < -1022) e = -1022;
+	u64 bits = (u64)(e + 1023) << 52;
+	f64 scale;
+	memcpy(&scale, &bits, sizeof(f64));
+	return x * scale;
+}
+
+#define STB_VORBIS_NO_CRT
+#define assert(x)
+#define alloca(s) 0
+#define qsort atlasSort
+// Only used at setup, and only on positive numbers
+#define floor(x) ((f64)wb_floorf((f32)(x)))
+#define pow(x, y) wb_ipowf((f32)(x), (i32)(y))
+#define exp(x) wb_expf((f32)(x))
+#define log(x) wb_logf((f32)(x))
+#define sin(x) wb_sinf((f32)(x))
+#define cos(x) wb_cosf((f32)(x))
+#define ldexp(x, e) vorbisLdexp((x), (e))
+#undef NULL
+#endif
+
+// Only the float pull API is used
+#define STB_VORBIS_NO_STDIO
+#define STB_VORBIS_NO_PUSHDATA_API
+#define STB_VORBIS_NO_INTEGER_CONVERSION
+// Its temp_free is a bare 0 when there's no dealloca
+#if defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable: 4555)
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-value"
+#endif
+#include "thirdparty/stb_vorbis.c"
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#ifdef WPL_REPLACE_CRT
+#undef assert
+#undef alloca
+#undef qsort
+#undef floor
+#undef pow
+#undef exp
+#undef log
+#undef sin
+#undef cos
+#undef ldexp
+#undef malloc
+#undef free
+#undef realloc
+#undef NULL
+#define NULL ((void*)0)
+#endif
+
+/* Fills out with up to count frames, going back to loopStart at the loop
+ * end. Returns fewer than count only at the end of a track that doesn't
+ * loop.
+ */
+static
+i32 decodeVorbisFrames(wVorbisStream* vs, f32* out, i32 count)
+{
+	stb_vorbis* decoder = vs->decoder;
+	i32 end = vs->totalFrames;
+	if(vs->loop && vs->loopEnd > 0 && vs->loopEnd < end) {
+		end = vs->loopEnd;
+	}
+
+	i32 got = 0;
+	i32 emptyLoops = 0;
+	while(got < count) {
+		i32 want = count - got;
+		if(end > 0 && vs->decodeFrame + want > end) {
+			want = end - vs->decodeFrame;
+		}
+
+		i32 n = 0;
+		if(want > 0) {
+			n = stb_vorbis_get_samples_float_interleaved(decoder, 2,
+					out + got * 2, want * 2);
+		}
+		if(n <= 0) {
+			// Bail out rather than spin on a loop with nothing in it
+			if(!vs->loop || emptyLoops++ > 0) {
+				break;
+			}
+			stb_vorbis_seek(decoder, vs->loopStart);
+			vs->decodeFrame = vs->loopStart;
+			continue;
+		}
+		emptyLoops = 0;
+
+		// stb_vorbis leaves the missing channel silent
+		if(vs->channels == 1) {
+			f32* p = out + got * 2;
+			for(i32 i = 0; i < n; ++i) {
+				p[i * 2 + 1] = p[i * 2];
+			}
+		}
+		got += n;
+		vs->decodeFrame += n;
+	}
+	return got;
+}
+
+/* Fills every buffer the mixer has handed back, in order. */
+static
+void fillVorbisBuffers(wVorbisStream* vs)
+{
+	f64 start = wGetTime();
+	while(1) {
+		i32 epoch = wAtomicLoad(&vs->seekEpoch);
+		if(epoch != vs->decodeEpoch) {
+			i32 frame = wAtomicLoad(&vs->seekFrame);
+			if(frame < 0) frame = 0;
+			if(vs->totalFrames > 0 && frame > vs->totalFrames) {
+				frame = vs->totalFrames;
+			}
+			stb_vorbis_seek(vs->decoder, frame);
+			vs->decodeFrame = frame;
+			vs->decodeEpoch = epoch;
+		}
+		if(wAtomicLoad(&vs->endEpoch) == vs->decodeEpoch) {
+			break;
+		}
+
+		wVorbisBuffer* buffer = vs->buffers + vs->fillIndex;
+		if(wAtomicLoad(&buffer->frames) != 0) {
+			break;
+		}
+		i32 frames = decodeVorbisFrames(vs, buffer->data, vs->bufferFrames);
+		vs->decodedFrames += frames;
+		if(frames > 0) {
+			wAtomicStore(&buffer->epoch, vs->decodeEpoch);
+			wAtomicStore(&buffer->frames, frames);
+			vs->fillIndex ^= 1;
+		}
+		// Only after publishing, so the mixer doesn't stop short of it
+		if(frames < vs->bufferFrames) {
+			wAtomicStore(&vs->endEpoch, vs->decodeEpoch);
+		}
+	}
+	vs->decodeTime += wGetTime() - start;
+}
+
+static
+i32 vorbisDecoderProc(void* data)
+{
+	wVorbisStream* vs = data;
+	while(1) {
+		wSemaphoreWait(vs->wake);
+		if(wAtomicLoad(&vs->quit)) {
+			break;
+		}
+		fillVorbisBuffers(vs);
+	}
+	return 0;
+}
+
+/* The mixer's refill callback, on the audio thread. Hands back the
+ * buffer that just finished and takes the next one, skipping anything
+ * decoded before the last seek. A length of 0 ends the voice.
+ */
+static
+void refillVorbisStream(wMixerSample* sample, void* userdata)
+{
+	wVorbisStream* vs = userdata;
+	if(vs->playing >= 0) {
+		wAtomicStore(&vs->buffers[vs->playing].frames, 0);
+		vs->playing = -1;
+		if(vs->wake) {
+			wSemaphorePost(vs->wake);
+		}
+	}
+	if(!vs->thread) {
+		fillVorbisBuffers(vs);
+	}
+
+	i32 epoch = wAtomicLoad(&vs->seekEpoch);
+	// Read before the buffers; see fillVorbisBuffers
+	i32 ended = wAtomicLoad(&vs->endEpoch) == epoch;
+	for(i32 i = 0; i < 2; ++i) {
+		wVorbisBuffer* buffer = vs->buffers + vs->playIndex;
+		i32 frames = wAtomicLoad(&buffer->frames);
+		if(frames == 0) {
+			break;
+		}
+		vs->playIndex ^= 1;
+		if(wAtomicLoad(&buffer->epoch) != epoch) {
+			wAtomicStore(&buffer->frames, 0);
+			if(vs->wake) {
+				wSemaphorePost(vs->wake);
+			}
+			continue;
+		}
+
+		vs->playing = (i32)(buffer - vs->buffers);
+		sample->data = buffer->data;
+		sample->length = frames * 2;
+		return;
+	}
+
+	if(ended) {
+		sample->length = 0;
+		return;
+	}
+	vs->starved++;
+	sample->data = vs->silence;
+	sample->length = Vorbis_SilenceFrames * 2;
+}
+
+/* bufferFrames is per buffer; the decoder stays up to two ahead. Returns
+ * 0 if the file isn't Vorbis or the decoder doesn't fit Vorbis_AllocSize.
+ */
+i32 wInitVorbisStream(wVorbisStream* vs, void* data, isize size,
+		i32 bufferFrames, wMemoryArena* arena)
+{
+	memset(vs, 0, sizeof(wVorbisStream));
+	if(bufferFrames < Mixer_BlockSize) {
+		bufferFrames = Mixer_BlockSize;
+	}
+
+	stb_vorbis_alloc alloc;
+	alloc.alloc_buffer = wArenaPush(arena, Vorbis_AllocSize);
+	alloc.alloc_buffer_length_in_bytes = Vorbis_AllocSize;
+	i32 error = 0;
+	stb_vorbis* decoder = stb_vorbis_open_memory(data, (i32)size, &error, &alloc);
+	if(!decoder) {
+		wLogError(0, "Error: couldn't open vorbis stream (stb_vorbis error %d)\n",
+				error);
+		return 0;
+	}
+
+	stb_vorbis_info info = stb_vorbis_get_info(decoder);
+	vs->decoder = decoder;
+	vs->channels = info.channels;
+	vs->frequency = info.sample_rate;
+	vs->totalFrames = (i32)stb_vorbis_stream_length_in_samples(decoder);
+	vs->bufferFrames = bufferFrames;
+	vs->endEpoch = -1;
+	vs->playing = -1;
+
+	for(i32 i = 0; i < 2; ++i) {
+		vs->buffers[i].data = wArenaPush(arena,
+				sizeof(f32) * 2 * bufferFrames);
+	}
+	vs->silence = wArenaPush(arena, sizeof(f32) * 2 * Vorbis_SilenceFrames);
+	memset(vs->silence, 0, sizeof(f32) * 2 * Vorbis_SilenceFrames);
+	vs->residentBytes = Vorbis_AllocSize +
+		sizeof(f32) * 2 * (bufferFrames * 2 + Vorbis_SilenceFrames);
+
+	vs->stream.userdata = vs;
+	vs->stream.callback = refillVorbisStream;
+	vs->stream.sample.frequency = vs->frequency;
+	vs->stream.sample.length = 0;
+	vs->stream.sample.data = vs->silence;
+
+	// Have something ready before the thread is even up
+	fillVorbisBuffers(vs);
+	vs->wake = wCreateSemaphore(0);
+	if(vs->wake) {
+		vs->thread = wCreateThread(vorbisDecoderProc, vs);
+	}
+	return 1;
+}
+
+void wSetVorbisLoop(wVorbisStream* vs, i32 loop, i32 loopStart, i32 loopEnd)
+{
+	if(loopStart < 0) loopStart = 0;
+	if(vs->totalFrames > 0 && loopStart >= vs->totalFrames) {
+		loopStart = 0;
+	}
+	if(loopEnd <= loopStart) {
+		loopEnd = 0;
+	}
+	vs->loopStart = loopStart;
+	vs->loopEnd = loopEnd;
+	vs->loop = loop;
+}
+
+/* Exact to the frame. Whatever was already decoded gets dropped, so there
+ * may be a buffer's worth of silence while the decoder catches up.
+ */
+void wSeekVorbisStream(wVorbisStream* vs, i32 frame)
+{
+	wAtomicStore(&vs->seekFrame, frame);
+	wAtomicAdd(&vs->seekEpoch, 1);
+	if(vs->wake) {
+		wSemaphorePost(vs->wake);
+	}
+}
+
+void wDestroyVorbisStream(wVorbisStream* vs)
+{
+	if(vs->thread) {
+		wAtomicStore(&vs->quit, 1);
+		wSemaphorePost(vs->wake);
+		wWaitThread(vs->thread);
+		vs->thread = NULL;
+	}
+	if(vs->wake) {
+		wDestroySemaphore(vs->wake);
+		vs->wake = NULL;
+	}
+	if(vs->decoder) {
+		stb_vorbis_close(vs->decoder);
+		vs->decoder = NULL;
+	}
+}
@@ -39,6 +39,46 @@ sdlgame:
 	/link /NOLOGO /INCREMENTAL:NO /SUBSYSTEM:CONSOLE /LIBPATH:"usr/lib"\
 		kernel32.lib user32.lib opengl32.lib gdi32.lib wplsdl.lib SDL2.lib
 
+audiorender: 
+	echo Audio render
+	cl /nologo /TC /Zi /MT /Gd /EHsc /W3 /fp:fast $(disabled) \
+		src/audiorender.c /DWPL_SDL_BACKEND \
+		/Fe"usr/bin/audiorender.exe" /Fd"audiorender.pdb" \
+	/link /NOLOGO /INCREMENTAL:NO /SUBSYSTEM:CONSOLE /LIBPATH:"usr/lib"\
+		kernel32.lib user32.lib opengl32.lib gdi32.lib wplsdl.lib SDL2.lib
+
+mixerstress: 
+	echo Mixer stress
+	cl /nologo /TC /Zi /MT /Gd /EHsc /W3 /fp:fast $(disabled) \
+		src/mixerstress.c /DWPL_SDL_BACKEND \
+		/Fe"usr/bin/mixerstress.exe" /Fd"mixerstress.pdb" \
+	/link /NOLOGO /INCREMENTAL:NO /SUBSYSTEM:CONSOLE /LIBPATH:"usr/lib"\
+		kernel32.lib user32.lib opengl32.lib gdi32.lib wplsdl.lib SDL2.lib
+
+segmentcheck: 
+	echo Sprite segment check
+	cl /nologo /TC /Zi /MT /Gd /EHsc /W3 /fp:fast $(disabled) \
+		src/segmentcheck.c /DWPL_SDL_BACKEND \
+		/Fe"usr/bin/segmentcheck.exe" /Fd"segmentcheck.pdb" \
+	/link /NOLOGO /INCREMENTAL:NO /SUBSYSTEM:CONSOLE /LIBPATH:"usr/lib"\
+		kernel32.lib user32.lib opengl32.lib gdi32.lib wplsdl.lib SDL2.lib
+
+bench: 
+	echo Bench
+	cl /nologo /TC /Zi /MT /Gd /EHsc /W3 /fp:fast $(disabled) \
+		src/bench.c /DWPL_SDL_BACKEND \
+		/Fe"usr/bin/bench.exe" /Fd"bench.pdb" \
+	/link /NOLOGO /INCREMENTAL:NO /SUBSYSTEM:CONSOLE /LIBPATH:"usr/lib"\
+		kernel32.lib user32.lib opengl32.lib gdi32.lib wplsdl.lib SDL2.lib
+
+audiodevice: 
+	echo Audio Device
+	cl /nologo /TC /Zi /MT /Gd /EHsc /W3 /fp:fast $(disabled) \
+		src/audiodevice.c /DWPL_SDL_BACKEND \
+		/Fe"usr/bin/audiodevice.exe" /Fd"audiodevice.pdb" \
+	/link /NOLOGO /INCREMENTAL:NO /SUBSYSTEM:CONSOLE /LIBPATH:"usr/lib"\
+		kernel32.lib user32.lib opengl32.lib gdi32.lib wplsdl.lib SDL2.lib
+
 game: 
 	echo Win32 Game
 	cl /nologo /TC /Zi /Gd /EHsc /W3 /F16777216 \